@@ -2,27 +2,331 @@
  * Copyright (C) 1995-2022 Mark Adler
  * For conditions of distribution and use, see copyright notice in zlib.h
  *
- * This interleaved implementation of a CRC makes use of pipelined multiple
- * arithmetic-logic units, commonly found in modern CPU cores. It is due to
- * Kadatch and Jenkins (2010). See doc/crc-doc.1.0.pdf in this distribution.
+ * The portable path is slicing-by-16: 16 bytes are folded into the CRC per
+ * iteration using 16 tables, which keeps several independent table lookups
+ * in flight.  On x86 CPUs with carry-less multiply, blocks of 64 bytes or
+ * more are folded with PCLMULQDQ instead, using the folding constants from
+ * Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+ * Instruction" as adapted by Chromium's zlib.
+ *
+ * crc32.h is generated by compiling this file with MAKECRCH defined and
+ * running the result.
  */
 
 #include <stdint.h>
 #include <stddef.h>
 
+#define POLY 0xedb88320
+
+#ifdef MAKECRCH
+
+#include <stdio.h>
+
+static uint32_t multmodp(uint32_t a, uint32_t b);
+
+int main(void)
+{
+    uint32_t table[16][256];
+    uint32_t x2n[32];
+    uint32_t p;
+    int k, n;
+
+    for (n = 0; n < 256; n++) {
+        p = (uint32_t)n;
+        for (k = 0; k < 8; k++)
+            p = p & 1 ? (p >> 1) ^ POLY : p >> 1;
+        table[0][n] = p;
+    }
+
+    for (k = 1; k < 16; k++)
+        for (n = 0; n < 256; n++)
+            table[k][n] = (table[k - 1][n] >> 8) ^ table[0][table[k - 1][n] & 0xff];
+
+    p = (uint32_t)1 << 30;      /* x^1 */
+    x2n[0] = p;
+    for (n = 1; n < 32; n++)
+        x2n[n] = p = multmodp(p, p);
+
+    printf("/* crc32.h -- tables for rapid CRC calculation\r\n");
+    printf(" * Generated automatically by crc32.c\r\n");
+    printf(" */\r\n\r\n");
+
+    printf("const uint32_t crc_table[16][256] = {\r\n");
+    for (k = 0; k < 16; k++) {
+        printf("  {\r\n");
+        for (n = 0; n < 256; n++)
+            printf("%s0x%08x%s", n % 5 ? "" : "    ", table[k][n], n == 255 ? "\r\n" : (n % 5 == 4 ? ",\r\n" : ", "));
+        printf("  }%s\r\n", k == 15 ? "" : ",");
+    }
+    printf("};\r\n\r\n");
+
+    printf("const uint32_t x2n_table[32] = {\r\n");
+    for (n = 0; n < 32; n++)
+        printf("%s0x%08x%s", n % 5 ? "" : "    ", x2n[n], n == 31 ? "\r\n" : (n % 5 == 4 ? ",\r\n" : ", "));
+    printf("};\r\n");
+
+    return 0;
+}
+
+#else
+
 #include "crc32.h"
-  
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define CRC32_HAVE_PCLMUL   1
+#define CRC32_PCLMUL_TARGET
+#include <intrin.h>
+#include <immintrin.h>
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define CRC32_HAVE_PCLMUL   1
+#define CRC32_PCLMUL_TARGET __attribute__((target("pclmul,sse4.1")))
+#include <cpuid.h>
+#include <immintrin.h>
+#else
+#define CRC32_HAVE_PCLMUL   0
+#endif
+
+/* Smallest input that is worth sending through the carry-less multiply path */
+#define CRC32_PCLMUL_MIN_LEN    64
+
+#endif
+
+/* Multiplies a and b modulo the CRC polynomial, with the bits reflected */
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m, p;
+
+    m = (uint32_t)1 << 31;
+    p = 0;
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0)
+                break;
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ POLY : b >> 1;
+    }
+    return p;
+}
+
+#ifndef MAKECRCH
+
+/* Returns x^(n * 2^k) modulo the CRC polynomial */
+static uint32_t x2nmodp(uint64_t n, unsigned k)
+{
+    uint32_t p;
+
+    p = (uint32_t)1 << 31;      /* x^0 == 1 */
+    while (n) {
+        if (n & 1)
+            p = multmodp(x2n_table[k & 31], p);
+        n >>= 1;
+        k++;
+    }
+    return p;
+}
+
+static uint32_t load32le(const uint8_t *buf)
+{
+    return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+/* Runs on the inverted CRC */
+static uint32_t crc32_slice16(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    while (len >= 16)
+    {
+        uint32_t w0 = crc ^ load32le(buf);
+        uint32_t w1 = load32le(buf + 4);
+        uint32_t w2 = load32le(buf + 8);
+        uint32_t w3 = load32le(buf + 12);
+
+        crc = crc_table[15][w0 & 0xff] ^ crc_table[14][(w0 >> 8) & 0xff] ^ crc_table[13][(w0 >> 16) & 0xff] ^ crc_table[12][w0 >> 24]
+            ^ crc_table[11][w1 & 0xff] ^ crc_table[10][(w1 >> 8) & 0xff] ^ crc_table[9][(w1 >> 16) & 0xff] ^ crc_table[8][w1 >> 24]
+            ^ crc_table[7][w2 & 0xff] ^ crc_table[6][(w2 >> 8) & 0xff] ^ crc_table[5][(w2 >> 16) & 0xff] ^ crc_table[4][w2 >> 24]
+            ^ crc_table[3][w3 & 0xff] ^ crc_table[2][(w3 >> 8) & 0xff] ^ crc_table[1][(w3 >> 16) & 0xff] ^ crc_table[0][w3 >> 24];
+
+        buf += 16;
+        len -= 16;
+    }
+
+    while (len)
+    {
+        len--;
+        crc = (crc >> 8) ^ crc_table[0][(crc ^ *buf++) & 0xff];
+    }
+
+    return crc;
+}
+
+#if CRC32_HAVE_PCLMUL
+
+static int crc32_cpu_has_pclmul(void)
+{
+#if defined(_MSC_VER)
+    int regs[4];
+
+    __cpuid(regs, 1);
+    return ((regs[2] >> 1) & 1) != 0 && ((regs[2] >> 19) & 1) != 0;
+#else
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return 0;
+
+    return (ecx & bit_PCLMUL) != 0 && (ecx & bit_SSE4_1) != 0;
+#endif
+}
+
+/* Runs on the inverted CRC.  len must be at least 64, any remainder past a
+ * multiple of 16 bytes is left for the caller.
+ */
+CRC32_PCLMUL_TARGET
+static uint32_t crc32_pclmul(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    const __m128i k5k0 = _mm_set_epi64x(0x0000000000, 0x0163cd6124);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+
+    x0 = k1k2;
+
+    buf += 64;
+    len -= 64;
+
+    /* Fold 64 bytes at a time into 4 parallel 128-bit accumulators */
+    while (len >= 64)
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+        y5 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+        y6 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+        y7 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+        y8 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+        buf += 64;
+        len -= 64;
+    }
+
+    /* Fold the accumulators into one */
+    x0 = k3k4;
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    /* Fold the remaining whole 16-byte blocks */
+    while (len >= 16)
+    {
+        x2 = _mm_loadu_si128((const __m128i *)buf);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+        buf += 16;
+        len -= 16;
+    }
+
+    /* Fold 128 bits down to 64 */
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x0 = k5k0;
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /* Barrett reduction to 32 bits */
+    x0 = poly;
+
+    x2 = _mm_and_si128(x1, mask32);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, mask32);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+/* -1 until the first call checks the CPU.  Racing threads store the same
+ * value, so no synchronization is needed.
+ */
+static volatile int crc32_use_pclmul = -1;
+
+#endif
+
 uint32_t crc32(uint32_t crc, const void *vbuf, size_t len)
 {
     const uint8_t *buf = (const uint8_t *)vbuf;
 
     crc = crc ^ 0xffffffff;
 
-    while (len)
+#if CRC32_HAVE_PCLMUL
+    if (len >= CRC32_PCLMUL_MIN_LEN)
     {
-        len--;
-        crc = (crc >> 8) ^ crc_table[(crc ^ *buf++) & 0xff];
+        int usePCLMUL = crc32_use_pclmul;
+        if (usePCLMUL < 0)
+            crc32_use_pclmul = usePCLMUL = crc32_cpu_has_pclmul();
+
+        if (usePCLMUL)
+        {
+            size_t chunkLen = len & ~(size_t)15;
+
+            crc = crc32_pclmul(crc, buf, chunkLen);
+            buf += chunkLen;
+            len -= chunkLen;
+        }
     }
+#endif
+
+    crc = crc32_slice16(crc, buf, len);
 
     return crc ^ 0xffffffff;
 }
+
+/* Returns the CRC of two blocks concatenated, given the CRC of each block
+ * and the length of the second, so that chunks can be checksummed
+ * independently.
+ */
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, size_t len2)
+{
+    return multmodp(x2nmodp((uint64_t)len2, 3), crc1) ^ crc2;
+}
+
+#endif
@@ -13,6 +13,12 @@ the included LICENSE.txt file.
 #include "zdict.h"
 #include "gstdenc.h"
 #include "libdeflate.h"
+#include "common/xxhash.h"
+
+extern "C"
+{
+#include "compress/hist.h"
+}
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -20,19 +26,40 @@ the included LICENSE.txt file.
 #include <stddef.h>
 #include <thread>
 #include <mutex>
+#include <chrono>
 #include <vector>
+#include <algorithm>
+#include <atomic>
 #include <limits>
+#include <unordered_map>
+#include <random>
+#include <string>
 
 #include <stdarg.h>
+#include <math.h>
 
 #include "gstddec_public_constants.h"
+#include "gstddec_cpu.h"
+#include "gstd_trace.h"
+#include "gstd_fileio.h"
+#include "gstd_archive.h"
+#include "gstd_crc32.h"
+#include "gstd_page_cache.h"
+#include "gstd_archive_reader.h"
 
 struct ThreadedTaskWorkerState;
 struct SerializedTaskGlobalState;
 struct SerializedTaskWorkerState;
 
-extern void DecompressGstdCPU32(const void *inData, uint32_t inSize, void *outData, uint32_t outCapacity, void *warnContext, void (*warnCallback)(void *, const char *), void *diagContext, void (*diagCallback)(void *, const char *, ...));
-extern "C" uint32_t crc32(uint32_t crc, const void *buf, size_t len);
+// Locks a mutex, recording the wait in the trace if the mutex was contended
+void LockWithTrace(std::unique_lock<std::mutex> &lock, TraceRecorder *traceRecorder, const char *waitName)
+{
+	if (lock.try_lock())
+		return;
+
+	TraceScope traceScope(traceRecorder, waitName);
+	lock.lock();
+}
 
 class AutoResetEvent
 {
@@ -150,6 +177,7 @@ struct SerializedTaskGlobalState
 	~SerializedTaskGlobalState();
 
 	void SetTaskRunner(size_t index, ThreadedTaskBase *taskRunner);
+	void SetTraceRecorder(TraceRecorder *traceRecorder);
 	void RunThread(size_t index);
 	void WaitForCompletion(size_t index);
 
@@ -168,6 +196,8 @@ struct SerializedTaskGlobalState
 	Semaphore m_kickSemaphore;
 	Semaphore m_finishWorkSemaphore;
 
+	TraceRecorder *m_traceRecorder;
+
 private:
 	struct TaskBucket
 	{
@@ -191,11 +221,13 @@ struct SerializedTaskWorkerState
 	SerializedTaskGlobalState *m_globalState;
 	ThreadedTaskBase *m_taskRunner;
 	AutoResetEvent m_finalizeEvent;
+
+	char m_traceThreadName[32];
 };
 
 
 SerializedTaskGlobalState::SerializedTaskGlobalState(size_t numTasks, size_t numWorkers)
-	: m_numTasks(numTasks), m_numWorkers(numWorkers), m_tasksStarted(0), m_tasksCompleted(0), m_numWorkersActive(0)
+	: m_numTasks(numTasks), m_numWorkers(numWorkers), m_tasksStarted(0), m_tasksCompleted(0), m_numWorkersActive(0), m_traceRecorder(nullptr)
 {
 	m_workers = new SerializedTaskWorkerState[numWorkers];
 	m_taskQueue = new TaskBucket[numWorkers];
@@ -221,12 +253,24 @@ void SerializedTaskGlobalState::SetTaskRunner(size_t index, ThreadedTaskBase *ta
 	m_workers[index].m_taskRunner = taskRunner;
 }
 
+void SerializedTaskGlobalState::SetTraceRecorder(TraceRecorder *traceRecorder)
+{
+	m_traceRecorder = traceRecorder;
+}
+
 void SerializedTaskGlobalState::RunThread(size_t workerIndex)
 {
 	SerializedTaskWorkerState *workerState = m_workers + workerIndex;
 
+	if (m_traceRecorder)
 	{
-		std::lock_guard<std::mutex> lock(m_taskQueueMutex);
+		snprintf(workerState->m_traceThreadName, sizeof(workerState->m_traceThreadName), "Worker %zu", workerIndex);
+		m_traceRecorder->SetThreadName(workerState->m_traceThreadName);
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(m_taskQueueMutex, std::defer_lock);
+		LockWithTrace(lock, m_traceRecorder, "queue-lock-wait");
 
 		workerState->m_started = true;
 		m_numWorkersActive++;
@@ -234,12 +278,15 @@ void SerializedTaskGlobalState::RunThread(size_t workerIndex)
 
 	for (;;)
 	{
+		TraceBegin(m_traceRecorder, "kick-wait");
 		m_kickSemaphore.Acquire();
+		TraceEnd(m_traceRecorder);
 
 		size_t thisWorkUnit = 0;
 
 		{
-			std::lock_guard<std::mutex> lock(m_taskQueueMutex);
+			std::unique_lock<std::mutex> lock(m_taskQueueMutex, std::defer_lock);
+			LockWithTrace(lock, m_traceRecorder, "queue-lock-wait");
 			if (m_tasksStarted == m_numTasks || workerState->m_terminated)
 			{
 				m_kickSemaphore.Release();
@@ -260,7 +307,8 @@ void SerializedTaskGlobalState::RunThread(size_t workerIndex)
 		bool shouldWaitForCompletionKick = false;
 
 		{
-			std::lock_guard<std::mutex> lock(m_taskQueueMutex);
+			std::unique_lock<std::mutex> lock(m_taskQueueMutex, std::defer_lock);
+			LockWithTrace(lock, m_traceRecorder, "queue-lock-wait");
 			size_t relativeIndex = thisWorkUnit - m_tasksCompleted;
 
 			m_taskQueue[relativeIndex].m_isFinished = true;
@@ -269,12 +317,19 @@ void SerializedTaskGlobalState::RunThread(size_t workerIndex)
 		}
 
 		if (shouldWaitForCompletionKick)
+		{
+			TraceScope traceScope(m_traceRecorder, "finalize-wait");
 			workerState->m_finalizeEvent.WaitFor();
+		}
 
-		workerState->m_taskRunner->FinishWritingWorkUnit();
+		{
+			TraceScope traceScope(m_traceRecorder, "finalize");
+			workerState->m_taskRunner->FinishWritingWorkUnit();
+		}
 
 		{
-			std::lock_guard<std::mutex> lock(m_taskQueueMutex);
+			std::unique_lock<std::mutex> lock(m_taskQueueMutex, std::defer_lock);
+			LockWithTrace(lock, m_traceRecorder, "queue-lock-wait");
 
 			m_tasksCompleted++;
 
@@ -293,7 +348,8 @@ void SerializedTaskGlobalState::RunThread(size_t workerIndex)
 	bool isLastOut = false;
 
 	{
-		std::lock_guard<std::mutex> lock(m_taskQueueMutex);
+		std::unique_lock<std::mutex> lock(m_taskQueueMutex, std::defer_lock);
+		LockWithTrace(lock, m_traceRecorder, "queue-lock-wait");
 		m_numWorkersActive--;
 
 		isLastOut = (m_numWorkersActive == 0);
@@ -333,18 +389,66 @@ void PrintUsageAndQuit()
 	fprintf(stderr, "    gstd <mode> <options> <input> <output>\n");
 	fprintf(stderr, "Modes:\n");
 	fprintf(stderr, "    c - Compresses input to output\n");
+	fprintf(stderr, "    u - Compresses input to output, copying pages that are unchanged from the -base archive\n");
 	fprintf(stderr, "    d - Decompresses input to output\n");
+	fprintf(stderr, "    v - Verifies that every page of input decodes and matches its checksum, takes no output\n");
+	fprintf(stderr, "    r - Reads random ranges of input through the archive reader from several threads and compares\n");
+	fprintf(stderr, "        them against output, which is the original uncompressed file\n");
 	fprintf(stderr, "    p - Exports Gstd predefined tables\n");
+	fprintf(stderr, "    b - Benchmarks compression stages and decoders on input, writes CSV to output\n");
 	fprintf(stderr, "Compression options:\n");
-	fprintf(stderr, "    -pagesize <size> - Sets the size of a page (default is 65536 bytes)\n");
+	fprintf(stderr, "    -pagesize <size> - Sets the size of a page, up to 16MB (default is 65536 bytes).  16MB pages\n");
+	fprintf(stderr, "                       require 32 lanes and CRC-32 checksums and don't use page records.\n");
 	fprintf(stderr, "    -level <level>   - Sets compression level (default is 9)\n");
 	fprintf(stderr, "    -t <threads>     - Sets maximum thread count\n");
+	fprintf(stderr, "    -lanes <count>   - Sets the parallelism level to 8, 16, 32, or 64 lanes (default is 32)\n");
+	fprintf(stderr, "    -checksum <type> - Sets the page checksum to crc32 or xxh64 (default is crc32)\n");
 	fprintf(stderr, "    -isolate <block> - Compresses only a specific block\n");
 	fprintf(stderr, "    -f <path>        - Sets path to output failed blocks to (for debugging)\n");
 	fprintf(stderr, "    -nofseshuffle    - Disables FSE table shuffling\n");
+	fprintf(stderr, "    -dedup           - Replaces pages that duplicate an earlier page with a reference\n");
+	fprintf(stderr, "    -skipincompressible <margin> - Stores pages without compressing them if their estimated\n");
+	fprintf(stderr, "                       entropy isn't at least <margin> percent below the page size\n");
+	fprintf(stderr, "    -search <list>   - Tries each candidate in a comma-separated list and keeps the smallest page.\n");
+	fprintf(stderr, "                       z<level> is zstd, optionally followed by s<strategy>, w<window log>,\n");
+	fprintf(stderr, "                       and b to enable the block splitter.  d<level> is libdeflate.\n");
+	fprintf(stderr, "    -searchbudget <us> - Stops trying candidates on a page after this many microseconds\n");
+	fprintf(stderr, "    -targetrate <MB/s> - Adjusts the level as pages are compressed to hold this throughput,\n");
+	fprintf(stderr, "                       never going above -level.  With -search, adjusts the number of candidates.\n");
+	fprintf(stderr, "    -deadline <seconds> - Like -targetrate, but aims to finish the file within a time limit\n");
+	fprintf(stderr, "    -cache <dir>     - Reuses compressed pages from a cache directory and adds new ones to it\n");
+	fprintf(stderr, "    -stats <file>    - Writes per-page statistics, as JSON if the file ends in .json, otherwise CSV.\n");
+	fprintf(stderr, "                       Block, literal, and sequence counts are from the zstd frame before transcoding.\n");
+	fprintf(stderr, "    -trace <file>    - Writes a chrome://tracing timeline of the worker threads\n");
+	fprintf(stderr, "Update options, in addition to the compression options:\n");
+	fprintf(stderr, "    -base <archive>  - Archive of the previous version of the input, required.  Its page size, lane\n");
+	fprintf(stderr, "                       count, and checksum type are used unless they are set by options.\n");
 	fprintf(stderr, "Decompression options:\n");
 	fprintf(stderr, "    -dmg             - Output the contents of damaged blocks\n");
 	fprintf(stderr, "    -diag <file>     - Emit diagnostics (debug builds only)\n");
+	fprintf(stderr, "    -perf            - Print decoder performance counters (GSTDDEC_PERF_COUNTERS builds only)\n");
+	fprintf(stderr, "    -lanesim         - Print lane utilization and estimated wave cycles per page (GSTDDEC_PERF_COUNTERS builds only)\n");
+	fprintf(stderr, "    -skipstoredchecks - Don't check the checksums of stored pages that are copied directly between files.\n");
+	fprintf(stderr, "                       Without it, copied pages are read back to be checked, so they aren't zero-copy.\n");
+	fprintf(stderr, "    -mmap            - Decode pages in parallel directly into a memory-mapped output file\n");
+	fprintf(stderr, "    -range <offset> <size> - Decodes only the pages covering a range of the decompressed data\n");
+	fprintf(stderr, "    -t <threads>     - Sets maximum thread count for -mmap and -range, and for checksumming large pages\n");
+	fprintf(stderr, "Verify options:\n");
+	fprintf(stderr, "    -t <threads>     - Sets maximum thread count\n");
+	fprintf(stderr, "Random read options:\n");
+	fprintf(stderr, "    -t <threads>     - Sets the number of threads issuing reads (default is 4)\n");
+	fprintf(stderr, "    -decoders <count> - Sets the number of decoder threads in the reader (default is 2)\n");
+	fprintf(stderr, "    -cache <bytes>   - Sets the reader's cache budget (default is 16MB)\n");
+	fprintf(stderr, "    -readahead <pages> - Sets the number of pages decoded ahead of sequential reads (default is 4)\n");
+	fprintf(stderr, "    -reads <count>   - Sets the number of reads per thread (default is 10000)\n");
+	fprintf(stderr, "    -maxread <bytes> - Sets the largest read size (default is 262144)\n");
+	fprintf(stderr, "Benchmark options:\n");
+	fprintf(stderr, "    -pagesize <size> - Sets the size of a page (default is 65536 bytes)\n");
+	fprintf(stderr, "    -levels <list>   - Comma-separated compression levels to measure\n");
+	fprintf(stderr, "    -lanes <list>    - Comma-separated lane counts to measure\n");
+	fprintf(stderr, "    -threads <list>  - Comma-separated thread counts to measure\n");
+	fprintf(stderr, "    -passes <count>  - Number of decompression passes over the input\n");
+	fprintf(stderr, "    -nofseshuffle    - Disables FSE table shuffling\n");
 
 	exit(-1);
 }
@@ -354,6 +458,120 @@ void DecompressWarn(void *context, const char *str)
 	fprintf(stderr, "Decompressor threw warning for block %i: %s\n", *static_cast<int*>(context), str);
 }
 
+void AccumulatePerfCounters(gstd_PerfCounters_t &total, const gstd_PerfCounters_t &page)
+{
+	total.m_enabled |= page.m_enabled;
+	total.m_vectorWidth = std::max(total.m_vectorWidth, page.m_vectorWidth);
+
+	for (int i = 0; i < GSTD_PERF_MAX_LANES; i++)
+		total.m_refillsPerLane[i] += page.m_refillsPerLane[i];
+
+	total.m_laneDecodeSteps += page.m_laneDecodeSteps;
+	total.m_laneDecodeActiveLanes += page.m_laneDecodeActiveLanes;
+	total.m_huffmanLiterals += page.m_huffmanLiterals;
+	total.m_rawLiterals += page.m_rawLiterals;
+	total.m_rleLiterals += page.m_rleLiterals;
+	total.m_matches += page.m_matches;
+
+	for (int i = 0; i < GSTD_PERF_OFFSET_CLASS_COUNT; i++)
+		total.m_matchBytesByOffsetClass[i] += page.m_matchBytesByOffsetClass[i];
+
+	total.m_huffmanTableBuilds += page.m_huffmanTableBuilds;
+	total.m_fseTableBuilds += page.m_fseTableBuilds;
+
+	for (int i = 0; i < GSTD_PERF_PHASE_COUNT; i++)
+		total.m_phaseNanoseconds[i] += page.m_phaseNanoseconds[i];
+
+	total.m_vectorRegions += page.m_vectorRegions;
+	total.m_vectorRegionActiveLanes += page.m_vectorRegionActiveLanes;
+	total.m_vectorRegionsSkipped += page.m_vectorRegionsSkipped;
+	total.m_refillSteps += page.m_refillSteps;
+
+	for (int i = 0; i < GSTD_PERF_SERIAL_STEP_COUNT; i++)
+		total.m_serialSteps[i] += page.m_serialSteps[i];
+}
+
+// Coarse wave cost model, for comparing encodings against each other rather than predicting GPU time.
+// Every vector region and rotating decode step costs one wave cycle however many lanes are active, a
+// skipped region costs a uniform branch, and a refill costs a memory load that is only partly hidden.
+// Serial steps are charged for their loop overhead, the vector work inside them is counted separately.
+const uint64_t kWaveCyclesPerVectorRegion = 1;
+const uint64_t kWaveCyclesPerSkippedRegion = 1;
+const uint64_t kWaveCyclesPerDecodeStep = 1;
+const uint64_t kWaveCyclesPerRefill = 8;
+const uint64_t kWaveCyclesPerSerialStep = 2;
+
+uint64_t EstimateWaveCycles(const gstd_PerfCounters_t &counters)
+{
+	uint64_t cycles = counters.m_vectorRegions * kWaveCyclesPerVectorRegion
+		+ counters.m_vectorRegionsSkipped * kWaveCyclesPerSkippedRegion
+		+ counters.m_laneDecodeSteps * kWaveCyclesPerDecodeStep
+		+ counters.m_refillSteps * kWaveCyclesPerRefill;
+
+	for (int i = 0; i < GSTD_PERF_SERIAL_STEP_COUNT; i++)
+		cycles += counters.m_serialSteps[i] * kWaveCyclesPerSerialStep;
+
+	return cycles;
+}
+
+double LaneUtilizationPercent(uint64_t activeLanes, uint64_t steps, uint32_t vectorWidth)
+{
+	uint64_t laneSlots = steps * vectorWidth;
+
+	return laneSlots ? (100.0 * activeLanes / laneSlots) : 0.0;
+}
+
+void PrintLaneSimPage(int pageIndex, uint32_t uncompressedSize, const gstd_PerfCounters_t &counters)
+{
+	uint64_t waveCycles = EstimateWaveCycles(counters);
+
+	fprintf(stderr, "Page %i: %llu wave cycles (%.2f bytes/cycle), region utilization %.1f%% over %llu regions (%llu skipped), decode utilization %.1f%% over %llu steps, %llu refills, serial steps %llu sequence %llu broadcast %llu scatter\n",
+		pageIndex, static_cast<unsigned long long>(waveCycles), waveCycles ? (static_cast<double>(uncompressedSize) / waveCycles) : 0.0,
+		LaneUtilizationPercent(counters.m_vectorRegionActiveLanes, counters.m_vectorRegions, counters.m_vectorWidth),
+		static_cast<unsigned long long>(counters.m_vectorRegions), static_cast<unsigned long long>(counters.m_vectorRegionsSkipped),
+		LaneUtilizationPercent(counters.m_laneDecodeActiveLanes, counters.m_laneDecodeSteps, counters.m_vectorWidth),
+		static_cast<unsigned long long>(counters.m_laneDecodeSteps), static_cast<unsigned long long>(counters.m_refillSteps),
+		static_cast<unsigned long long>(counters.m_serialSteps[GSTD_PERF_SERIAL_STEP_SEQUENCE_EXECUTE]),
+		static_cast<unsigned long long>(counters.m_serialSteps[GSTD_PERF_SERIAL_STEP_HUFFMAN_BROADCAST]),
+		static_cast<unsigned long long>(counters.m_serialSteps[GSTD_PERF_SERIAL_STEP_HUFFMAN_SCATTER]));
+}
+
+void PrintPerfCounters(const gstd_PerfCounters_t &counters)
+{
+	if (!counters.m_enabled)
+	{
+		fprintf(stderr, "Performance counters are not available, rebuild with GSTDDEC_PERF_COUNTERS=1\n");
+		return;
+	}
+
+	static const char *phaseNames[GSTD_PERF_PHASE_COUNT] = { "Lit table", "FSE tables", "Sequences", "Execute" };
+	static const char *offsetClassNames[GSTD_PERF_OFFSET_CLASS_COUNT] = { "<16", "<256", "<4K", "<64K", "Far" };
+
+	fprintf(stderr, "Lane occupancy: %.1f%% over %llu decode steps\n", LaneUtilizationPercent(counters.m_laneDecodeActiveLanes, counters.m_laneDecodeSteps, counters.m_vectorWidth), static_cast<unsigned long long>(counters.m_laneDecodeSteps));
+	fprintf(stderr, "Region utilization: %.1f%% over %llu vector regions, %llu skipped\n", LaneUtilizationPercent(counters.m_vectorRegionActiveLanes, counters.m_vectorRegions, counters.m_vectorWidth), static_cast<unsigned long long>(counters.m_vectorRegions), static_cast<unsigned long long>(counters.m_vectorRegionsSkipped));
+	fprintf(stderr, "Serial steps: %llu sequence, %llu Huffman broadcast, %llu Huffman scatter\n", static_cast<unsigned long long>(counters.m_serialSteps[GSTD_PERF_SERIAL_STEP_SEQUENCE_EXECUTE]), static_cast<unsigned long long>(counters.m_serialSteps[GSTD_PERF_SERIAL_STEP_HUFFMAN_BROADCAST]), static_cast<unsigned long long>(counters.m_serialSteps[GSTD_PERF_SERIAL_STEP_HUFFMAN_SCATTER]));
+	fprintf(stderr, "Refill steps: %llu\n", static_cast<unsigned long long>(counters.m_refillSteps));
+	fprintf(stderr, "Estimated wave cycles: %llu\n", static_cast<unsigned long long>(EstimateWaveCycles(counters)));
+	fprintf(stderr, "Literals: %llu Huffman, %llu raw, %llu RLE\n", static_cast<unsigned long long>(counters.m_huffmanLiterals), static_cast<unsigned long long>(counters.m_rawLiterals), static_cast<unsigned long long>(counters.m_rleLiterals));
+	fprintf(stderr, "Matches: %llu\n", static_cast<unsigned long long>(counters.m_matches));
+
+	for (int i = 0; i < GSTD_PERF_OFFSET_CLASS_COUNT; i++)
+		fprintf(stderr, "    Offset %-5s %llu bytes\n", offsetClassNames[i], static_cast<unsigned long long>(counters.m_matchBytesByOffsetClass[i]));
+
+	fprintf(stderr, "Table builds: %u Huffman, %u FSE\n", counters.m_huffmanTableBuilds, counters.m_fseTableBuilds);
+
+	for (int i = 0; i < GSTD_PERF_PHASE_COUNT; i++)
+		fprintf(stderr, "Phase %-12s %.3f ms\n", phaseNames[i], counters.m_phaseNanoseconds[i] / 1000000.0);
+
+	fprintf(stderr, "Refills per lane:");
+	for (int i = 0; i < GSTD_PERF_MAX_LANES; i++)
+	{
+		if (counters.m_refillsPerLane[i])
+			fprintf(stderr, " %llu", static_cast<unsigned long long>(counters.m_refillsPerLane[i]));
+	}
+	fprintf(stderr, "\n");
+}
+
 void DecompressDiag(void *context, const char *fmt, ...)
 {
 	va_list args;
@@ -366,10 +584,293 @@ void DecompressDiag(void *context, const char *fmt, ...)
 	fflush(static_cast<FILE *>(context));
 }
 
+struct PageFailure
+{
+	size_t m_pageIndex;
+	uint64_t m_expectedChecksum;
+	uint64_t m_actualChecksum;
+};
+
+bool PageFailureLess(const PageFailure &a, const PageFailure &b)
+{
+	return a.m_pageIndex < b.m_pageIndex;
+}
+
+// Shared state for decoding an indexed archive straight into a mapped output file.  Every page's
+// output location is known from the index, so workers take pages in any order.  Page references are
+// copied from their decoded pages in a second pass.
+class MappedDecompressGlobal
+{
+public:
+	MappedDecompressGlobal(const ArchiveIndex &index, const uint8_t *archiveData, uint8_t *outData, bool writeDamaged);
+
+	void RunWorker();
+	void RunReferenceWorker();
+
+	// Must be called between the passes, with no workers running
+	void StartReferencePass();
+
+	std::vector<PageFailure> &Failures();
+
+private:
+	const ArchiveIndex &m_index;
+	const uint8_t *m_archiveData;
+	uint8_t *m_outData;
+	bool m_writeDamaged;
+
+	// Pages only start 4-byte aligned in the output if the page size is a multiple of 4
+	bool m_decodeInPlace;
+
+	std::atomic<size_t> m_nextPage;
+
+	// Each page's flag is only written by the worker that decodes it
+	std::vector<uint8_t> m_pageFailed;
+
+	std::mutex m_failureMutex;
+	std::vector<PageFailure> m_failures;
+};
+
+MappedDecompressGlobal::MappedDecompressGlobal(const ArchiveIndex &index, const uint8_t *archiveData, uint8_t *outData, bool writeDamaged)
+	: m_index(index), m_archiveData(archiveData), m_outData(outData), m_writeDamaged(writeDamaged), m_decodeInPlace((index.m_header.m_pageSize & 3u) == 0), m_nextPage(0)
+	, m_pageFailed(index.m_pages.size(), 0)
+{
+}
+
+void MappedDecompressGlobal::StartReferencePass()
+{
+	m_nextPage = 0;
+}
+
+void MappedDecompressGlobal::RunReferenceWorker()
+{
+	for (;;)
+	{
+		size_t pageIndex = m_nextPage.fetch_add(1, std::memory_order_relaxed);
+		if (pageIndex >= m_index.m_pages.size())
+			break;
+
+		const ArchivePageEntry &page = m_index.m_pages[pageIndex];
+		if (page.m_recordType != kArchiveRecordPageReference)
+			continue;
+
+		const ArchivePageEntry &referencedPage = m_index.m_pages[page.m_recordPayload];
+
+		// The index already checked that the checksums match, so a reference fails only with its page
+		if (m_pageFailed[page.m_recordPayload])
+		{
+			PageFailure failure;
+			failure.m_pageIndex = pageIndex;
+			failure.m_expectedChecksum = page.m_checksum;
+			failure.m_actualChecksum = 0;
+
+			std::lock_guard<std::mutex> lock(m_failureMutex);
+			m_failures.push_back(failure);
+		}
+
+		memcpy(m_outData + page.m_outputOffset, m_outData + referencedPage.m_outputOffset, page.m_uncompressedSize);
+	}
+}
+
+void MappedDecompressGlobal::RunWorker()
+{
+	std::vector<uint8_t> stagingBuffer;
+	std::vector<uint8_t> unalignedPage;
+
+	if (!m_decodeInPlace)
+		unalignedPage.resize(m_index.m_header.m_pageSize + 3);
+
+	for (;;)
+	{
+		size_t pageIndex = m_nextPage.fetch_add(1, std::memory_order_relaxed);
+		if (pageIndex >= m_index.m_pages.size())
+			break;
+
+		const ArchivePageEntry &page = m_index.m_pages[pageIndex];
+		int blockIndex = static_cast<int>(pageIndex);
+
+		if (page.m_recordType == kArchiveRecordPageReference)
+			continue;
+
+		// A fresh mapping is zero-filled, so in-place pages need no clearing.  If the output size isn't a
+		// multiple of 4, the last page's rounding bytes land in the same memory page past the end of the file.
+		uint8_t *pageOutData = m_outData + page.m_outputOffset;
+		if (!m_decodeInPlace)
+		{
+			pageOutData = &unalignedPage[0];
+			memset(pageOutData, 0, (page.m_uncompressedSize + 3u) & ~static_cast<uint32_t>(3u));
+		}
+
+		uint64_t actualChecksum = 0;
+		bool checksumOK = DecodeArchivePage(m_index.m_header, page, m_archiveData + page.m_storedOffset, stagingBuffer, pageOutData, actualChecksum, &blockIndex, DecompressWarn);
+
+		if (!checksumOK)
+		{
+			m_pageFailed[pageIndex] = 1;
+
+			PageFailure failure;
+			failure.m_pageIndex = pageIndex;
+			failure.m_expectedChecksum = page.m_checksum;
+			failure.m_actualChecksum = actualChecksum;
+
+			{
+				std::lock_guard<std::mutex> lock(m_failureMutex);
+				m_failures.push_back(failure);
+			}
+
+			if (!m_writeDamaged)
+			{
+				memset(m_outData + page.m_outputOffset, 0, page.m_uncompressedSize);
+				continue;
+			}
+		}
+
+		if (!m_decodeInPlace)
+			memcpy(m_outData + page.m_outputOffset, pageOutData, page.m_uncompressedSize);
+	}
+}
+
+std::vector<PageFailure> &MappedDecompressGlobal::Failures()
+{
+	return m_failures;
+}
+
+// Indexes the archive, sizes and maps the output file, then decodes every page into its final location
+int DecompressMapped(const char *inFileName, const char *outFileName, unsigned int numThreads, bool writeDamaged)
+{
+	FILE *inF = fopen(inFileName, "rb");
+	if (!inF)
+	{
+		fprintf(stderr, "Failed to open input file\n");
+		return -1;
+	}
+
+	ArchiveIndex index;
+	bool indexed = BuildArchiveIndex(inF, index);
+	fclose(inF);
+
+	if (!indexed)
+		return -1;
+
+	MappedFile archiveMap;
+	if (!archiveMap.OpenRead(inFileName))
+	{
+		fprintf(stderr, "Failed to map input file\n");
+		return -1;
+	}
+
+	MappedFile outMap;
+	if (!outMap.CreateReadWrite(outFileName, index.m_uncompressedSize))
+	{
+		fprintf(stderr, "Failed to create mapped output file or allocate its disk space\n");
+		return -1;
+	}
+
+	if (numThreads < 1)
+		numThreads = 1;
+
+	MappedDecompressGlobal mglobal(index, archiveMap.Data(), outMap.Data(), writeDamaged);
+
+	std::vector<std::thread> threads;
+	for (unsigned int i = 1; i < numThreads; i++)
+		threads.push_back(std::thread(&MappedDecompressGlobal::RunWorker, &mglobal));
+
+	mglobal.RunWorker();
+
+	for (std::thread &thread : threads)
+		thread.join();
+
+	threads.clear();
+	mglobal.StartReferencePass();
+
+	for (unsigned int i = 1; i < numThreads; i++)
+		threads.push_back(std::thread(&MappedDecompressGlobal::RunReferenceWorker, &mglobal));
+
+	mglobal.RunReferenceWorker();
+
+	for (std::thread &thread : threads)
+		thread.join();
+
+	std::vector<PageFailure> &failures = mglobal.Failures();
+	if (failures.empty())
+		return 0;
+
+	std::sort(failures.begin(), failures.end(), PageFailureLess);
+
+	for (const PageFailure &failure : failures)
+		fprintf(stderr, "Error in block %llu: Expected checksum %llx but checksum was %llx\n", static_cast<unsigned long long>(failure.m_pageIndex), static_cast<unsigned long long>(failure.m_expectedChecksum), static_cast<unsigned long long>(failure.m_actualChecksum));
+
+	return -1;
+}
+
+// Decodes only the pages covering a range of the decompressed data and writes the range to the output
+int DecompressRange(const char *inFileName, const char *outFileName, uint64_t offset, uint64_t size, unsigned int numThreads)
+{
+	FILE *inF = fopen(inFileName, "rb");
+	if (!inF)
+	{
+		fprintf(stderr, "Failed to open input file\n");
+		return -1;
+	}
+
+	ArchiveIndex index;
+	bool indexed = BuildArchiveIndex(inF, index);
+	fclose(inF);
+
+	if (!indexed)
+		return -1;
+
+	if (offset > index.m_uncompressedSize || size > index.m_uncompressedSize - offset)
+	{
+		fprintf(stderr, "Range is past the end of the decompressed data, which is %llu bytes\n", static_cast<unsigned long long>(index.m_uncompressedSize));
+		return -1;
+	}
+
+	MappedFile archiveMap;
+	if (!archiveMap.OpenRead(inFileName))
+	{
+		fprintf(stderr, "Failed to map input file\n");
+		return -1;
+	}
+
+	std::vector<uint8_t> rangeData(static_cast<size_t>(size));
+
+	int numFailed = DecompressArchiveRange(index, archiveMap.Data(), offset, size, rangeData.empty() ? nullptr : &rangeData[0], numThreads);
+	if (numFailed != 0)
+	{
+		fprintf(stderr, "%i pages in the range failed their checksums\n", numFailed);
+		return -1;
+	}
+
+	FILE *outF = fopen(outFileName, "wb");
+	if (!outF)
+	{
+		fprintf(stderr, "Failed to open output file\n");
+		return -1;
+	}
+
+	if (!rangeData.empty())
+		fwrite(&rangeData[0], 1, rangeData.size(), outF);
+
+	fclose(outF);
+
+	return 0;
+}
+
 int DecompressMain(int optc, const char **optv, const char *inFileName, const char *outFileName)
 {
 	FILE *diagF = nullptr;
 	bool writeDamaged = false;
+	bool printPerf = false;
+	bool laneSim = false;
+	bool verifyStored = true;
+	bool mmapOutput = false;
+	bool rangeOutput = false;
+	unsigned long long rangeOffset = 0;
+	unsigned long long rangeSize = 0;
+	unsigned int numThreads = std::thread::hardware_concurrency();
+
+	gstd_PerfCounters_t totalPerfCounters;
+	memset(&totalPerfCounters, 0, sizeof(totalPerfCounters));
 
 	for (int i = 0; i < optc; i++)
 	{
@@ -398,6 +899,43 @@ int DecompressMain(int optc, const char **optv, const char *inFileName, const ch
 		}
 		else if (!strcmp(optName, "-dmg"))
 			writeDamaged = true;
+		else if (!strcmp(optName, "-perf"))
+			printPerf = true;
+		else if (!strcmp(optName, "-lanesim"))
+			laneSim = true;
+		else if (!strcmp(optName, "-skipstoredchecks"))
+			verifyStored = false;
+		else if (!strcmp(optName, "-mmap"))
+			mmapOutput = true;
+		else if (!strcmp(optName, "-range"))
+		{
+			if (optc - i < 3 || !sscanf(optv[i + 1], "%llu", &rangeOffset) || !sscanf(optv[i + 2], "%llu", &rangeSize))
+			{
+				fprintf(stderr, "Expected offset and size for -range");
+				return -1;
+			}
+
+			i += 2;
+			rangeOutput = true;
+		}
+		else if (!strcmp(optName, "-t"))
+		{
+			i++;
+			if (i == optc)
+			{
+				fprintf(stderr, "Expected thread count for -t");
+				return -1;
+			}
+
+			int numThreadsInt = atoi(optv[i]);
+			if (numThreadsInt < 1)
+			{
+				fprintf(stderr, "Invalid thread count");
+				return -1;
+			}
+
+			numThreads = static_cast<unsigned int>(numThreadsInt);
+		}
 		else
 		{
 			fprintf(stderr, "Invalid option %s", optName);
@@ -405,6 +943,20 @@ int DecompressMain(int optc, const char **optv, const char *inFileName, const ch
 		}
 	}
 
+	if (mmapOutput || rangeOutput)
+	{
+		if (diagF || printPerf || laneSim || (mmapOutput && rangeOutput))
+		{
+			fprintf(stderr, "-mmap and -range can't be combined with each other or with -diag, -perf, or -lanesim");
+			return -1;
+		}
+
+		if (rangeOutput)
+			return DecompressRange(inFileName, outFileName, rangeOffset, rangeSize, numThreads);
+
+		return DecompressMapped(inFileName, outFileName, numThreads, writeDamaged);
+	}
+
 	FILE *inF = fopen(inFileName, "rb");
 	if (!inF)
 	{
@@ -412,110 +964,162 @@ int DecompressMain(int optc, const char **optv, const char *inFileName, const ch
 		return -1;
 	}
 
-	FILE *outF = fopen(outFileName, "wb");
-	if (!inF)
+	// The output is also read so that page references can copy earlier pages
+	FILE *outF = fopen(outFileName, "w+b");
+	if (!outF)
 	{
 		fprintf(stderr, "Failed to open output file\n");
+		fclose(inF);
 		return -1;
 	}
 
-	uint8_t sizeBytes[4];
-	size_t bytesRead = fread(sizeBytes, 1, 4, inF);
-
-	if (bytesRead != 4)
-	{
-		fprintf(stderr, "Failed to read page size");
+	ArchiveHeader archiveHeader;
+	if (!ReadArchiveHeader(inF, archiveHeader))
 		return -1;
-	}
 
-	uint32_t pageSize = sizeBytes[0] | (static_cast<uint32_t>(sizeBytes[1]) << 8) | (static_cast<uint32_t>(sizeBytes[2]) << 16) | (static_cast<uint32_t>(sizeBytes[3]) << 24);
+	uint32_t numLanes = archiveHeader.m_numLanes;
+	PageChecksumType checksumType = archiveHeader.m_checksumType;
 
-	if (pageSize > 16 * 1024 * 1024)
-	{
-		fprintf(stderr, "Page size too large");
-		return -1;
-	}
+	// Stored pages are copied by the kernel when possible.  Unless -skipstoredchecks is set, their checksums
+	// are still checked afterward by reading the copied range back from the input, which normally hits the
+	// page cache, so only -skipstoredchecks keeps the data out of user space entirely.
+	bool kernelCopyStored = CanKernelCopyFileRange(inF, outF);
+
+	// Record types of every page read so far, which page references are checked against
+	std::vector<ArchiveRecordType> recordTypes;
 
 	int blockIndex = 0;
 	for (;;)
 	{
-		bytesRead = fread(sizeBytes, 1, 4, inF);
+		ArchivePageHeader pageHeader;
+		int pageHeaderResult = ReadArchivePageHeader(inF, archiveHeader, pageHeader);
 
-		if (bytesRead == 0)
+		if (pageHeaderResult == 0)
 			break;
 
-		if (bytesRead != 4)
-		{
-			fprintf(stderr, "Failed to read block size");
-			return -1;
-		}
-
-		uint32_t blockSize = sizeBytes[0] | (static_cast<uint32_t>(sizeBytes[1]) << 8) | (static_cast<uint32_t>(sizeBytes[2]) << 16) | (static_cast<uint32_t>(sizeBytes[3]) << 24);
-
-		if (blockSize > pageSize || blockSize == 0)
-		{
-			fprintf(stderr, "Malformed block size");
+		if (pageHeaderResult < 0)
 			return -1;
-		}
 
-		///
+		recordTypes.push_back(pageHeader.m_recordType);
 
-		bytesRead = fread(sizeBytes, 1, 4, inF);
+		uint32_t blockSize = pageHeader.m_storedSize;
+		uint32_t uncompressedSize = pageHeader.m_uncompressedSize;
+		uint64_t expectedChecksum = pageHeader.m_checksum;
 
-		if (bytesRead != 4)
+		if (pageHeader.m_recordType == kArchiveRecordPageReference)
 		{
-			fprintf(stderr, "Failed to read uncompressed size");
-			return -1;
-		}
+			// Every page before the last is a full page, so the referenced page's output offset follows from
+			// its index
+			if (!IsValidPageReference(archiveHeader, pageHeader, static_cast<size_t>(blockIndex), recordTypes))
+				return -1;
 
-		uint32_t uncompressedSize = sizeBytes[0] | (static_cast<uint32_t>(sizeBytes[1]) << 8) | (static_cast<uint32_t>(sizeBytes[2]) << 16) | (static_cast<uint32_t>(sizeBytes[3]) << 24);
+			std::vector<uint8_t> referencedPage(uncompressedSize);
 
-		if (uncompressedSize < blockSize || uncompressedSize > pageSize)
-		{
-			fprintf(stderr, "Malformed uncompressed size");
-			return -1;
-		}
+			uint64_t outputPos = static_cast<uint64_t>(blockIndex) * archiveHeader.m_pageSize;
+			uint64_t referencedPos = static_cast<uint64_t>(pageHeader.m_recordPayload) * archiveHeader.m_pageSize;
 
-		///
+			if (fflush(outF) != 0 || !SeekFile64(outF, referencedPos) || fread(&referencedPage[0], 1, uncompressedSize, outF) != uncompressedSize || !SeekFile64(outF, outputPos))
+			{
+				fprintf(stderr, "Failed to read back block %u for block %i", static_cast<unsigned int>(pageHeader.m_recordPayload), blockIndex);
+				return -1;
+			}
 
-		bytesRead = fread(sizeBytes, 1, 4, inF);
+			uint64_t actualChecksum = ComputePageChecksum(checksumType, &referencedPage[0], uncompressedSize);
+			if (actualChecksum != expectedChecksum)
+			{
+				fprintf(stderr, "Error in block %i: Expected checksum %llx but checksum was %llx", blockIndex, static_cast<unsigned long long>(expectedChecksum), static_cast<unsigned long long>(actualChecksum));
+				return -1;
+			}
+
+			fwrite(&referencedPage[0], 1, uncompressedSize, outF);
 
-		if (bytesRead != 4)
+			blockIndex++;
+			continue;
+		}
+
+		if (pageHeader.m_recordType == kArchiveRecordConstant)
 		{
-			fprintf(stderr, "Failed to read CRC");
-			return -1;
+			std::vector<uint8_t> constantPage(uncompressedSize, static_cast<uint8_t>(pageHeader.m_recordPayload));
+
+			uint64_t actualChecksum = ComputePageChecksum(checksumType, &constantPage[0], uncompressedSize);
+			if (actualChecksum != expectedChecksum)
+			{
+				fprintf(stderr, "Error in block %i: Expected checksum %llx but checksum was %llx", blockIndex, static_cast<unsigned long long>(expectedChecksum), static_cast<unsigned long long>(actualChecksum));
+				return -1;
+			}
+
+			fwrite(&constantPage[0], 1, uncompressedSize, outF);
+
+			blockIndex++;
+			continue;
 		}
 
-		uint32_t expectedCRC  = sizeBytes[0] | (static_cast<uint32_t>(sizeBytes[1]) << 8) | (static_cast<uint32_t>(sizeBytes[2]) << 16) | (static_cast<uint32_t>(sizeBytes[3]) << 24);
+		uint64_t kernelCopiedSize = 0;
+		uint64_t storedOffset = 0;
+		if (blockSize == uncompressedSize && kernelCopyStored && TellFile64(inF, storedOffset))
+		{
+			kernelCopiedSize = KernelCopyFileRange(inF, outF, blockSize);
+			if (kernelCopiedSize == blockSize && !verifyStored)
+			{
+				blockIndex++;
+				continue;
+			}
+		}
 
+		// Zero padding past the end of the page lets the decoder skip per-lane input bounds checks
 		std::vector<uint8_t> compressedPage;
-		compressedPage.resize(blockSize);
+		compressedPage.resize(blockSize + GSTD_DECOMPRESS_INPUT_PADDING);
+
+		size_t copiedPrefixSize = static_cast<size_t>(kernelCopiedSize);
+		size_t bytesRead = fread(&compressedPage[copiedPrefixSize], 1, blockSize - copiedPrefixSize, inF);
 
-		bytesRead = fread(&compressedPage[0], 1, blockSize, inF);
+		if (copiedPrefixSize + bytesRead != blockSize)
+		{
+			fprintf(stderr, "Failed to read block %i", blockIndex);
+			return -1;
+		}
 
-		uint32_t actualCRC = 0;
-		if (bytesRead == pageSize)
+		if (blockSize == uncompressedSize)
 		{
-			fwrite(&compressedPage[0], 1, bytesRead, outF);
+			fwrite(&compressedPage[copiedPrefixSize], 1, bytesRead, outF);
+
+			// Only kernel-copied pages can skip the check, pages read through the buffer are always checked
+			bool checkStored = verifyStored || copiedPrefixSize == 0;
 
-			uint32_t actualCRC = crc32(0, &compressedPage[0], uncompressedSize);
-			if (actualCRC != expectedCRC)
+			if (checkStored && copiedPrefixSize > 0 && !ReadFileAt(inF, storedOffset, &compressedPage[0], copiedPrefixSize))
 			{
-				fprintf(stderr, "Error in block %i: Expected CRC %x but CRC was %x", blockIndex, expectedCRC, actualCRC);
+				fprintf(stderr, "Failed to read back block %i", blockIndex);
 				return -1;
 			}
+
+			if (checkStored)
+			{
+				uint64_t actualChecksum = ComputePageChecksumParallel(checksumType, &compressedPage[0], uncompressedSize, numThreads);
+				if (actualChecksum != expectedChecksum)
+				{
+					fprintf(stderr, "Error in block %i: Expected checksum %llx but checksum was %llx", blockIndex, static_cast<unsigned long long>(expectedChecksum), static_cast<unsigned long long>(actualChecksum));
+					return -1;
+				}
+			}
 		}
 		else
 		{
 			std::vector<uint8_t> decompressedPage;
 			decompressedPage.resize(uncompressedSize + 3);
 
-			DecompressGstdCPU32(&compressedPage[0], blockSize, &decompressedPage[0], uncompressedSize, &blockIndex, DecompressWarn, diagF, diagF ? DecompressDiag : nullptr);
+			gstd_PerfCounters_t pagePerfCounters;
+			DecompressGstdCPULanes(&compressedPage[0], blockSize, &decompressedPage[0], uncompressedSize, numLanes, GSTD_DECOMPRESS_FLAG_PADDED_BUFFERS, (printPerf || laneSim) ? &pagePerfCounters : nullptr, &blockIndex, DecompressWarn, diagF, diagF ? DecompressDiag : nullptr);
+
+			if (printPerf || laneSim)
+				AccumulatePerfCounters(totalPerfCounters, pagePerfCounters);
+
+			if (laneSim && pagePerfCounters.m_enabled)
+				PrintLaneSimPage(blockIndex, uncompressedSize, pagePerfCounters);
 
-			uint32_t actualCRC = crc32(0, &decompressedPage[0], uncompressedSize);
-			if (actualCRC != expectedCRC)
+			uint64_t actualChecksum = ComputePageChecksumParallel(checksumType, &decompressedPage[0], uncompressedSize, numThreads);
+			if (actualChecksum != expectedChecksum)
 			{
-				fprintf(stderr, "Error in block %i: Expected CRC %x but CRC was %x", blockIndex, expectedCRC, actualCRC);
+				fprintf(stderr, "Error in block %i: Expected checksum %llx but checksum was %llx", blockIndex, static_cast<unsigned long long>(expectedChecksum), static_cast<unsigned long long>(actualChecksum));
 
 				if (writeDamaged)
 					fwrite(&decompressedPage[0], 1, uncompressedSize, outF);
@@ -538,10 +1142,439 @@ int DecompressMain(int optc, const char **optv, const char *inFileName, const ch
 	if (diagF)
 		fclose(diagF);
 
+	if (printPerf || laneSim)
+		PrintPerfCounters(totalPerfCounters);
+
+	return 0;
+}
+
+
+uint64_t NanosecondsSince(std::chrono::steady_clock::time_point startTime)
+{
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count());
+}
+
+// Shared state for verify workers.  Workers take turns reading the next page from the archive, then
+// decode and check it outside of the lock.
+class VerifyGlobal
+{
+public:
+	VerifyGlobal(FILE *inF, const ArchiveHeader &archiveHeader);
+
+	void RunWorker();
+
+	bool IsMalformed() const;
+	uint64_t NumPages() const;
+	uint64_t StoredBytes() const;
+	uint64_t UncompressedBytes() const;
+	std::vector<PageFailure> &Failures();
+
+private:
+	// Reads the next page into the compressed buffer, returns false at the end of the archive or on error
+	bool ReadNextPage(std::vector<uint8_t> &compressedPage, ArchivePageHeader &outPageHeader, size_t &outPageIndex);
+
+	void AddFailure(size_t pageIndex, uint64_t expectedChecksum, uint64_t actualChecksum);
+
+	FILE *m_inF;
+	ArchiveHeader m_archiveHeader;
+
+	std::mutex m_inFileMutex;
+	bool m_endOfArchive;
+	bool m_malformed;
+	uint64_t m_numPages;
+	uint64_t m_storedBytes;
+	uint64_t m_uncompressedBytes;
+
+	// Checksums and record types of every page read so far, which page references are checked against
+	std::vector<uint64_t> m_pageChecksums;
+	std::vector<ArchiveRecordType> m_pageRecordTypes;
+
+	std::mutex m_failureMutex;
+	std::vector<PageFailure> m_failures;
+};
+
+VerifyGlobal::VerifyGlobal(FILE *inF, const ArchiveHeader &archiveHeader)
+	: m_inF(inF), m_archiveHeader(archiveHeader), m_endOfArchive(false), m_malformed(false), m_numPages(0), m_storedBytes(0), m_uncompressedBytes(0)
+{
+}
+
+bool VerifyGlobal::ReadNextPage(std::vector<uint8_t> &compressedPage, ArchivePageHeader &outPageHeader, size_t &outPageIndex)
+{
+	std::lock_guard<std::mutex> lock(m_inFileMutex);
+
+	if (m_endOfArchive)
+		return false;
+
+	int pageHeaderResult = 0;
+
+	for (;;)
+	{
+		pageHeaderResult = ReadArchivePageHeader(m_inF, m_archiveHeader, outPageHeader);
+		if (pageHeaderResult <= 0 || outPageHeader.m_recordType != kArchiveRecordPageReference)
+			break;
+
+		// A page reference is valid if it matches the referenced page's checksum, which is verified when that
+		// page is decoded, so references are checked here without being handed to a worker
+		size_t pageIndex = static_cast<size_t>(m_numPages);
+		uint32_t referencedIndex = outPageHeader.m_recordPayload;
+
+		if (!IsValidPageReference(m_archiveHeader, outPageHeader, pageIndex, m_pageRecordTypes))
+		{
+			fprintf(stderr, "\n");
+			m_malformed = true;
+			m_endOfArchive = true;
+			return false;
+		}
+
+		if (m_pageChecksums[referencedIndex] != outPageHeader.m_checksum)
+			AddFailure(pageIndex, outPageHeader.m_checksum, m_pageChecksums[referencedIndex]);
+
+		m_pageChecksums.push_back(outPageHeader.m_checksum);
+		m_pageRecordTypes.push_back(outPageHeader.m_recordType);
+		m_numPages++;
+		m_uncompressedBytes += outPageHeader.m_uncompressedSize;
+	}
+
+	if (pageHeaderResult <= 0)
+	{
+		if (pageHeaderResult < 0)
+		{
+			fprintf(stderr, " at block %llu\n", static_cast<unsigned long long>(m_numPages));
+			m_malformed = true;
+		}
+
+		m_endOfArchive = true;
+		return false;
+	}
+
+	if (fread(&compressedPage[0], 1, outPageHeader.m_storedSize, m_inF) != outPageHeader.m_storedSize)
+	{
+		fprintf(stderr, "Failed to read block %llu\n", static_cast<unsigned long long>(m_numPages));
+		m_malformed = true;
+		m_endOfArchive = true;
+		return false;
+	}
+
+	// Clear out the previous page's bytes so the input padding stays zero
+	memset(&compressedPage[outPageHeader.m_storedSize], 0, GSTD_DECOMPRESS_INPUT_PADDING);
+
+	outPageIndex = static_cast<size_t>(m_numPages);
+
+	m_pageChecksums.push_back(outPageHeader.m_checksum);
+	m_pageRecordTypes.push_back(outPageHeader.m_recordType);
+	m_numPages++;
+	m_storedBytes += outPageHeader.m_storedSize;
+	m_uncompressedBytes += outPageHeader.m_uncompressedSize;
+
+	return true;
+}
+
+void VerifyGlobal::RunWorker()
+{
+	// Scratch buffers are sized for the largest page once and reused for every page
+	std::vector<uint8_t> compressedPage(m_archiveHeader.m_pageSize + GSTD_DECOMPRESS_INPUT_PADDING);
+	std::vector<uint8_t> decompressedPage(m_archiveHeader.m_pageSize + 3);
+
+	ArchivePageHeader pageHeader;
+	size_t pageIndex = 0;
+
+	while (ReadNextPage(compressedPage, pageHeader, pageIndex))
+	{
+		const uint8_t *pageData = &compressedPage[0];
+
+		if (pageHeader.m_recordType == kArchiveRecordConstant)
+		{
+			memset(&decompressedPage[0], static_cast<int>(pageHeader.m_recordPayload), pageHeader.m_uncompressedSize);
+			pageData = &decompressedPage[0];
+		}
+		else if (pageHeader.m_storedSize != pageHeader.m_uncompressedSize)
+		{
+			int blockIndex = static_cast<int>(pageIndex);
+
+			memset(&decompressedPage[0], 0, (pageHeader.m_uncompressedSize + 3u) & ~static_cast<uint32_t>(3u));
+			DecompressGstdCPULanes(&compressedPage[0], pageHeader.m_storedSize, &decompressedPage[0], pageHeader.m_uncompressedSize, m_archiveHeader.m_numLanes, GSTD_DECOMPRESS_FLAG_PADDED_BUFFERS, nullptr, &blockIndex, DecompressWarn, nullptr, nullptr);
+
+			pageData = &decompressedPage[0];
+		}
+
+		uint64_t actualChecksum = ComputePageChecksum(m_archiveHeader.m_checksumType, pageData, pageHeader.m_uncompressedSize);
+		if (actualChecksum != pageHeader.m_checksum)
+			AddFailure(pageIndex, pageHeader.m_checksum, actualChecksum);
+	}
+}
+
+void VerifyGlobal::AddFailure(size_t pageIndex, uint64_t expectedChecksum, uint64_t actualChecksum)
+{
+	PageFailure failure;
+	failure.m_pageIndex = pageIndex;
+	failure.m_expectedChecksum = expectedChecksum;
+	failure.m_actualChecksum = actualChecksum;
+
+	std::lock_guard<std::mutex> lock(m_failureMutex);
+	m_failures.push_back(failure);
+}
+
+bool VerifyGlobal::IsMalformed() const
+{
+	return m_malformed;
+}
+
+uint64_t VerifyGlobal::NumPages() const
+{
+	return m_numPages;
+}
+
+uint64_t VerifyGlobal::StoredBytes() const
+{
+	return m_storedBytes;
+}
+
+uint64_t VerifyGlobal::UncompressedBytes() const
+{
+	return m_uncompressedBytes;
+}
+
+std::vector<PageFailure> &VerifyGlobal::Failures()
+{
+	return m_failures;
+}
+
+// Decodes every page and checks its checksum without writing any output
+int VerifyMain(int optc, const char **optv, const char *inFileName)
+{
+	unsigned int maxThreads = std::thread::hardware_concurrency();
+	unsigned int numThreads = maxThreads;
+
+	for (int i = 0; i < optc; i++)
+	{
+		const char *optName = optv[i];
+		if (!strcmp(optName, "-t"))
+		{
+			i++;
+			if (i == optc)
+			{
+				fprintf(stderr, "Expected thread count for -t");
+				return -1;
+			}
+
+			int numThreadsInt = atoi(optv[i]);
+			if (numThreadsInt < 1)
+			{
+				fprintf(stderr, "Invalid thread count");
+				return -1;
+			}
+
+			numThreads = static_cast<unsigned int>(numThreadsInt);
+		}
+		else
+		{
+			fprintf(stderr, "Invalid option %s", optName);
+			return -1;
+		}
+	}
+
+	if (numThreads == 0)
+		numThreads = 1;
+
+	FILE *inF = fopen(inFileName, "rb");
+	if (!inF)
+	{
+		fprintf(stderr, "Failed to open input file\n");
+		return -1;
+	}
+
+	ArchiveHeader archiveHeader;
+	if (!ReadArchiveHeader(inF, archiveHeader))
+	{
+		fclose(inF);
+		return -1;
+	}
+
+	VerifyGlobal vglobal(inF, archiveHeader);
+
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> threads;
+	for (unsigned int i = 1; i < numThreads; i++)
+		threads.push_back(std::thread(&VerifyGlobal::RunWorker, &vglobal));
+
+	vglobal.RunWorker();
+
+	for (std::thread &thread : threads)
+		thread.join();
+
+	uint64_t nanoseconds = NanosecondsSince(startTime);
+
+	fclose(inF);
+
+	std::vector<PageFailure> &failures = vglobal.Failures();
+	std::sort(failures.begin(), failures.end(), PageFailureLess);
+
+	for (const PageFailure &failure : failures)
+		fprintf(stderr, "Error in block %llu: Expected checksum %llx but checksum was %llx\n", static_cast<unsigned long long>(failure.m_pageIndex), static_cast<unsigned long long>(failure.m_expectedChecksum), static_cast<unsigned long long>(failure.m_actualChecksum));
+
+	double seconds = static_cast<double>(nanoseconds) / 1000000000.0;
+	double mbPerSecond = 0.0;
+	if (nanoseconds > 0)
+		mbPerSecond = (static_cast<double>(vglobal.UncompressedBytes()) / (1024.0 * 1024.0)) / seconds;
+
+	fprintf(stderr, "Verified %llu pages, %llu bytes (%llu stored) in %.3f seconds, %.2f MB/s\n", static_cast<unsigned long long>(vglobal.NumPages()), static_cast<unsigned long long>(vglobal.UncompressedBytes()), static_cast<unsigned long long>(vglobal.StoredBytes()), seconds, mbPerSecond);
+
+	if (vglobal.IsMalformed())
+	{
+		fprintf(stderr, "Archive is malformed\n");
+		return -1;
+	}
+
+	if (!failures.empty())
+	{
+		fprintf(stderr, "%llu of %llu pages failed verification\n", static_cast<unsigned long long>(failures.size()), static_cast<unsigned long long>(vglobal.NumPages()));
+		return -1;
+	}
+
 	return 0;
 }
 
 
+// Issues a mix of random and sequential reads through an ArchiveReader from several threads at once and
+// compares every read against the original file.  A small cache budget forces pages to be evicted while
+// other threads are still reading or decoding them.
+int ReadStressMain(int optc, const char **optv, const char *archiveFileName, const char *originalFileName)
+{
+	unsigned int numThreads = 4;
+	unsigned int numDecoders = 2;
+	unsigned long long cacheBytes = 16 * 1024 * 1024;
+	unsigned int readAheadPages = 4;
+	unsigned int numReads = 10000;
+	unsigned int maxReadSize = 256 * 1024;
+
+	for (int i = 0; i < optc; i++)
+	{
+		const char *optName = optv[i];
+		unsigned int *uintOption = nullptr;
+
+		if (!strcmp(optName, "-t"))
+			uintOption = &numThreads;
+		else if (!strcmp(optName, "-decoders"))
+			uintOption = &numDecoders;
+		else if (!strcmp(optName, "-readahead"))
+			uintOption = &readAheadPages;
+		else if (!strcmp(optName, "-reads"))
+			uintOption = &numReads;
+		else if (!strcmp(optName, "-maxread"))
+			uintOption = &maxReadSize;
+		else if (!strcmp(optName, "-cache"))
+		{
+			i++;
+			if (i == optc || !sscanf(optv[i], "%llu", &cacheBytes))
+			{
+				fprintf(stderr, "Invalid size for -cache");
+				return -1;
+			}
+
+			continue;
+		}
+		else
+		{
+			fprintf(stderr, "Invalid option %s", optName);
+			return -1;
+		}
+
+		i++;
+		if (i == optc || !sscanf(optv[i], "%u", uintOption) || *uintOption == 0)
+		{
+			fprintf(stderr, "Invalid value for %s", optName);
+			return -1;
+		}
+	}
+
+	MappedFile originalMap;
+	if (!originalMap.OpenRead(originalFileName))
+	{
+		fprintf(stderr, "Couldn't open original file %s", originalFileName);
+		return -1;
+	}
+
+	ArchiveReader reader;
+	if (!reader.Open(archiveFileName, static_cast<size_t>(cacheBytes), numDecoders, readAheadPages))
+	{
+		fprintf(stderr, "Couldn't open archive %s", archiveFileName);
+		return -1;
+	}
+
+	uint64_t dataSize = reader.Size();
+	if (dataSize != originalMap.Size())
+	{
+		fprintf(stderr, "Archive decompresses to %llu bytes but the original file is %llu bytes\n", static_cast<unsigned long long>(dataSize), static_cast<unsigned long long>(originalMap.Size()));
+		return -1;
+	}
+
+	if (dataSize == 0)
+		return 0;
+
+	const uint8_t *originalData = originalMap.Data();
+
+	std::atomic<uint64_t> numMismatches(0);
+	std::atomic<uint64_t> numFailedReads(0);
+	std::atomic<uint64_t> bytesRead(0);
+
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> threads;
+	for (unsigned int threadIndex = 0; threadIndex < numThreads; threadIndex++)
+	{
+		threads.push_back(std::thread([&, threadIndex]
+			{
+				std::mt19937_64 rng(threadIndex + 1u);
+				std::vector<uint8_t> readBuffer(maxReadSize);
+
+				uint64_t offset = 0;
+
+				for (unsigned int readIndex = 0; readIndex < numReads; readIndex++)
+				{
+					// Half of the reads continue where the last one ended so that read-ahead kicks in
+					if (offset >= dataSize || (rng() & 1u) != 0)
+						offset = rng() % dataSize;
+
+					size_t size = static_cast<size_t>(rng() % maxReadSize) + 1u;
+					size_t expectedSize = static_cast<size_t>(std::min<uint64_t>(size, dataSize - offset));
+
+					int64_t result = reader.Read(&readBuffer[0], offset, size);
+
+					if (result < 0)
+						numFailedReads++;
+					else if (static_cast<size_t>(result) != expectedSize || memcmp(&readBuffer[0], originalData + offset, expectedSize) != 0)
+						numMismatches++;
+					else
+						bytesRead += expectedSize;
+
+					offset += expectedSize;
+				}
+			}));
+	}
+
+	for (std::thread &thread : threads)
+		thread.join();
+
+	uint64_t nanoseconds = NanosecondsSince(startTime);
+
+	double seconds = static_cast<double>(nanoseconds) / 1000000000.0;
+	double mbPerSecond = 0.0;
+	if (nanoseconds > 0)
+		mbPerSecond = (static_cast<double>(bytesRead) / (1024.0 * 1024.0)) / seconds;
+
+	fprintf(stderr, "%llu reads, %llu bytes in %.3f seconds, %.2f MB/s\n", static_cast<unsigned long long>(numThreads) * numReads, static_cast<unsigned long long>(bytesRead), seconds, mbPerSecond);
+	fprintf(stderr, "Cache: %llu hits, %llu misses, %llu pages read ahead\n", static_cast<unsigned long long>(reader.NumCacheHits()), static_cast<unsigned long long>(reader.NumCacheMisses()), static_cast<unsigned long long>(reader.NumReadAheadPages()));
+
+	if (numFailedReads > 0 || numMismatches > 0)
+	{
+		fprintf(stderr, "%llu reads failed their checksums and %llu reads didn't match the original file\n", static_cast<unsigned long long>(numFailedReads), static_cast<unsigned long long>(numMismatches));
+		return -1;
+	}
+
+	return 0;
+}
+
 int TrainMain(int optc, const char **optv, const char *inFileName, const char *outFileName)
 {
 	unsigned int maxThreads = std::thread::hardware_concurrency();
@@ -707,563 +1740,3130 @@ int TrainMain(int optc, const char **optv, const char *inFileName, const char *o
 	return 0;
 }
 
-class CompressionGlobal
+enum CompressionStage
 {
-public:
-	CompressionGlobal(FILE *inF, FILE *outF, size_t numPages, size_t pageSize, size_t globalSize,
-		unsigned int compressionLevel, uint32_t tweaks, const char *failBlockPath, bool isIsolate,
-		unsigned int isolateBlock, bool useZStd, bool useDeflate,
-		ZSTD_CDict *dict, const void *dictData, size_t dictSize);
+	kCompressionStageZStd,
+	kCompressionStageDeflate,
+	kCompressionStageDeflateConv,
+	kCompressionStageTranscode,
+	kCompressionStageCRC,
+	kCompressionStageEstimate,
+
+	kCompressionStageCount,
+};
 
-	void ReadFromInput(void *dest, size_t offset, size_t size);
-	void WriteToOutput(const void *src, uint32_t crc, size_t compressedSize, size_t uncompressedSize);
+struct CompressionStageStats
+{
+	CompressionStageStats();
 
-	bool IsUsingZStd() const;
-	bool IsUsingDeflate() const;
-	size_t NumPages() const;
-	size_t PageSize() const;
-	size_t GlobalSize() const;
-	unsigned int CompressionLevel() const;
-	uint32_t Tweaks() const;
-	const char* FailBlockPath() const;
-	bool IsIsolateBlock() const;
-	unsigned int IsolateBlock() const;
-	ZSTD_CDict *ZStdDict() const;
-	const void *ZStdDictData() const;
-	size_t ZStdDictSize() const;
-
-private:
-	std::mutex m_inFileMutex;
-	FILE *m_inF;
-
-	std::mutex m_outFileMutex;
-	FILE *m_outF;
-
-	std::mutex m_logMutex;
-
-	size_t m_pageSize;
-	size_t m_globalSize;
-	size_t m_numPages;
+	// Returns the elapsed time of the sample in nanoseconds
+	uint64_t AddSample(CompressionStage stage, std::chrono::steady_clock::time_point startTime, size_t inputBytes, size_t outputBytes);
+	void Add(const CompressionStageStats &other);
 
-	unsigned int m_compressionLevel;
-	uint32_t m_tweaks;
-	const char* m_failBlockPath;
-
-	bool m_isIsolateBlock;
-	unsigned int m_isolateBlock;
-
-	bool m_useZStd;
-	bool m_useDeflate;
-
-	ZSTD_CDict *m_dict;
-	const void *m_dictData;
-	size_t m_dictSize;
+	uint64_t m_nanoseconds[kCompressionStageCount];
+	uint64_t m_inputBytes[kCompressionStageCount];
+	uint64_t m_outputBytes[kCompressionStageCount];
 };
 
-CompressionGlobal::CompressionGlobal(FILE *inF, FILE *outF, size_t numPages,
-	size_t pageSize, size_t globalSize, unsigned int compressionLevel,
-	uint32_t tweaks, const char *failBlockPath, bool isIsolate, unsigned int isolateBlock, bool useZStd, bool useDeflate,
-	ZSTD_CDict *dict, const void *dictData, size_t dictSize)
-	: m_inF(inF), m_outF(outF), m_numPages(numPages), m_pageSize(pageSize), m_globalSize(globalSize)
-	, m_compressionLevel(compressionLevel), m_tweaks(tweaks), m_failBlockPath(failBlockPath)
-	, m_isIsolateBlock(isIsolate), m_isolateBlock(isolateBlock), m_useZStd(useZStd), m_useDeflate(useDeflate)
-	, m_dict(dict), m_dictData(dictData), m_dictSize(dictSize)
-{
-}
-
-void CompressionGlobal::ReadFromInput(void *dest, size_t offset, size_t size)
+CompressionStageStats::CompressionStageStats()
 {
-	std::lock_guard<std::mutex> lock(m_inFileMutex);
-	fseek(m_inF, static_cast<long>(offset), SEEK_SET);
-
-	fread(dest, 1, size, m_inF);
+	for (int i = 0; i < kCompressionStageCount; i++)
+	{
+		m_nanoseconds[i] = 0;
+		m_inputBytes[i] = 0;
+		m_outputBytes[i] = 0;
+	}
 }
 
-void CompressionGlobal::WriteToOutput(const void *src, uint32_t crc, size_t compressedSize, size_t uncompressedSize)
+uint64_t CompressionStageStats::AddSample(CompressionStage stage, std::chrono::steady_clock::time_point startTime, size_t inputBytes, size_t outputBytes)
 {
-	std::lock_guard<std::mutex> lock(m_outFileMutex);
+	std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - startTime;
+	uint64_t nanoseconds = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
 
-	uint8_t chunkSizeBytes[12];
-	chunkSizeBytes[0] = static_cast<uint8_t>((compressedSize >> 0) & 0xffu);
-	chunkSizeBytes[1] = static_cast<uint8_t>((compressedSize >> 8) & 0xffu);
-	chunkSizeBytes[2] = static_cast<uint8_t>((compressedSize >> 16) & 0xffu);
-	chunkSizeBytes[3] = static_cast<uint8_t>((compressedSize >> 24) & 0xffu);
-	chunkSizeBytes[4] = static_cast<uint8_t>((uncompressedSize >> 0) & 0xffu);
-	chunkSizeBytes[5] = static_cast<uint8_t>((uncompressedSize >> 8) & 0xffu);
-	chunkSizeBytes[6] = static_cast<uint8_t>((uncompressedSize >> 16) & 0xffu);
-	chunkSizeBytes[7] = static_cast<uint8_t>((uncompressedSize >> 24) & 0xffu);
-	chunkSizeBytes[8] = static_cast<uint8_t>((crc >> 0) & 0xffu);
-	chunkSizeBytes[9] = static_cast<uint8_t>((crc >> 8) & 0xffu);
-	chunkSizeBytes[10] = static_cast<uint8_t>((crc >> 16) & 0xffu);
-	chunkSizeBytes[11] = static_cast<uint8_t>((crc >> 24) & 0xffu);
+	m_nanoseconds[stage] += nanoseconds;
+	m_inputBytes[stage] += inputBytes;
+	m_outputBytes[stage] += outputBytes;
 
-	fwrite(chunkSizeBytes, 1, 12, m_outF);
-	fwrite(src, 1, compressedSize, m_outF);
+	return nanoseconds;
 }
 
-bool CompressionGlobal::IsUsingZStd() const
+void CompressionStageStats::Add(const CompressionStageStats &other)
 {
-	return m_useZStd;
+	for (int i = 0; i < kCompressionStageCount; i++)
+	{
+		m_nanoseconds[i] += other.m_nanoseconds[i];
+		m_inputBytes[i] += other.m_inputBytes[i];
+		m_outputBytes[i] += other.m_outputBytes[i];
+	}
 }
 
-bool CompressionGlobal::IsUsingDeflate() const
+struct CompressedPageRecord
 {
-	return m_useDeflate;
-}
+	std::vector<uint8_t> m_data;
+	uint32_t m_uncompressedSize;
+	uint64_t m_checksum;
+};
 
-size_t CompressionGlobal::NumPages() const
+// Block-level stats of the zstd frame that the transcoder accepted, written under zstd_ names
+struct BlockStats
 {
-	return m_numPages;
-}
+	uint32_t m_blockType;
+	uint32_t m_numLiterals;
+	uint32_t m_numSequences;
+	uint32_t m_litSectionType;
+	uint32_t m_litLengthsMode;
+	uint32_t m_offsetsMode;
+	uint32_t m_matchLengthsMode;
+};
 
-size_t CompressionGlobal::PageSize() const
+enum PageWinner
 {
-	return m_pageSize;
-}
+	kPageWinnerNone,
+	kPageWinnerZStd,
+	kPageWinnerDeflateConv,
+	kPageWinnerStored,
+	kPageWinnerReference,
+	kPageWinnerConstant,
+	kPageWinnerEstimatedStored,
+	kPageWinnerCached,
+	kPageWinnerBase,
+};
 
-size_t CompressionGlobal::GlobalSize() const
+struct PageStats
 {
-	return m_globalSize;
-}
+	PageStats();
 
-unsigned int CompressionGlobal::CompressionLevel() const
-{
-	return m_compressionLevel;
-}
+	void Reset(size_t pageIndex, size_t uncompressedSize);
 
-unsigned int CompressionGlobal::Tweaks() const
-{
-	return m_tweaks;
-}
+	size_t m_pageIndex;
+	size_t m_uncompressedSize;
+	size_t m_zstdSize;
+	size_t m_deflateSize;
+	size_t m_deflateConvSize;
+	size_t m_transcodedSize;
+	size_t m_finalSize;
 
-const char* CompressionGlobal::FailBlockPath() const
-{
-	return m_failBlockPath;
-}
+	PageWinner m_winner;
+	bool m_usedDict;
+	bool m_transcodeFailed;
 
-bool CompressionGlobal::IsIsolateBlock() const
-{
-	return m_isIsolateBlock;
-}
+	uint64_t m_stageNanoseconds[kCompressionStageCount];
 
-unsigned int CompressionGlobal::IsolateBlock() const
-{
-	return m_isolateBlock;
-}
+	std::vector<BlockStats> m_blocks;
+};
 
-ZSTD_CDict *CompressionGlobal::ZStdDict() const
+PageStats::PageStats()
 {
-	return m_dict;
+	Reset(0, 0);
 }
 
-const void *CompressionGlobal::ZStdDictData() const
+void PageStats::Reset(size_t pageIndex, size_t uncompressedSize)
 {
-	return m_dictData;
+	m_pageIndex = pageIndex;
+	m_uncompressedSize = uncompressedSize;
+	m_zstdSize = 0;
+	m_deflateSize = 0;
+	m_deflateConvSize = 0;
+	m_transcodedSize = 0;
+	m_finalSize = 0;
+	m_winner = kPageWinnerNone;
+	m_usedDict = false;
+	m_transcodeFailed = false;
+
+	for (int i = 0; i < kCompressionStageCount; i++)
+		m_stageNanoseconds[i] = 0;
+
+	m_blocks.clear();
 }
 
-size_t CompressionGlobal::ZStdDictSize() const
+// Walks the block headers of a zstd frame.  Returns false if the frame is malformed, in which case the
+// blocks parsed so far are left in outBlocks.
+bool ParseZStdFrameBlocks(const uint8_t *data, size_t size, std::vector<BlockStats> &outBlocks)
 {
-	return m_dictSize;
-}
+	outBlocks.clear();
 
-class CompressionTask : public ThreadedTaskBase
-{
-public:
-	CompressionTask();
-	~CompressionTask();
+	if (size < 5 || data[0] != 0x28 || data[1] != 0xb5 || data[2] != 0x2f || data[3] != 0xfd)
+		return false;
 
-	void Init(CompressionGlobal *cglobal);
+	uint8_t frameHeaderDesc = data[4];
+	uint32_t fcsFlag = (frameHeaderDesc >> 6) & 3u;
+	bool isSingleSegment = ((frameHeaderDesc >> 5) & 1u) != 0;
+	uint32_t dictIDFlag = frameHeaderDesc & 3u;
 
-	void RunWorkUnit(size_t workUnit) override;
-	void FinishWritingWorkUnit() override;
+	static const size_t kDictIDSizes[4] = { 0, 1, 2, 4 };
+	static const size_t kFCSSizes[4] = { 0, 2, 4, 8 };
 
-private:
-	struct CompressionOutputBuffer
-	{
-		CompressionOutputBuffer() : m_data(nullptr), m_size(0), m_capacity(0) {}
+	size_t pos = 5;
+	if (!isSingleSegment)
+		pos++;
 
-		unsigned char *m_data;
-		size_t m_size;
-		size_t m_capacity;
-	};
+	pos += kDictIDSizes[dictIDFlag];
 
-	struct CompressionInputBuffer
+	if (fcsFlag == 0 && isSingleSegment)
+		pos += 1;
+	else
+		pos += kFCSSizes[fcsFlag];
+
+	for (;;)
 	{
-		CompressionInputBuffer() : m_data(nullptr), m_readPos(0), m_size(0) {}
+		if (pos > size || size - pos < 3)
+			return false;
+
+		uint32_t blockHeader = data[pos] | (data[pos + 1] << 8) | (data[pos + 2] << 16);
+		pos += 3;
+
+		bool isLastBlock = (blockHeader & 1u) != 0;
+		uint32_t blockType = (blockHeader >> 1) & 3u;
+		uint32_t blockSize = blockHeader >> 3;
+
+		BlockStats block;
+		block.m_blockType = blockType;
+		block.m_numLiterals = 0;
+		block.m_numSequences = 0;
+		block.m_litSectionType = 0;
+		block.m_litLengthsMode = 0;
+		block.m_offsetsMode = 0;
+		block.m_matchLengthsMode = 0;
+
+		size_t blockContentSize = blockSize;
+		if (blockType == 1)
+			blockContentSize = 1;
+		else if (blockType == 3)
+			return false;
+
+		if (size - pos < blockContentSize)
+			return false;
+
+		if (blockType != 2)
+			block.m_numLiterals = blockSize;
+		else
+		{
+			const uint8_t *blockData = data + pos;
+			size_t blockPos = 0;
 
-		const unsigned char *m_data;
-		size_t m_readPos;
-		size_t m_size;
-	};
+			if (blockSize < 1)
+				return false;
 
-	size_t ComputeCurrentPageSize() const;
+			uint32_t litSectionType = blockData[0] & 3u;
+			uint32_t sizeFormat = (blockData[0] >> 2) & 3u;
+			size_t litHeaderSize = 0;
+			size_t litContentSize = 0;
+			uint32_t regeneratedSize = 0;
 
-	size_t m_workUnit;
-	size_t m_compressedSize;
-	size_t m_deflatedSize;
-	size_t m_maxCompressedSize;
-	size_t m_maxDeflatedData;
-	CompressionGlobal *m_cglobal;
-	unsigned char *m_inputData;
-	unsigned char *m_compressedData;
-	unsigned char *m_deflatedData;
-	ZSTD_CCtx *m_ctx;
-	libdeflate_compressor *m_libdeflateCompressor;
+			if (litSectionType < 2)
+			{
+				static const size_t kRawHeaderSizes[4] = { 1, 2, 1, 3 };
+				litHeaderSize = kRawHeaderSizes[sizeFormat];
+			}
+			else
+			{
+				static const size_t kCompressedHeaderSizes[4] = { 3, 3, 4, 5 };
+				litHeaderSize = kCompressedHeaderSizes[sizeFormat];
+			}
 
-	CompressionOutputBuffer m_transcodeOutput;
-	CompressionOutputBuffer m_deflateConvOutput;
+			if (blockSize < litHeaderSize)
+				return false;
 
-	zstdhl_EncoderOutputObject_t m_encoderOutputObj;
-	zstdhl_EncoderOutputObject_t m_deflateConvOutputObj;
-	zstdhl_MemoryAllocatorObject_t m_memAlloc;
-	gstd_EncoderState_t *m_encState;
-	zstdhl_StreamSourceObject_t m_dictStreamSource;
-	zstdhl_StreamSourceObject_t m_transcodeStreamSource;
-	zstdhl_StreamSourceObject_t m_deflateConvStreamSource;
+			uint64_t litHeader = 0;
+			for (size_t i = 0; i < litHeaderSize; i++)
+				litHeader |= static_cast<uint64_t>(blockData[i]) << (i * 8);
 
-	CompressionInputBuffer m_dictInput;
-	CompressionInputBuffer m_transcodeInput;
-	CompressionInputBuffer m_deflateConvInput;
+			if (litSectionType < 2)
+			{
+				if (litHeaderSize == 1)
+					regeneratedSize = static_cast<uint32_t>(litHeader >> 3);
+				else
+					regeneratedSize = static_cast<uint32_t>(litHeader >> 4);
 
-	size_t m_numLanes;
+				litContentSize = (litSectionType == 0) ? regeneratedSize : 1;
+			}
+			else
+			{
+				static const uint32_t kSizeBits[4] = { 10, 10, 14, 18 };
+				uint32_t sizeBits = kSizeBits[sizeFormat];
+				uint64_t sizeMask = (static_cast<uint64_t>(1) << sizeBits) - 1u;
 
-	size_t m_deflateReadPos;
+				regeneratedSize = static_cast<uint32_t>((litHeader >> 4) & sizeMask);
+				litContentSize = static_cast<size_t>((litHeader >> (4 + sizeBits)) & sizeMask);
+			}
 
-	static void *CBRealloc(void *userdata, void *ptr, size_t newSize);
-	static zstdhl_ResultCode_t CBWriteBitstream(void *userdata, const void *data, size_t size);
-	static size_t CBReadBytes(void *userdata, void *dest, size_t size);
-};
+			blockPos = litHeaderSize + litContentSize;
+			if (blockPos >= blockSize)
+				return false;
 
-CompressionTask::CompressionTask()
-	: m_workUnit(0), m_cglobal(nullptr), m_inputData(nullptr), m_compressedData(nullptr), m_compressedSize(0), m_ctx(nullptr),
-	m_encState(nullptr), m_maxCompressedSize(0), m_deflatedSize(0), m_maxDeflatedData(0)
-{
-	m_numLanes = 32;
+			block.m_litSectionType = litSectionType;
+			block.m_numLiterals = regeneratedSize;
 
-	m_encoderOutputObj.m_userdata = nullptr;
-	m_encoderOutputObj.m_writeBitstreamFunc = nullptr;
+			uint32_t numSequences = blockData[blockPos++];
+			if (numSequences >= 128)
+			{
+				if (numSequences == 255)
+				{
+					if (blockSize - blockPos < 2)
+						return false;
 
-	m_deflateConvOutputObj.m_userdata = nullptr;
-	m_deflateConvOutputObj.m_writeBitstreamFunc = nullptr;
+					numSequences = blockData[blockPos] + (blockData[blockPos + 1] << 8) + 0x7f00;
+					blockPos += 2;
+				}
+				else
+				{
+					if (blockSize - blockPos < 1)
+						return false;
 
-	m_memAlloc.m_userdata = nullptr;
-	m_memAlloc.m_reallocFunc = nullptr;
+					numSequences = ((numSequences - 128) << 8) + blockData[blockPos];
+					blockPos++;
+				}
+			}
 
-	m_transcodeStreamSource.m_readBytesFunc = nullptr;
-	m_transcodeStreamSource.m_userdata = nullptr;
+			block.m_numSequences = numSequences;
 
-	m_dictStreamSource.m_readBytesFunc = nullptr;
-	m_dictStreamSource.m_userdata = nullptr;
+			if (numSequences > 0)
+			{
+				if (blockSize - blockPos < 1)
+					return false;
 
-	m_deflateConvStreamSource.m_readBytesFunc = nullptr;
-	m_deflateConvStreamSource.m_userdata = nullptr;
+				uint8_t modes = blockData[blockPos];
+				block.m_litLengthsMode = (modes >> 6) & 3u;
+				block.m_offsetsMode = (modes >> 4) & 3u;
+				block.m_matchLengthsMode = (modes >> 2) & 3u;
+			}
+		}
+
+		outBlocks.push_back(block);
+
+		pos += blockContentSize;
+
+		if (isLastBlock)
+			return true;
+	}
 }
 
-CompressionTask::~CompressionTask()
+class PageStatsWriter
 {
-	delete[] m_inputData;
-	delete[] m_compressedData;
-	delete[] m_transcodeOutput.m_data;
-	delete[] m_deflateConvOutput.m_data;
-	delete[] m_deflatedData;
+public:
+	// Writes JSON if the file name ends in .json, otherwise CSV
+	PageStatsWriter(FILE *f, const char *fileName);
 
-	if (m_ctx)
-		ZSTD_freeCCtx(m_ctx);
+	void WriteHeader();
+	void WritePage(const PageStats &stats);
+	void WriteFooter();
 
-	if (m_encState)
-		gstd_Encoder_Destroy(m_encState);
+private:
+	static const char *WinnerName(PageWinner winner);
+	static const char *BlockTypeName(uint32_t blockType);
+	static const char *LitSectionTypeName(uint32_t litSectionType);
+	static const char *SeqModeName(uint32_t mode);
 
-	if (m_libdeflateCompressor)
-		libdeflate_free_compressor(m_libdeflateCompressor);
-}
+	void WriteCSVBlockField(const PageStats &stats, const char *(*nameFunc)(uint32_t), uint32_t BlockStats::*field, bool compressedOnly);
 
-void CompressionTask::Init(CompressionGlobal *cglobal)
+	FILE *m_f;
+	bool m_isJSON;
+	bool m_isFirstPage;
+};
+
+PageStatsWriter::PageStatsWriter(FILE *f, const char *fileName)
+	: m_f(f), m_isJSON(false), m_isFirstPage(true)
 {
-	m_cglobal = cglobal;
-	m_inputData = new unsigned char[cglobal->PageSize()];
+	size_t nameLength = strlen(fileName);
+	if (nameLength >= 5 && !strcmp(fileName + nameLength - 5, ".json"))
+		m_isJSON = true;
+}
 
-	m_maxCompressedSize = ZSTD_compressBound(cglobal->PageSize());
-	m_compressedData = new unsigned char[m_maxCompressedSize];
+void PageStatsWriter::WriteHeader()
+{
+	if (m_isJSON)
+		fprintf(m_f, "[\n");
+	else
+		fprintf(m_f, "page,winner,uncompressed_size,zstd_size,deflate_size,deflateconv_size,transcoded_size,final_size,used_dict,transcode_failed,"
+			"zstd_ns,deflate_ns,deflateconv_ns,transcode_ns,crc_ns,estimate_ns,"
+			"zstd_blocks,zstd_literals,zstd_sequences,zstd_block_types,zstd_lit_types,zstd_lit_length_modes,zstd_offset_modes,zstd_match_length_modes\n");
+}
 
-	m_ctx = ZSTD_createCCtx();
-	m_libdeflateCompressor = libdeflate_alloc_compressor(12);
+void PageStatsWriter::WriteCSVBlockField(const PageStats &stats, const char *(*nameFunc)(uint32_t), uint32_t BlockStats::*field, bool compressedOnly)
+{
+	fputc(',', m_f);
 
-	if (m_cglobal->IsUsingDeflate())
+	bool isFirst = true;
+	for (const BlockStats &block : stats.m_blocks)
 	{
-		m_maxDeflatedData = libdeflate_deflate_compress_bound(m_libdeflateCompressor, cglobal->PageSize());
-		m_deflatedData = new unsigned char[m_maxDeflatedData];
+		if (!isFirst)
+			fputc('|', m_f);
+		isFirst = false;
+
+		if (compressedOnly && block.m_blockType != 2)
+			fputc('-', m_f);
+		else
+			fputs(nameFunc(block.*field), m_f);
 	}
-	else
+}
+
+void PageStatsWriter::WritePage(const PageStats &stats)
+{
+	uint64_t totalLiterals = 0;
+	uint64_t totalSequences = 0;
+
+	for (const BlockStats &block : stats.m_blocks)
 	{
-		m_maxDeflatedData = 0;
-		m_deflatedData = nullptr;
+		totalLiterals += block.m_numLiterals;
+		totalSequences += block.m_numSequences;
 	}
 
-	m_memAlloc.m_userdata = this;
-	m_memAlloc.m_reallocFunc = CBRealloc;
-
-	m_encoderOutputObj.m_userdata = &m_transcodeOutput;
-	m_encoderOutputObj.m_writeBitstreamFunc = CBWriteBitstream;
+	if (m_isJSON)
+	{
+		if (!m_isFirstPage)
+			fprintf(m_f, ",\n");
 
-	m_deflateConvOutputObj.m_userdata = &m_deflateConvOutput;
-	m_deflateConvOutputObj.m_writeBitstreamFunc = CBWriteBitstream;
+		fprintf(m_f, "  {\"page\": %zu, \"winner\": \"%s\", \"uncompressed_size\": %zu, \"zstd_size\": %zu, \"deflate_size\": %zu, \"deflateconv_size\": %zu, \"transcoded_size\": %zu, \"final_size\": %zu, \"used_dict\": %s, \"transcode_failed\": %s,\n",
+			stats.m_pageIndex, WinnerName(stats.m_winner), stats.m_uncompressedSize, stats.m_zstdSize, stats.m_deflateSize, stats.m_deflateConvSize, stats.m_transcodedSize, stats.m_finalSize,
+			stats.m_usedDict ? "true" : "false", stats.m_transcodeFailed ? "true" : "false");
 
-	m_transcodeStreamSource.m_userdata = &m_transcodeInput;
-	m_transcodeStreamSource.m_readBytesFunc = CBReadBytes;
+		fprintf(m_f, "   \"stage_ns\": {\"zstd\": %llu, \"deflate\": %llu, \"deflateconv\": %llu, \"transcode\": %llu, \"crc\": %llu, \"estimate\": %llu},\n",
+			static_cast<unsigned long long>(stats.m_stageNanoseconds[kCompressionStageZStd]),
+			static_cast<unsigned long long>(stats.m_stageNanoseconds[kCompressionStageDeflate]),
+			static_cast<unsigned long long>(stats.m_stageNanoseconds[kCompressionStageDeflateConv]),
+			static_cast<unsigned long long>(stats.m_stageNanoseconds[kCompressionStageTranscode]),
+			static_cast<unsigned long long>(stats.m_stageNanoseconds[kCompressionStageCRC]),
+			static_cast<unsigned long long>(stats.m_stageNanoseconds[kCompressionStageEstimate]));
 
-	m_dictStreamSource.m_userdata = &m_dictInput;
-	m_dictStreamSource.m_readBytesFunc = CBReadBytes;
+		fprintf(m_f, "   \"zstd_frame\": {\"literals\": %llu, \"sequences\": %llu, \"blocks\": [", static_cast<unsigned long long>(totalLiterals), static_cast<unsigned long long>(totalSequences));
 
-	m_deflateConvStreamSource.m_userdata = &m_deflateConvInput;
-	m_deflateConvStreamSource.m_readBytesFunc = CBReadBytes;
+		for (size_t i = 0; i < stats.m_blocks.size(); i++)
+		{
+			const BlockStats &block = stats.m_blocks[i];
 
-	gstd_Encoder_Create(&m_encoderOutputObj, m_numLanes, gstd_ComputeMaxOffsetExtraBits(static_cast<uint32_t>(cglobal->PageSize())), m_cglobal->Tweaks(), &m_memAlloc, &m_encState);	// TODO: Error check
-}
+			if (i > 0)
+				fprintf(m_f, ", ");
 
-void CompressionTask::RunWorkUnit(size_t workUnit)
-{
-	bool useDict = false;
+			fprintf(m_f, "{\"type\": \"%s\", \"literals\": %u, \"sequences\": %u", BlockTypeName(block.m_blockType), block.m_numLiterals, block.m_numSequences);
 
-	m_workUnit = workUnit;
+			if (block.m_blockType == 2)
+				fprintf(m_f, ", \"lit_type\": \"%s\", \"lit_length_mode\": \"%s\", \"offset_mode\": \"%s\", \"match_length_mode\": \"%s\"",
+					LitSectionTypeName(block.m_litSectionType), SeqModeName(block.m_litLengthsMode), SeqModeName(block.m_offsetsMode), SeqModeName(block.m_matchLengthsMode));
 
-	if (m_cglobal->IsIsolateBlock() && m_cglobal->IsolateBlock() != workUnit)
-		return;
+			fprintf(m_f, "}");
+		}
+
+		fprintf(m_f, "]}}");
+	}
+	else
+	{
+		fprintf(m_f, "%zu,%s,%zu,%zu,%zu,%zu,%zu,%zu,%i,%i,%llu,%llu,%llu,%llu,%llu,%llu,%zu,%llu,%llu",
+			stats.m_pageIndex, WinnerName(stats.m_winner), stats.m_uncompressedSize, stats.m_zstdSize, stats.m_deflateSize, stats.m_deflateConvSize, stats.m_transcodedSize, stats.m_finalSize,
+			stats.m_usedDict ? 1 : 0, stats.m_transcodeFailed ? 1 : 0,
+			static_cast<unsigned long long>(stats.m_stageNanoseconds[kCompressionStageZStd]),
+			static_cast<unsigned long long>(stats.m_stageNanoseconds[kCompressionStageDeflate]),
+			static_cast<unsigned long long>(stats.m_stageNanoseconds[kCompressionStageDeflateConv]),
+			static_cast<unsigned long long>(stats.m_stageNanoseconds[kCompressionStageTranscode]),
+			static_cast<unsigned long long>(stats.m_stageNanoseconds[kCompressionStageCRC]),
+			static_cast<unsigned long long>(stats.m_stageNanoseconds[kCompressionStageEstimate]),
+			stats.m_blocks.size(), static_cast<unsigned long long>(totalLiterals), static_cast<unsigned long long>(totalSequences));
+
+		WriteCSVBlockField(stats, BlockTypeName, &BlockStats::m_blockType, false);
+		WriteCSVBlockField(stats, LitSectionTypeName, &BlockStats::m_litSectionType, true);
+		WriteCSVBlockField(stats, SeqModeName, &BlockStats::m_litLengthsMode, true);
+		WriteCSVBlockField(stats, SeqModeName, &BlockStats::m_offsetsMode, true);
+		WriteCSVBlockField(stats, SeqModeName, &BlockStats::m_matchLengthsMode, true);
+
+		fputc('\n', m_f);
+	}
+
+	m_isFirstPage = false;
+}
+
+void PageStatsWriter::WriteFooter()
+{
+	if (m_isJSON)
+		fprintf(m_f, "\n]\n");
+}
+
+const char *PageStatsWriter::WinnerName(PageWinner winner)
+{
+	switch (winner)
+	{
+	case kPageWinnerZStd:
+		return "zstd";
+	case kPageWinnerDeflateConv:
+		return "deflateconv";
+	case kPageWinnerStored:
+		return "stored";
+	case kPageWinnerReference:
+		return "reference";
+	case kPageWinnerConstant:
+		return "constant";
+	case kPageWinnerEstimatedStored:
+		return "stored_estimate";
+	case kPageWinnerCached:
+		return "cached";
+	case kPageWinnerBase:
+		return "base";
+	default:
+		return "none";
+	}
+}
+
+const char *PageStatsWriter::BlockTypeName(uint32_t blockType)
+{
+	static const char *kNames[4] = { "raw", "rle", "compressed", "reserved" };
+	return kNames[blockType & 3u];
+}
+
+const char *PageStatsWriter::LitSectionTypeName(uint32_t litSectionType)
+{
+	static const char *kNames[4] = { "raw", "rle", "huffman", "huffman_reuse" };
+	return kNames[litSectionType & 3u];
+}
+
+const char *PageStatsWriter::SeqModeName(uint32_t mode)
+{
+	static const char *kNames[4] = { "predefined", "rle", "fse", "reuse" };
+	return kNames[mode & 3u];
+}
+
+enum SearchCandidateType
+{
+	kSearchCandidateZStd,
+	kSearchCandidateDeflate,
+};
+
+struct SearchCandidate
+{
+	SearchCandidateType m_type;
+	unsigned int m_level;
+	unsigned int m_strategy;		// 0 uses the level's strategy
+	unsigned int m_windowLog;		// 0 uses the level's window log
+	bool m_useBlockSplitter;
+	std::string m_name;
+};
+
+// Picks compression settings so that compression keeps up with a target throughput or finishes by a
+// deadline.  Settings are ordered from fastest to slowest.  The cost of each setting is tracked as a
+// moving average of nanoseconds per byte on one thread.  Since pages are compressed in parallel, the
+// setting only moves once enough pages have completed since the last change to reflect it.
+class LevelController
+{
+public:
+	LevelController(unsigned int numSettings, unsigned int initialSetting, unsigned int numThreads, uint64_t totalBytes);
+
+	void SetTargetRate(double bytesPerSecond);
+	void SetDeadline(double seconds);
+
+	unsigned int CurrentSetting();
+
+	// Records a completed page.  Pages that didn't run the compressors still count toward progress, but
+	// don't say anything about the cost of their setting.
+	void AddSample(unsigned int setting, size_t bytes, uint64_t nanoseconds, bool isCompressed);
+
+	unsigned int NumSettings() const;
+	uint64_t NumPagesAtSetting(unsigned int setting) const;
+
+private:
+	// Must be called with m_mutex locked
+	double RequiredNanosecondsPerByte() const;
+
+	std::mutex m_mutex;
+
+	unsigned int m_numThreads;
+	unsigned int m_setting;
+	unsigned int m_samplesSinceChange;
+
+	std::vector<double> m_settingCosts;		// Nanoseconds per byte, negative if not measured yet
+	std::vector<uint64_t> m_settingPages;
+
+	bool m_hasDeadline;
+	double m_targetBytesPerSecond;
+	double m_deadlineSeconds;
+
+	std::chrono::steady_clock::time_point m_startTime;
+	uint64_t m_totalBytes;
+	uint64_t m_completedBytes;
+};
+
+LevelController::LevelController(unsigned int numSettings, unsigned int initialSetting, unsigned int numThreads, uint64_t totalBytes)
+	: m_numThreads(numThreads), m_setting(initialSetting), m_samplesSinceChange(0), m_settingCosts(numSettings, -1.0), m_settingPages(numSettings, 0)
+	, m_hasDeadline(false), m_targetBytesPerSecond(0.0), m_deadlineSeconds(0.0)
+	, m_startTime(std::chrono::steady_clock::now()), m_totalBytes(totalBytes), m_completedBytes(0)
+{
+}
+
+void LevelController::SetTargetRate(double bytesPerSecond)
+{
+	m_hasDeadline = false;
+	m_targetBytesPerSecond = bytesPerSecond;
+}
+
+void LevelController::SetDeadline(double seconds)
+{
+	m_hasDeadline = true;
+	m_deadlineSeconds = seconds;
+	m_startTime = std::chrono::steady_clock::now();
+}
+
+unsigned int LevelController::CurrentSetting()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	return m_setting;
+}
+
+void LevelController::AddSample(unsigned int setting, size_t bytes, uint64_t nanoseconds, bool isCompressed)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_completedBytes += bytes;
+	m_settingPages[setting]++;
+
+	if (!isCompressed || bytes == 0)
+		return;
+
+	double cost = static_cast<double>(nanoseconds) / static_cast<double>(bytes);
+
+	if (m_settingCosts[setting] < 0.0)
+		m_settingCosts[setting] = cost;
+	else
+		m_settingCosts[setting] = m_settingCosts[setting] * 0.75 + cost * 0.25;
+
+	if (setting != m_setting)
+		return;
+
+	m_samplesSinceChange++;
+	if (m_samplesSinceChange < m_numThreads)
+		return;
+
+	double requiredCost = RequiredNanosecondsPerByte();
+	unsigned int newSetting = m_setting;
+
+	if (m_settingCosts[m_setting] > requiredCost)
+	{
+		// Too slow, drop to the slowest measured setting that fits, or one step down if none have been
+		// measured
+		newSetting = (m_setting > 0) ? (m_setting - 1) : 0;
+
+		for (unsigned int i = m_setting; i > 0; i--)
+		{
+			double lowerCost = m_settingCosts[i - 1];
+			if (lowerCost >= 0.0 && lowerCost <= requiredCost)
+			{
+				newSetting = i - 1;
+				break;
+			}
+		}
+	}
+	else if (m_setting + 1 < m_settingCosts.size())
+	{
+		// Step up if the next setting is known to fit, or try it if there's enough headroom to absorb a
+		// page that turns out to be too slow
+		double higherCost = m_settingCosts[m_setting + 1];
+
+		if (higherCost >= 0.0 ? (higherCost <= requiredCost) : (m_settingCosts[m_setting] * 1.5 <= requiredCost))
+			newSetting = m_setting + 1;
+	}
+
+	if (newSetting != m_setting)
+	{
+		m_setting = newSetting;
+		m_samplesSinceChange = 0;
+	}
+}
+
+unsigned int LevelController::NumSettings() const
+{
+	return static_cast<unsigned int>(m_settingCosts.size());
+}
+
+uint64_t LevelController::NumPagesAtSetting(unsigned int setting) const
+{
+	return m_settingPages[setting];
+}
+
+double LevelController::RequiredNanosecondsPerByte() const
+{
+	// The per-thread cost that, with every thread busy, just meets the target
+	if (!m_hasDeadline)
+		return static_cast<double>(m_numThreads) * 1000000000.0 / m_targetBytesPerSecond;
+
+	double remainingNanoseconds = m_deadlineSeconds * 1000000000.0 - static_cast<double>(NanosecondsSince(m_startTime));
+
+	if (remainingNanoseconds <= 0.0)
+		return 0.0;
+
+	if (m_completedBytes >= m_totalBytes)
+		return std::numeric_limits<double>::max();
+
+	return static_cast<double>(m_numThreads) * remainingNanoseconds / static_cast<double>(m_totalBytes - m_completedBytes);
+}
+
+// Must be incremented whenever the encoder's output changes, which invalidates existing page cache entries
+const uint64_t kPageCacheVersion = 1;
+
+class CompressionGlobal
+{
+public:
+	CompressionGlobal(FILE *inF, FILE *outF, size_t numPages, size_t pageSize, size_t globalSize,
+		unsigned int compressionLevel, uint32_t tweaks, const char *failBlockPath, bool isIsolate,
+		unsigned int isolateBlock, bool useZStd, bool useDeflate,
+		ZSTD_CDict *dict, const void *dictData, size_t dictSize);
+
+	void ReadFromInput(void *dest, size_t offset, size_t size);
+	void WriteToOutput(const void *src, uint64_t checksum, size_t compressedSize, size_t uncompressedSize);
+	void WriteRecordToOutput(ArchiveRecordType recordType, uint32_t payload, uint64_t checksum, size_t uncompressedSize);
+
+	// True if any page was written as a record, in which case the archive header must enable records
+	bool HasWrittenRecords() const;
+
+	// Reads input from memory instead of the input file
+	void SetInputMemory(const void *data);
+
+	// Collects pages in memory instead of writing them to the output file.  Collected pages are always
+	// whole pages, so records are disabled while collecting.
+	void SetPageCollector(std::vector<CompressedPageRecord> *pages);
+	bool CanWriteRecords() const;
+
+	// Disables records for archives whose header can't enable them
+	void DisableRecords();
+
+	void SetStatsWriter(PageStatsWriter *statsWriter);
+	bool IsCollectingStats() const;
+	void WritePageStats(const PageStats &stats);
+
+	void SetTraceRecorder(TraceRecorder *traceRecorder);
+	TraceRecorder *GetTraceRecorder() const;
+
+	// Sets the parallelism level of the encoded pages, must be called before the tasks are initialized
+	void SetNumLanes(unsigned int numLanes);
+	unsigned int NumLanes() const;
+
+	void SetChecksumType(PageChecksumType checksumType);
+	PageChecksumType ChecksumType() const;
+
+	// Enables replacing full pages that duplicate an earlier page with a page reference record
+	void SetDeduplicate(bool deduplicate);
+	bool IsDeduplicating() const;
+
+	// Registers a page's content hash.  Returns true if an earlier page had the same hash, in which case
+	// the caller must still compare the contents.  If a later page registered the hash first, the entry is
+	// moved to this page, so references always point at the earliest page seen.
+	bool FindEarlierDuplicate(uint64_t contentHash, size_t pageIndex, size_t &outEarlierPage);
+
+	// Enables storing pages without compressing them if their order-0 entropy estimate isn't at least
+	// marginPercent percent smaller than the page
+	void SetIncompressibleMargin(unsigned int marginPercent);
+	bool IsSkippingIncompressible() const;
+	unsigned int IncompressibleMargin() const;
+
+	// Replaces the single zstd and libdeflate pass with a search over candidates.  Every page tries at
+	// least the first candidate, and no more are started once the budget has elapsed.  A budget of zero is
+	// unlimited.  Must be called before the tasks are initialized.
+	void SetSearch(const std::vector<SearchCandidate> &candidates, uint64_t budgetNanoseconds);
+	bool IsSearching() const;
+	const std::vector<SearchCandidate> &SearchCandidates() const;
+	uint64_t SearchBudgetNanoseconds() const;
+
+	// Lets a controller pick the settings of each page instead of using the level and candidate set as
+	// given.  Settings run from 0, the fastest, to NumLevelSettings() - 1, which is the configuration the
+	// global was created with, and the controller starts at the top.  It never goes above the configuration.
+	void SetLevelController(LevelController *levelController);
+	LevelController *GetLevelController() const;
+	unsigned int NumLevelSettings() const;
+	unsigned int InitialLevelSetting() const;
+	void GetLevelSetting(unsigned int setting, unsigned int &outLevel, bool &outUseDeflate, size_t &outNumSearchCandidates) const;
+
+	void SetPageCache(PageCache *pageCache);
+	PageCache *GetPageCache() const;
+
+	// Sets an archive to copy pages from instead of compressing them again.  The archive must use the same
+	// page size, lane count, and checksum type, and its data must outlive the global.
+	void SetBaseArchive(const ArchiveIndex *baseIndex, const uint8_t *baseData);
+	bool HasBaseArchive() const;
+	const ArchiveIndex &BaseArchiveIndex() const;
+	const uint8_t *BaseArchiveData() const;
+
+	// Finds a page of the base archive with the same size and checksum, which the caller must still compare
+	// against the page's contents.  The page at the same position is tried first.  Other positions are
+	// only searched with XXH64 checksums, since a CRC-32 would too often match a different page somewhere
+	// in a large archive, which would waste a decode on every changed page.
+	bool FindBasePage(size_t pageIndex, uint64_t checksum, size_t uncompressedSize, size_t &outBasePage) const;
+
+	// Hash of everything that affects a page's compressed bytes, given the settings of the page
+	uint64_t PageCacheSettingsHash(unsigned int level, bool useDeflate, size_t numSearchCandidates) const;
+
+	bool IsUsingZStd() const;
+	bool IsUsingDeflate() const;
+	size_t NumPages() const;
+	size_t PageSize() const;
+	size_t GlobalSize() const;
+	unsigned int CompressionLevel() const;
+	uint32_t Tweaks() const;
+	const char* FailBlockPath() const;
+	bool IsIsolateBlock() const;
+	unsigned int IsolateBlock() const;
+	ZSTD_CDict *ZStdDict() const;
+	const void *ZStdDictData() const;
+	size_t ZStdDictSize() const;
+
+private:
+	// The zstd level of the top setting when not searching
+	unsigned int TopLadderLevel() const;
+
+	// Must be called with the output file locked
+	void WritePageHeader(uint64_t checksum, size_t compressedSize, size_t uncompressedSize);
+
+	std::mutex m_inFileMutex;
+	FILE *m_inF;
+
+	std::mutex m_outFileMutex;
+	FILE *m_outF;
+	bool m_hasWrittenRecords;
+
+	std::mutex m_logMutex;
+
+	const uint8_t *m_inputMemory;
+	std::vector<CompressedPageRecord> *m_collectedPages;
+	PageStatsWriter *m_statsWriter;
+	TraceRecorder *m_traceRecorder;
+	unsigned int m_numLanes;
+	PageChecksumType m_checksumType;
+
+	bool m_recordsDisabled;
+	bool m_deduplicate;
+	std::mutex m_dedupMutex;
+	std::unordered_map<uint64_t, size_t> m_dedupPages;
+
+	bool m_skipIncompressible;
+	unsigned int m_incompressibleMargin;
+
+	std::vector<SearchCandidate> m_searchCandidates;
+	uint64_t m_searchBudgetNanoseconds;
+
+	LevelController *m_levelController;
+	PageCache *m_pageCache;
+
+	const ArchiveIndex *m_baseIndex;
+	const uint8_t *m_baseData;
+	std::unordered_map<uint64_t, size_t> m_basePagesByChecksum;
+
+	size_t m_pageSize;
+	size_t m_globalSize;
+	size_t m_numPages;
+
+	unsigned int m_compressionLevel;
+	uint32_t m_tweaks;
+	const char* m_failBlockPath;
+
+	bool m_isIsolateBlock;
+	unsigned int m_isolateBlock;
+
+	bool m_useZStd;
+	bool m_useDeflate;
+
+	ZSTD_CDict *m_dict;
+	const void *m_dictData;
+	size_t m_dictSize;
+	uint64_t m_dictHash;
+};
+
+CompressionGlobal::CompressionGlobal(FILE *inF, FILE *outF, size_t numPages,
+	size_t pageSize, size_t globalSize, unsigned int compressionLevel,
+	uint32_t tweaks, const char *failBlockPath, bool isIsolate, unsigned int isolateBlock, bool useZStd, bool useDeflate,
+	ZSTD_CDict *dict, const void *dictData, size_t dictSize)
+	: m_inF(inF), m_outF(outF), m_hasWrittenRecords(false), m_inputMemory(nullptr), m_collectedPages(nullptr), m_statsWriter(nullptr), m_traceRecorder(nullptr), m_numLanes(32), m_checksumType(kPageChecksumCRC32), m_recordsDisabled(false), m_deduplicate(false), m_skipIncompressible(false), m_incompressibleMargin(0), m_searchBudgetNanoseconds(0), m_levelController(nullptr), m_pageCache(nullptr), m_baseIndex(nullptr), m_baseData(nullptr), m_numPages(numPages), m_pageSize(pageSize), m_globalSize(globalSize)
+	, m_compressionLevel(compressionLevel), m_tweaks(tweaks), m_failBlockPath(failBlockPath)
+	, m_isIsolateBlock(isIsolate), m_isolateBlock(isolateBlock), m_useZStd(useZStd), m_useDeflate(useDeflate)
+	, m_dict(dict), m_dictData(dictData), m_dictSize(dictSize), m_dictHash(0)
+{
+	// Raw content dictionaries have no dictionary ID, so dictionaries are identified by their contents
+	if (dict)
+		m_dictHash = XXH64(dictData, dictSize, 0);
+}
+
+void CompressionGlobal::ReadFromInput(void *dest, size_t offset, size_t size)
+{
+	TraceScope traceScope(m_traceRecorder, "read");
+
+	if (m_inputMemory)
+	{
+		memcpy(dest, m_inputMemory + offset, size);
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(m_inFileMutex, std::defer_lock);
+	LockWithTrace(lock, m_traceRecorder, "in-file-lock-wait");
+	fseek(m_inF, static_cast<long>(offset), SEEK_SET);
+
+	fread(dest, 1, size, m_inF);
+}
+
+void CompressionGlobal::WriteToOutput(const void *src, uint64_t checksum, size_t compressedSize, size_t uncompressedSize)
+{
+	TraceScope traceScope(m_traceRecorder, "write");
+
+	std::unique_lock<std::mutex> lock(m_outFileMutex, std::defer_lock);
+	LockWithTrace(lock, m_traceRecorder, "out-file-lock-wait");
+
+	if (m_collectedPages)
+	{
+		CompressedPageRecord page;
+		page.m_data.assign(static_cast<const uint8_t *>(src), static_cast<const uint8_t *>(src) + compressedSize);
+		page.m_uncompressedSize = static_cast<uint32_t>(uncompressedSize);
+		page.m_checksum = checksum;
+
+		m_collectedPages->push_back(std::move(page));
+		return;
+	}
+
+	WritePageHeader(checksum, compressedSize, uncompressedSize);
+	fwrite(src, 1, compressedSize, m_outF);
+}
+
+void CompressionGlobal::WriteRecordToOutput(ArchiveRecordType recordType, uint32_t payload, uint64_t checksum, size_t uncompressedSize)
+{
+	TraceScope traceScope(m_traceRecorder, "write");
+
+	std::unique_lock<std::mutex> lock(m_outFileMutex, std::defer_lock);
+	LockWithTrace(lock, m_traceRecorder, "out-file-lock-wait");
+
+	uint8_t recordBytes[kArchiveRecordSize];
+	for (size_t i = 0; i < 4; i++)
+	{
+		recordBytes[i] = static_cast<uint8_t>((static_cast<uint32_t>(recordType) >> (i * 8)) & 0xffu);
+		recordBytes[4 + i] = static_cast<uint8_t>((payload >> (i * 8)) & 0xffu);
+	}
+
+	WritePageHeader(checksum, 0, uncompressedSize);
+	fwrite(recordBytes, 1, kArchiveRecordSize, m_outF);
+
+	m_hasWrittenRecords = true;
+}
+
+bool CompressionGlobal::HasWrittenRecords() const
+{
+	return m_hasWrittenRecords;
+}
+
+bool CompressionGlobal::CanWriteRecords() const
+{
+	return !m_recordsDisabled && m_collectedPages == nullptr;
+}
+
+void CompressionGlobal::DisableRecords()
+{
+	m_recordsDisabled = true;
+}
+
+void CompressionGlobal::WritePageHeader(uint64_t checksum, size_t compressedSize, size_t uncompressedSize)
+{
+	uint8_t chunkSizeBytes[16];
+	chunkSizeBytes[0] = static_cast<uint8_t>((compressedSize >> 0) & 0xffu);
+	chunkSizeBytes[1] = static_cast<uint8_t>((compressedSize >> 8) & 0xffu);
+	chunkSizeBytes[2] = static_cast<uint8_t>((compressedSize >> 16) & 0xffu);
+	chunkSizeBytes[3] = static_cast<uint8_t>((compressedSize >> 24) & 0xffu);
+	chunkSizeBytes[4] = static_cast<uint8_t>((uncompressedSize >> 0) & 0xffu);
+	chunkSizeBytes[5] = static_cast<uint8_t>((uncompressedSize >> 8) & 0xffu);
+	chunkSizeBytes[6] = static_cast<uint8_t>((uncompressedSize >> 16) & 0xffu);
+	chunkSizeBytes[7] = static_cast<uint8_t>((uncompressedSize >> 24) & 0xffu);
+
+	size_t headerSize = PageHeaderSize(m_checksumType);
+	for (size_t i = 8; i < headerSize; i++)
+		chunkSizeBytes[i] = static_cast<uint8_t>((checksum >> ((i - 8) * 8)) & 0xffu);
+
+	fwrite(chunkSizeBytes, 1, headerSize, m_outF);
+}
+
+void CompressionGlobal::SetInputMemory(const void *data)
+{
+	m_inputMemory = static_cast<const uint8_t *>(data);
+}
+
+void CompressionGlobal::SetPageCollector(std::vector<CompressedPageRecord> *pages)
+{
+	m_collectedPages = pages;
+}
+
+void CompressionGlobal::SetStatsWriter(PageStatsWriter *statsWriter)
+{
+	m_statsWriter = statsWriter;
+}
+
+bool CompressionGlobal::IsCollectingStats() const
+{
+	return m_statsWriter != nullptr;
+}
+
+void CompressionGlobal::WritePageStats(const PageStats &stats)
+{
+	std::lock_guard<std::mutex> lock(m_logMutex);
+
+	m_statsWriter->WritePage(stats);
+}
+
+void CompressionGlobal::SetTraceRecorder(TraceRecorder *traceRecorder)
+{
+	m_traceRecorder = traceRecorder;
+}
+
+TraceRecorder *CompressionGlobal::GetTraceRecorder() const
+{
+	return m_traceRecorder;
+}
+
+void CompressionGlobal::SetNumLanes(unsigned int numLanes)
+{
+	m_numLanes = numLanes;
+}
+
+unsigned int CompressionGlobal::NumLanes() const
+{
+	return m_numLanes;
+}
+
+void CompressionGlobal::SetChecksumType(PageChecksumType checksumType)
+{
+	m_checksumType = checksumType;
+}
+
+PageChecksumType CompressionGlobal::ChecksumType() const
+{
+	return m_checksumType;
+}
+
+void CompressionGlobal::SetDeduplicate(bool deduplicate)
+{
+	m_deduplicate = deduplicate;
+}
+
+bool CompressionGlobal::IsDeduplicating() const
+{
+	return m_deduplicate;
+}
+
+void CompressionGlobal::SetIncompressibleMargin(unsigned int marginPercent)
+{
+	m_skipIncompressible = true;
+	m_incompressibleMargin = marginPercent;
+}
+
+bool CompressionGlobal::IsSkippingIncompressible() const
+{
+	return m_skipIncompressible;
+}
+
+unsigned int CompressionGlobal::IncompressibleMargin() const
+{
+	return m_incompressibleMargin;
+}
+
+void CompressionGlobal::SetSearch(const std::vector<SearchCandidate> &candidates, uint64_t budgetNanoseconds)
+{
+	m_searchCandidates = candidates;
+	m_searchBudgetNanoseconds = budgetNanoseconds;
+}
+
+bool CompressionGlobal::IsSearching() const
+{
+	return !m_searchCandidates.empty();
+}
+
+const std::vector<SearchCandidate> &CompressionGlobal::SearchCandidates() const
+{
+	return m_searchCandidates;
+}
+
+uint64_t CompressionGlobal::SearchBudgetNanoseconds() const
+{
+	return m_searchBudgetNanoseconds;
+}
+
+void CompressionGlobal::SetLevelController(LevelController *levelController)
+{
+	m_levelController = levelController;
+}
+
+LevelController *CompressionGlobal::GetLevelController() const
+{
+	return m_levelController;
+}
+
+unsigned int CompressionGlobal::NumLevelSettings() const
+{
+	// Searches step through the candidates in order.  Otherwise, every zstd level up to the configured
+	// level is a setting that keeps the configured libdeflate choice, and if libdeflate is enabled, an
+	// extra setting below those drops it at level 1.
+	if (IsSearching())
+		return static_cast<unsigned int>(m_searchCandidates.size());
+
+	unsigned int numSettings = TopLadderLevel();
+	if (m_useDeflate)
+		numSettings++;
+
+	return numSettings;
+}
+
+unsigned int CompressionGlobal::InitialLevelSetting() const
+{
+	return NumLevelSettings() - 1;
+}
+
+unsigned int CompressionGlobal::TopLadderLevel() const
+{
+	unsigned int clevel = m_compressionLevel;
+	if (clevel == 0)
+		clevel = static_cast<unsigned int>(ZSTD_defaultCLevel());
+
+	return std::min(clevel, static_cast<unsigned int>(ZSTD_maxCLevel()));
+}
+
+void CompressionGlobal::SetPageCache(PageCache *pageCache)
+{
+	m_pageCache = pageCache;
+}
+
+PageCache *CompressionGlobal::GetPageCache() const
+{
+	return m_pageCache;
+}
+
+void CompressionGlobal::SetBaseArchive(const ArchiveIndex *baseIndex, const uint8_t *baseData)
+{
+	m_baseIndex = baseIndex;
+	m_baseData = baseData;
+
+	m_basePagesByChecksum.clear();
+
+	if (m_checksumType == kPageChecksumXXH64)
+	{
+		for (size_t i = 0; i < baseIndex->m_pages.size(); i++)
+			m_basePagesByChecksum.insert(std::make_pair(baseIndex->m_pages[i].m_checksum, i));
+	}
+}
+
+bool CompressionGlobal::HasBaseArchive() const
+{
+	return m_baseIndex != nullptr;
+}
+
+const ArchiveIndex &CompressionGlobal::BaseArchiveIndex() const
+{
+	return *m_baseIndex;
+}
+
+const uint8_t *CompressionGlobal::BaseArchiveData() const
+{
+	return m_baseData;
+}
+
+bool CompressionGlobal::FindBasePage(size_t pageIndex, uint64_t checksum, size_t uncompressedSize, size_t &outBasePage) const
+{
+	const std::vector<ArchivePageEntry> &basePages = m_baseIndex->m_pages;
+
+	// Constant pages are detected before the base is searched, so only pages with stored bytes are copied.
+	// References already point at the stored bytes of the page they reference.
+	size_t candidatePage = pageIndex;
+
+	if (candidatePage >= basePages.size() || basePages[candidatePage].m_checksum != checksum)
+	{
+		std::unordered_map<uint64_t, size_t>::const_iterator it = m_basePagesByChecksum.find(checksum);
+		if (it == m_basePagesByChecksum.end())
+			return false;
+
+		candidatePage = it->second;
+	}
+
+	const ArchivePageEntry &basePage = basePages[candidatePage];
+
+	if (basePage.m_checksum != checksum || basePage.m_uncompressedSize != uncompressedSize || basePage.m_recordType == kArchiveRecordConstant)
+		return false;
+
+	outBasePage = candidatePage;
+	return true;
+}
+
+uint64_t CompressionGlobal::PageCacheSettingsHash(unsigned int level, bool useDeflate, size_t numSearchCandidates) const
+{
+	// The global page size is included because it limits the encoded offsets of every page
+	uint64_t settings[9] =
+	{
+		kPageCacheVersion, m_pageSize, m_numLanes, m_tweaks, level, useDeflate ? 1u : 0u, m_useZStd ? 1u : 0u, m_dictHash, numSearchCandidates
+	};
+
+	uint64_t hash = XXH64(settings, sizeof(settings), 0);
+
+	for (size_t i = 0; i < numSearchCandidates; i++)
+		hash = XXH64(m_searchCandidates[i].m_name.c_str(), m_searchCandidates[i].m_name.size(), hash);
+
+	return hash;
+}
+
+void CompressionGlobal::GetLevelSetting(unsigned int setting, unsigned int &outLevel, bool &outUseDeflate, size_t &outNumSearchCandidates) const
+{
+	outLevel = m_compressionLevel;
+	outUseDeflate = m_useDeflate;
+	outNumSearchCandidates = m_searchCandidates.size();
+
+	if (IsSearching())
+	{
+		outNumSearchCandidates = setting + 1;
+		return;
+	}
+
+	if (m_useDeflate)
+	{
+		if (setting == 0)
+		{
+			outLevel = 1;
+			outUseDeflate = false;
+			return;
+		}
+
+		setting--;
+	}
+
+	outLevel = std::min(setting + 1, TopLadderLevel());
+}
+
+bool CompressionGlobal::FindEarlierDuplicate(uint64_t contentHash, size_t pageIndex, size_t &outEarlierPage)
+{
+	std::lock_guard<std::mutex> lock(m_dedupMutex);
+
+	std::unordered_map<uint64_t, size_t>::iterator it = m_dedupPages.find(contentHash);
+	if (it == m_dedupPages.end())
+	{
+		m_dedupPages[contentHash] = pageIndex;
+		return false;
+	}
+
+	if (it->second < pageIndex)
+	{
+		outEarlierPage = it->second;
+		return true;
+	}
+
+	it->second = pageIndex;
+	return false;
+}
+
+bool CompressionGlobal::IsUsingZStd() const
+{
+	return m_useZStd;
+}
+
+bool CompressionGlobal::IsUsingDeflate() const
+{
+	return m_useDeflate;
+}
+
+size_t CompressionGlobal::NumPages() const
+{
+	return m_numPages;
+}
+
+size_t CompressionGlobal::PageSize() const
+{
+	return m_pageSize;
+}
+
+size_t CompressionGlobal::GlobalSize() const
+{
+	return m_globalSize;
+}
+
+unsigned int CompressionGlobal::CompressionLevel() const
+{
+	return m_compressionLevel;
+}
+
+unsigned int CompressionGlobal::Tweaks() const
+{
+	return m_tweaks;
+}
+
+const char* CompressionGlobal::FailBlockPath() const
+{
+	return m_failBlockPath;
+}
+
+bool CompressionGlobal::IsIsolateBlock() const
+{
+	return m_isIsolateBlock;
+}
+
+unsigned int CompressionGlobal::IsolateBlock() const
+{
+	return m_isolateBlock;
+}
+
+ZSTD_CDict *CompressionGlobal::ZStdDict() const
+{
+	return m_dict;
+}
+
+const void *CompressionGlobal::ZStdDictData() const
+{
+	return m_dictData;
+}
+
+size_t CompressionGlobal::ZStdDictSize() const
+{
+	return m_dictSize;
+}
+
+// Checks if every byte of a page is the same.  The page is compared a word at a time against the first
+// byte repeated, in blocks that compilers vectorize, with an early out after each block.
+bool FindConstantByte(const uint8_t *data, size_t size, uint8_t &outByte)
+{
+	if (size == 0)
+		return false;
+
+	const size_t kBlockWords = 8;
+	const size_t kBlockSize = kBlockWords * sizeof(uint64_t);
+
+	uint8_t byte = data[0];
+	uint64_t pattern = static_cast<uint64_t>(byte) * 0x0101010101010101ull;
+
+	size_t offset = 0;
+	while (size - offset >= kBlockSize)
+	{
+		uint64_t words[kBlockWords];
+		memcpy(words, data + offset, kBlockSize);
+
+		uint64_t diff = 0;
+		for (size_t i = 0; i < kBlockWords; i++)
+			diff |= words[i] ^ pattern;
+
+		if (diff != 0)
+			return false;
+
+		offset += kBlockSize;
+	}
+
+	for (; offset < size; offset++)
+	{
+		if (data[offset] != byte)
+			return false;
+	}
+
+	outByte = byte;
+	return true;
+}
+
+class CompressionTask : public ThreadedTaskBase
+{
+public:
+	CompressionTask();
+	~CompressionTask();
+
+	void Init(CompressionGlobal *cglobal);
+
+	void RunWorkUnit(size_t workUnit) override;
+	void FinishWritingWorkUnit() override;
+
+	const CompressionStageStats &StageStats() const;
+
+	// Number of pages each search candidate produced the smallest result for
+	const std::vector<uint64_t> &SearchWins() const;
+	uint64_t NumSearchBudgetStops() const;
+
+	uint64_t NumBasePages() const;
+
+private:
+	struct CompressionOutputBuffer
+	{
+		CompressionOutputBuffer() : m_data(nullptr), m_size(0), m_capacity(0) {}
+
+		unsigned char *m_data;
+		size_t m_size;
+		size_t m_capacity;
+	};
+
+	struct CompressionInputBuffer
+	{
+		CompressionInputBuffer() : m_data(nullptr), m_readPos(0), m_size(0) {}
+
+		const unsigned char *m_data;
+		size_t m_readPos;
+		size_t m_size;
+	};
+
+	size_t ComputeCurrentPageSize() const;
+
+	uint64_t ComputeContentHash(size_t currentPageSize) const;
+	bool FindDuplicatePage(size_t currentPageSize);
+	bool LoadFromPageCache(size_t currentPageSize);
+	bool MatchesBasePage(size_t currentPageSize);
+	void WriteBasePage(size_t currentPageSize);
+	void StoreInPageCache(size_t currentPageSize);
+	bool IsEstimatedIncompressible(size_t currentPageSize);
+	zstdhl_ResultCode_t ConvertDeflatedData();
+
+	void CompressWorkUnit(size_t workUnit);
+	void RunSearch(size_t currentPageSize);
+
+	// Compresses the page with a candidate and points the transcode input at the resulting zstd frame
+	bool CompressSearchCandidate(size_t candidateIndex, size_t currentPageSize, bool &outUsedDict);
+
+	size_t m_workUnit;
+	size_t m_compressedSize;
+	uint64_t m_pageChecksum;
+	ArchiveRecordType m_recordType;
+	uint32_t m_recordPayload;
+	bool m_isEstimatedIncompressible;
+	unsigned char *m_dedupCompareData;
+	size_t m_deflatedSize;
+	size_t m_maxCompressedSize;
+	size_t m_maxDeflatedData;
+	CompressionGlobal *m_cglobal;
+	unsigned char *m_inputData;
+	unsigned char *m_compressedData;
+	unsigned char *m_deflatedData;
+	ZSTD_CCtx *m_ctx;
+	libdeflate_compressor *m_libdeflateCompressor;
+
+	CompressionOutputBuffer m_transcodeOutput;
+	CompressionOutputBuffer m_deflateConvOutput;
+	CompressionOutputBuffer m_searchBestOutput;
+
+	// Settings of the current page, which can be changed per page by a level controller
+	unsigned int m_pageLevel;
+	bool m_pageUseDeflate;
+	size_t m_pageNumSearchCandidates;
+
+	// Set when the page was looked up in the page cache, the hashes are kept to store it after compression
+	bool m_isPageCacheHit;
+	bool m_isPageCacheMiss;
+	uint64_t m_pageContentHash;
+	uint64_t m_pageVerifyHash;
+	uint64_t m_pageSettingsHash;
+	std::vector<uint8_t> m_pageCacheData;
+
+	// Set when the page is copied from the base archive
+	bool m_isBasePage;
+	size_t m_basePage;
+	uint64_t m_numBasePages;
+	std::vector<uint8_t> m_baseDecodeBuffer;
+	std::vector<uint8_t> m_baseStagingBuffer;
+
+	std::vector<libdeflate_compressor *> m_searchDeflateCompressors;
+	std::vector<uint64_t> m_searchWins;
+	uint64_t m_numSearchBudgetStops;
+
+	zstdhl_EncoderOutputObject_t m_encoderOutputObj;
+	zstdhl_EncoderOutputObject_t m_deflateConvOutputObj;
+	zstdhl_MemoryAllocatorObject_t m_memAlloc;
+	gstd_EncoderState_t *m_encState;
+	zstdhl_StreamSourceObject_t m_dictStreamSource;
+	zstdhl_StreamSourceObject_t m_transcodeStreamSource;
+	zstdhl_StreamSourceObject_t m_deflateConvStreamSource;
+
+	CompressionInputBuffer m_dictInput;
+	CompressionInputBuffer m_transcodeInput;
+	CompressionInputBuffer m_deflateConvInput;
+
+	size_t m_numLanes;
+
+	size_t m_deflateReadPos;
+
+	CompressionStageStats m_stageStats;
+	PageStats m_pageStats;
+
+	static void *CBRealloc(void *userdata, void *ptr, size_t newSize);
+	static zstdhl_ResultCode_t CBWriteBitstream(void *userdata, const void *data, size_t size);
+	static size_t CBReadBytes(void *userdata, void *dest, size_t size);
+};
+
+CompressionTask::CompressionTask()
+	: m_workUnit(0), m_cglobal(nullptr), m_inputData(nullptr), m_compressedData(nullptr), m_compressedSize(0), m_pageChecksum(0), m_recordType(kArchiveRecordNone), m_recordPayload(0), m_isEstimatedIncompressible(false), m_dedupCompareData(nullptr), m_ctx(nullptr),
+	m_encState(nullptr), m_maxCompressedSize(0), m_deflatedSize(0), m_maxDeflatedData(0), m_pageLevel(0), m_pageUseDeflate(false), m_pageNumSearchCandidates(0), m_isPageCacheHit(false), m_isPageCacheMiss(false), m_pageContentHash(0), m_pageVerifyHash(0), m_pageSettingsHash(0), m_isBasePage(false), m_basePage(0), m_numBasePages(0), m_numSearchBudgetStops(0)
+{
+	m_numLanes = 32;
+
+	m_encoderOutputObj.m_userdata = nullptr;
+	m_encoderOutputObj.m_writeBitstreamFunc = nullptr;
+
+	m_deflateConvOutputObj.m_userdata = nullptr;
+	m_deflateConvOutputObj.m_writeBitstreamFunc = nullptr;
+
+	m_memAlloc.m_userdata = nullptr;
+	m_memAlloc.m_reallocFunc = nullptr;
+
+	m_transcodeStreamSource.m_readBytesFunc = nullptr;
+	m_transcodeStreamSource.m_userdata = nullptr;
+
+	m_dictStreamSource.m_readBytesFunc = nullptr;
+	m_dictStreamSource.m_userdata = nullptr;
+
+	m_deflateConvStreamSource.m_readBytesFunc = nullptr;
+	m_deflateConvStreamSource.m_userdata = nullptr;
+}
+
+CompressionTask::~CompressionTask()
+{
+	delete[] m_inputData;
+	delete[] m_compressedData;
+	delete[] m_transcodeOutput.m_data;
+	delete[] m_deflateConvOutput.m_data;
+	delete[] m_searchBestOutput.m_data;
+	delete[] m_deflatedData;
+	delete[] m_dedupCompareData;
+
+	if (m_ctx)
+		ZSTD_freeCCtx(m_ctx);
+
+	if (m_encState)
+		gstd_Encoder_Destroy(m_encState);
+
+	if (m_libdeflateCompressor)
+		libdeflate_free_compressor(m_libdeflateCompressor);
+
+	for (libdeflate_compressor *compressor : m_searchDeflateCompressors)
+	{
+		if (compressor)
+			libdeflate_free_compressor(compressor);
+	}
+}
+
+void CompressionTask::Init(CompressionGlobal *cglobal)
+{
+	m_cglobal = cglobal;
+	m_numLanes = cglobal->NumLanes();
+	m_inputData = new unsigned char[cglobal->PageSize()];
+
+	m_maxCompressedSize = ZSTD_compressBound(cglobal->PageSize());
+	m_compressedData = new unsigned char[m_maxCompressedSize];
+
+	if (cglobal->IsDeduplicating())
+		m_dedupCompareData = new unsigned char[cglobal->PageSize()];
+
+	m_ctx = ZSTD_createCCtx();
+	m_libdeflateCompressor = libdeflate_alloc_compressor(12);
+
+	m_pageLevel = cglobal->CompressionLevel();
+	m_pageUseDeflate = cglobal->IsUsingDeflate();
+	m_pageNumSearchCandidates = cglobal->SearchCandidates().size();
+
+	const std::vector<SearchCandidate> &searchCandidates = cglobal->SearchCandidates();
+	bool searchUsesDeflate = false;
+
+	m_searchDeflateCompressors.assign(searchCandidates.size(), nullptr);
+	m_searchWins.assign(searchCandidates.size(), 0);
+
+	for (size_t i = 0; i < searchCandidates.size(); i++)
+	{
+		if (searchCandidates[i].m_type == kSearchCandidateDeflate)
+		{
+			m_searchDeflateCompressors[i] = libdeflate_alloc_compressor(static_cast<int>(searchCandidates[i].m_level));
+			searchUsesDeflate = true;
+		}
+	}
+
+	if (m_cglobal->IsUsingDeflate() || searchUsesDeflate)
+	{
+		m_maxDeflatedData = libdeflate_deflate_compress_bound(m_libdeflateCompressor, cglobal->PageSize());
+		m_deflatedData = new unsigned char[m_maxDeflatedData];
+	}
+	else
+	{
+		m_maxDeflatedData = 0;
+		m_deflatedData = nullptr;
+	}
+
+	m_memAlloc.m_userdata = this;
+	m_memAlloc.m_reallocFunc = CBRealloc;
+
+	m_encoderOutputObj.m_userdata = &m_transcodeOutput;
+	m_encoderOutputObj.m_writeBitstreamFunc = CBWriteBitstream;
+
+	m_deflateConvOutputObj.m_userdata = &m_deflateConvOutput;
+	m_deflateConvOutputObj.m_writeBitstreamFunc = CBWriteBitstream;
+
+	m_transcodeStreamSource.m_userdata = &m_transcodeInput;
+	m_transcodeStreamSource.m_readBytesFunc = CBReadBytes;
+
+	m_dictStreamSource.m_userdata = &m_dictInput;
+	m_dictStreamSource.m_readBytesFunc = CBReadBytes;
+
+	m_deflateConvStreamSource.m_userdata = &m_deflateConvInput;
+	m_deflateConvStreamSource.m_readBytesFunc = CBReadBytes;
+
+	gstd_Encoder_Create(&m_encoderOutputObj, m_numLanes, gstd_ComputeMaxOffsetExtraBits(static_cast<uint32_t>(cglobal->PageSize())), m_cglobal->Tweaks(), &m_memAlloc, &m_encState);	// TODO: Error check
+}
+
+void CompressionTask::RunWorkUnit(size_t workUnit)
+{
+	LevelController *levelController = m_cglobal->GetLevelController();
+	unsigned int setting = 0;
+
+	if (levelController)
+	{
+		setting = levelController->CurrentSetting();
+		m_cglobal->GetLevelSetting(setting, m_pageLevel, m_pageUseDeflate, m_pageNumSearchCandidates);
+	}
+
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+	m_isPageCacheHit = false;
+	m_isPageCacheMiss = false;
+
+	CompressWorkUnit(workUnit);
+
+	// Failed transcodes aren't cached, so that they're retried once the failure is fixed
+	if (m_isPageCacheMiss && !m_pageStats.m_transcodeFailed)
+		StoreInPageCache(ComputeCurrentPageSize());
+
+	if (levelController)
+	{
+		bool isCompressed = (m_recordType == kArchiveRecordNone && !m_isBasePage && !m_isEstimatedIncompressible && !m_isPageCacheHit);
+		levelController->AddSample(setting, ComputeCurrentPageSize(), NanosecondsSince(startTime), isCompressed);
+	}
+}
+
+void CompressionTask::CompressWorkUnit(size_t workUnit)
+{
+	bool useDict = false;
+
+	m_workUnit = workUnit;
+
+	if (m_cglobal->IsIsolateBlock() && m_cglobal->IsolateBlock() != workUnit)
+		return;
+
+	size_t currentPageSize = ComputeCurrentPageSize();
+
+	m_cglobal->ReadFromInput(m_inputData, workUnit * m_cglobal->PageSize(), currentPageSize);
+
+	m_pageStats.Reset(workUnit, currentPageSize);
+
+	TraceRecorder *traceRecorder = m_cglobal->GetTraceRecorder();
+
+	// The checksum is computed here rather than when the page is written so that it runs in parallel
+	std::chrono::steady_clock::time_point stageStartTime = std::chrono::steady_clock::now();
+
+	TraceBegin(traceRecorder, "checksum");
+	m_pageChecksum = ComputePageChecksum(m_cglobal->ChecksumType(), m_inputData, currentPageSize);
+	TraceEnd(traceRecorder);
+
+	m_pageStats.m_stageNanoseconds[kCompressionStageCRC] = m_stageStats.AddSample(kCompressionStageCRC, stageStartTime, currentPageSize, 0);
+
+	// Constant pages are checked first since they never need to be compared against other pages
+	m_recordType = kArchiveRecordNone;
+
+	uint8_t constantByte = 0;
+	if (m_cglobal->CanWriteRecords() && FindConstantByte(m_inputData, currentPageSize, constantByte))
+	{
+		m_recordType = kArchiveRecordConstant;
+		m_recordPayload = constantByte;
+		m_pageStats.m_winner = kPageWinnerConstant;
+		return;
+	}
+
+	m_isBasePage = false;
+
+	if (m_cglobal->HasBaseArchive() && m_cglobal->FindBasePage(workUnit, m_pageChecksum, currentPageSize, m_basePage) && MatchesBasePage(currentPageSize))
+	{
+		m_isBasePage = true;
+		m_pageStats.m_winner = kPageWinnerBase;
+		return;
+	}
+
+	if (m_cglobal->IsDeduplicating() && m_cglobal->CanWriteRecords() && FindDuplicatePage(currentPageSize))
+	{
+		m_recordType = kArchiveRecordPageReference;
+		m_pageStats.m_winner = kPageWinnerReference;
+		return;
+	}
+
+	m_isEstimatedIncompressible = false;
+
+	if (m_cglobal->IsSkippingIncompressible())
+	{
+		stageStartTime = std::chrono::steady_clock::now();
+
+		TraceBegin(traceRecorder, "estimate");
+		m_isEstimatedIncompressible = IsEstimatedIncompressible(currentPageSize);
+		TraceEnd(traceRecorder);
+
+		m_pageStats.m_stageNanoseconds[kCompressionStageEstimate] = m_stageStats.AddSample(kCompressionStageEstimate, stageStartTime, currentPageSize, 0);
+
+		if (m_isEstimatedIncompressible)
+		{
+			m_pageStats.m_winner = kPageWinnerEstimatedStored;
+			return;
+		}
+	}
+
+	if (m_cglobal->GetPageCache())
+	{
+		if (LoadFromPageCache(currentPageSize))
+		{
+			m_pageStats.m_winner = kPageWinnerCached;
+			return;
+		}
+	}
+
+	if (m_cglobal->IsSearching())
+	{
+		RunSearch(currentPageSize);
+		return;
+	}
+
+	stageStartTime = std::chrono::steady_clock::now();
+
+ 	if (m_cglobal->IsUsingZStd())
+	{
+		TraceScope traceScope(traceRecorder, "zstd");
+
+		unsigned int clevel = std::min(m_pageLevel, static_cast<unsigned int>(ZSTD_maxCLevel()));
+
+		ZSTD_CCtx_setPledgedSrcSize(m_ctx, currentPageSize);
+		ZSTD_CCtx_setParameter(m_ctx, ZSTD_c_compressionLevel, static_cast<int>(clevel));
+		//ZSTD_CCtx_setParameter(m_ctx, ZSTD_c_useBlockSplitter, static_cast<int>(ZSTD_ps_enable));
+
+		if (m_cglobal->ZStdDict())
+		{
+			m_compressedSize = ZSTD_compress_usingCDict(m_ctx, m_compressedData, m_maxCompressedSize, m_inputData, currentPageSize, m_cglobal->ZStdDict());
+			useDict = true;
+		}
+		else
+			m_compressedSize = ZSTD_compress2(m_ctx, m_compressedData, m_maxCompressedSize, m_inputData, currentPageSize);
+
+		ZSTD_CCtx_reset(m_ctx, ZSTD_reset_session_and_parameters);
+
+		m_pageStats.m_stageNanoseconds[kCompressionStageZStd] = m_stageStats.AddSample(kCompressionStageZStd, stageStartTime, currentPageSize, m_compressedSize);
+		m_pageStats.m_zstdSize = m_compressedSize;
+		m_pageStats.m_winner = kPageWinnerZStd;
+	}
+	else
+		m_compressedSize = 0;
+
+	m_transcodeInput.m_readPos = 0;
+	m_dictInput.m_readPos = 0;
+
+	m_transcodeInput.m_size = m_compressedSize;
+	m_transcodeInput.m_data = m_compressedData;
+
+	m_dictInput.m_data = static_cast<const uint8_t *>(m_cglobal->ZStdDictData());
+	m_dictInput.m_size = m_cglobal->ZStdDictSize();
+
+	if (m_pageUseDeflate)
+	{
+		stageStartTime = std::chrono::steady_clock::now();
+
+		TraceBegin(traceRecorder, "deflate");
+		m_deflatedSize = libdeflate_deflate_compress(m_libdeflateCompressor, m_inputData, currentPageSize, m_deflatedData, m_maxDeflatedData);
+		TraceEnd(traceRecorder);
+
+		m_pageStats.m_stageNanoseconds[kCompressionStageDeflate] = m_stageStats.AddSample(kCompressionStageDeflate, stageStartTime, currentPageSize, m_deflatedSize);
+		m_pageStats.m_deflateSize = m_deflatedSize;
+
+		stageStartTime = std::chrono::steady_clock::now();
+
+		TraceBegin(traceRecorder, "convert");
+		zstdhl_ResultCode_t convResult = ConvertDeflatedData();
+		TraceEnd(traceRecorder);
+
+		m_pageStats.m_stageNanoseconds[kCompressionStageDeflateConv] = m_stageStats.AddSample(kCompressionStageDeflateConv, stageStartTime, m_deflatedSize, m_deflateConvOutput.m_size);
+		m_pageStats.m_deflateConvSize = m_deflateConvOutput.m_size;
+
+		if (m_deflatedSize > 0 && convResult == ZSTDHL_RESULT_OK)
+		{
+			unsigned char *convertedData = m_deflateConvOutput.m_data;
+			size_t convertedSize = m_deflateConvOutput.m_size;
+
+			if (m_transcodeInput.m_size == 0 || m_deflateConvOutput.m_size < m_transcodeInput.m_size)
+			{
+				m_transcodeInput.m_size = m_deflateConvOutput.m_size;
+				m_transcodeInput.m_data = m_deflateConvOutput.m_data;
+				useDict = false;
+
+				m_pageStats.m_winner = kPageWinnerDeflateConv;
+			}
+		}
+	}
+
+	m_transcodeOutput.m_size = 0;
+
+	m_pageStats.m_usedDict = useDict;
+
+	stageStartTime = std::chrono::steady_clock::now();
+
+	TraceBegin(traceRecorder, "transcode");
+	zstdhl_ResultCode_t transcodeResult = gstd_Encoder_Transcode(m_encState, &m_transcodeStreamSource, useDict ? (&m_dictStreamSource) : nullptr, &m_memAlloc);
+	TraceEnd(traceRecorder);
+
+	m_pageStats.m_stageNanoseconds[kCompressionStageTranscode] = m_stageStats.AddSample(kCompressionStageTranscode, stageStartTime, m_transcodeInput.m_size, m_transcodeOutput.m_size);
+	m_pageStats.m_transcodedSize = m_transcodeOutput.m_size;
+
+	if (transcodeResult == ZSTDHL_RESULT_OK && m_cglobal->IsCollectingStats())
+		ParseZStdFrameBlocks(m_transcodeInput.m_data, m_transcodeInput.m_size, m_pageStats.m_blocks);
+
+	if (transcodeResult != ZSTDHL_RESULT_OK)
+	{
+		m_pageStats.m_transcodeFailed = true;
+
+		const char* failBlockBase = m_cglobal->FailBlockPath();
+
+		if (failBlockBase[0] != 0)
+		{
+			std::string pathBase(failBlockBase);
+			if (pathBase.back() != '/' && pathBase.back() != '\\')
+				pathBase.append("/");
+
+			fprintf(stderr, "Failed with result code %i in block %zu\n", static_cast<int>(transcodeResult), m_workUnit);
+			m_transcodeOutput.m_size = 0;
+
+			char debugPath[128];
+			sprintf_s(debugPath, "fail_block_%zu.bin", m_workUnit);
+
+			std::string fullPath = pathBase + debugPath;
+
+			if (FILE* debugFile = fopen(fullPath.c_str(), "wb"))
+			{
+				fwrite(m_inputData, 1, currentPageSize, debugFile);
+				fclose(debugFile);
+			}
+
+			sprintf_s(debugPath, "fail_block_%zu.zstd", m_workUnit);
+
+			fullPath = pathBase + debugPath;
+
+			if (FILE* debugFile = fopen(fullPath.c_str(), "wb"))
+			{
+				fwrite(m_compressedData, 1, m_compressedSize, debugFile);
+				fclose(debugFile);
+			}
+		}
+	}
+}
+
+void CompressionTask::FinishWritingWorkUnit()
+{
+	if (m_cglobal->IsIsolateBlock() && m_cglobal->IsolateBlock() != m_workUnit)
+		return;
 
 	size_t currentPageSize = ComputeCurrentPageSize();
 
-	m_cglobal->ReadFromInput(m_inputData, workUnit * m_cglobal->PageSize(), currentPageSize);
+	if (m_recordType != kArchiveRecordNone)
+	{
+		m_pageStats.m_finalSize = kArchiveRecordSize;
+
+		m_cglobal->WriteRecordToOutput(m_recordType, m_recordPayload, m_pageChecksum, currentPageSize);
+
+		if (m_cglobal->IsCollectingStats())
+			m_cglobal->WritePageStats(m_pageStats);
+
+		return;
+	}
+
+	if (m_isBasePage)
+	{
+		WriteBasePage(currentPageSize);
+		return;
+	}
+
+	const unsigned char *compressedData = m_transcodeOutput.m_data;
+	size_t compressedSize = m_transcodeOutput.m_size;
+
+	if (m_isEstimatedIncompressible)
+	{
+		compressedSize = currentPageSize;
+		compressedData = m_inputData;
+	}
+	else if (compressedSize == 0 || compressedSize >= currentPageSize)
+	{
+		compressedSize = currentPageSize;
+		compressedData = m_inputData;
+
+		m_pageStats.m_winner = kPageWinnerStored;
+	}
+
+	m_pageStats.m_finalSize = compressedSize;
+
+	m_cglobal->WriteToOutput(compressedData, m_pageChecksum, compressedSize, currentPageSize);
+
+	if (m_cglobal->IsCollectingStats())
+		m_cglobal->WritePageStats(m_pageStats);
+}
+
+bool CompressionTask::MatchesBasePage(size_t currentPageSize)
+{
+	TraceScope traceScope(m_cglobal->GetTraceRecorder(), "base-compare");
+
+	// Checksums can collide, so the base page is decoded and compared byte for byte before it's reused
+	const ArchiveIndex &baseIndex = m_cglobal->BaseArchiveIndex();
+	const ArchivePageEntry &basePage = baseIndex.m_pages[m_basePage];
+
+	m_baseDecodeBuffer.assign((currentPageSize + 3u) & ~static_cast<size_t>(3u), 0);
+
+	uint64_t actualChecksum = 0;
+	if (!DecodeArchivePage(baseIndex.m_header, basePage, m_cglobal->BaseArchiveData() + basePage.m_storedOffset, m_baseStagingBuffer, &m_baseDecodeBuffer[0], actualChecksum, nullptr, nullptr))
+		return false;
+
+	return memcmp(&m_baseDecodeBuffer[0], m_inputData, currentPageSize) == 0;
+}
+
+void CompressionTask::WriteBasePage(size_t currentPageSize)
+{
+	const ArchivePageEntry &basePage = m_cglobal->BaseArchiveIndex().m_pages[m_basePage];
+
+	// The stored bytes are copied as they are, compressed or not, so the page keeps its old stored size
+	m_pageStats.m_finalSize = basePage.m_storedSize;
+
+	m_cglobal->WriteToOutput(m_cglobal->BaseArchiveData() + basePage.m_storedOffset, m_pageChecksum, basePage.m_storedSize, currentPageSize);
+
+	if (m_cglobal->IsCollectingStats())
+		m_cglobal->WritePageStats(m_pageStats);
+
+	m_numBasePages++;
+}
+
+uint64_t CompressionTask::ComputeContentHash(size_t currentPageSize) const
+{
+	if (m_cglobal->ChecksumType() == kPageChecksumXXH64)
+		return m_pageChecksum;
+
+	return XXH64(m_inputData, currentPageSize, 0);
+}
+
+bool CompressionTask::FindDuplicatePage(size_t currentPageSize)
+{
+	// Only full pages are deduplicated, since every page that can be referenced is a full page
+	if (currentPageSize != m_cglobal->PageSize())
+		return false;
+
+	TraceScope traceScope(m_cglobal->GetTraceRecorder(), "dedup");
+
+	uint64_t contentHash = ComputeContentHash(currentPageSize);
+
+	size_t earlierPage = 0;
+	if (!m_cglobal->FindEarlierDuplicate(contentHash, m_workUnit, earlierPage))
+		return false;
+
+	// Hash collisions are possible, so the earlier page is compared byte for byte
+	m_cglobal->ReadFromInput(m_dedupCompareData, earlierPage * currentPageSize, currentPageSize);
+
+	if (memcmp(m_dedupCompareData, m_inputData, currentPageSize) != 0)
+		return false;
+
+	m_recordPayload = static_cast<uint32_t>(earlierPage);
+	return true;
+}
+
+const CompressionStageStats &CompressionTask::StageStats() const
+{
+	return m_stageStats;
+}
+
+size_t CompressionTask::ComputeCurrentPageSize() const
+{
+	if (m_workUnit + 1u == m_cglobal->NumPages())
+	{
+		size_t lastPageSize = m_cglobal->GlobalSize() % m_cglobal->PageSize();
+		if (lastPageSize != 0)
+			return lastPageSize;
+	}
+
+	return m_cglobal->PageSize();
+}
+
+
+zstdhl_ResultCode_t CompressionTask::ConvertDeflatedData()
+{
+	zstdhl_DeflateConv_State_t *deflateConvState = nullptr;
+	zstdhl_EncBlockDesc_t convEncBlock;
+	zstdhl_FrameHeaderDesc_t frameHeaderDesc;
+
+	m_deflateConvOutput.m_size = 0;
+
+	m_deflateConvStreamSource.m_readBytesFunc = CBReadBytes;
+	m_deflateConvStreamSource.m_userdata = &m_deflateConvInput;
+
+	m_deflateConvInput.m_size = m_deflatedSize;
+	m_deflateConvInput.m_readPos = 0;
+	m_deflateConvInput.m_data = m_deflatedData;
+
+	zstdhl_DeflateConv_CreateState(&m_memAlloc, &m_deflateConvStreamSource, &deflateConvState);
+
+	zstdhl_ResultCode_t convResult = ZSTDHL_RESULT_OK;
+	uint8_t eofFlag = 0;
+
+	frameHeaderDesc.m_dictionaryID = 0;
+	frameHeaderDesc.m_frameContentSize = 0;
+	frameHeaderDesc.m_windowSize = 32768;
+	frameHeaderDesc.m_haveContentChecksum = 0;
+	frameHeaderDesc.m_haveDictionaryID = 0;
+	frameHeaderDesc.m_haveFrameContentSize = 0;
+	frameHeaderDesc.m_haveWindowSize = 1;
+	frameHeaderDesc.m_isSingleSegment = 0;
+
+	zstdhl_AssemblerPersistentState_t persistentState;
+
+	zstdhl_InitAssemblerState(&persistentState);
+
+	convResult = zstdhl_AssembleFrame(&frameHeaderDesc, &m_deflateConvOutputObj, 0);
+
+	while (convResult == ZSTDHL_RESULT_OK && !eofFlag)
+	{
+		size_t deflateReadStart = m_deflateConvInput.m_readPos;
+		size_t zstdWriteStart = m_deflateConvOutput.m_size;
+
+		convResult = zstdhl_DeflateConv_Convert(deflateConvState, &eofFlag, &convEncBlock);
+
+		if (eofFlag)
+			break;
+
+		if (convResult == ZSTDHL_RESULT_OK)
+		{
+			convResult = zstdhl_AssembleBlock(&persistentState, &convEncBlock, &m_deflateConvOutputObj, &m_memAlloc);
+		}
+	}
+
+	zstdhl_DeflateConv_DestroyState(deflateConvState);
+
+	return convResult;
+}
+
+void CompressionTask::RunSearch(size_t currentPageSize)
+{
+	TraceRecorder *traceRecorder = m_cglobal->GetTraceRecorder();
+	const std::vector<SearchCandidate> &candidates = m_cglobal->SearchCandidates();
+	uint64_t budgetNanoseconds = m_cglobal->SearchBudgetNanoseconds();
+
+	std::chrono::steady_clock::time_point searchStartTime = std::chrono::steady_clock::now();
+
+	// The smallest result so far is kept in m_searchBestOutput, and swapped back into m_transcodeOutput
+	// at the end so that it's written like any other page
+	size_t bestCandidate = candidates.size();
+	m_searchBestOutput.m_size = 0;
+
+	for (size_t i = 0; i < m_pageNumSearchCandidates; i++)
+	{
+		if (i > 0 && budgetNanoseconds > 0 && NanosecondsSince(searchStartTime) >= budgetNanoseconds)
+		{
+			m_numSearchBudgetStops++;
+			break;
+		}
+
+		bool useDict = false;
+		if (!CompressSearchCandidate(i, currentPageSize, useDict))
+			continue;
+
+		m_transcodeInput.m_readPos = 0;
+		m_dictInput.m_readPos = 0;
+		m_transcodeOutput.m_size = 0;
+
+		std::chrono::steady_clock::time_point stageStartTime = std::chrono::steady_clock::now();
+
+		TraceBegin(traceRecorder, "transcode");
+		zstdhl_ResultCode_t transcodeResult = gstd_Encoder_Transcode(m_encState, &m_transcodeStreamSource, useDict ? (&m_dictStreamSource) : nullptr, &m_memAlloc);
+		TraceEnd(traceRecorder);
+
+		m_pageStats.m_stageNanoseconds[kCompressionStageTranscode] += m_stageStats.AddSample(kCompressionStageTranscode, stageStartTime, m_transcodeInput.m_size, m_transcodeOutput.m_size);
+
+		if (transcodeResult != ZSTDHL_RESULT_OK)
+		{
+			m_pageStats.m_transcodeFailed = true;
+			continue;
+		}
+
+		if (bestCandidate == candidates.size() || m_transcodeOutput.m_size < m_searchBestOutput.m_size)
+		{
+			std::swap(m_transcodeOutput, m_searchBestOutput);
+			bestCandidate = i;
+
+			m_pageStats.m_usedDict = useDict;
+			m_pageStats.m_winner = (candidates[i].m_type == kSearchCandidateZStd) ? kPageWinnerZStd : kPageWinnerDeflateConv;
+		}
+	}
+
+	std::swap(m_transcodeOutput, m_searchBestOutput);
+
+	if (bestCandidate != candidates.size())
+		m_searchWins[bestCandidate]++;
+
+	m_pageStats.m_transcodedSize = m_transcodeOutput.m_size;
+}
+
+bool CompressionTask::CompressSearchCandidate(size_t candidateIndex, size_t currentPageSize, bool &outUsedDict)
+{
+	const SearchCandidate &candidate = m_cglobal->SearchCandidates()[candidateIndex];
+	TraceRecorder *traceRecorder = m_cglobal->GetTraceRecorder();
+
+	std::chrono::steady_clock::time_point stageStartTime = std::chrono::steady_clock::now();
+
+	outUsedDict = false;
+
+	if (candidate.m_type == kSearchCandidateZStd)
+	{
+		TraceScope traceScope(traceRecorder, "zstd");
+
+		unsigned int clevel = std::min(candidate.m_level, static_cast<unsigned int>(ZSTD_maxCLevel()));
+
+		if (m_cglobal->ZStdDict())
+		{
+			ZSTD_CCtx_refCDict(m_ctx, m_cglobal->ZStdDict());
+			outUsedDict = true;
+		}
+
+		ZSTD_CCtx_setPledgedSrcSize(m_ctx, currentPageSize);
+		ZSTD_CCtx_setParameter(m_ctx, ZSTD_c_compressionLevel, static_cast<int>(clevel));
+
+		if (candidate.m_strategy != 0)
+			ZSTD_CCtx_setParameter(m_ctx, ZSTD_c_strategy, static_cast<int>(candidate.m_strategy));
+
+		if (candidate.m_windowLog != 0)
+			ZSTD_CCtx_setParameter(m_ctx, ZSTD_c_windowLog, static_cast<int>(candidate.m_windowLog));
+
+		if (candidate.m_useBlockSplitter)
+			ZSTD_CCtx_setParameter(m_ctx, ZSTD_c_useBlockSplitter, static_cast<int>(ZSTD_ps_enable));
+
+		m_compressedSize = ZSTD_compress2(m_ctx, m_compressedData, m_maxCompressedSize, m_inputData, currentPageSize);
+
+		ZSTD_CCtx_reset(m_ctx, ZSTD_reset_session_and_parameters);
+
+		m_pageStats.m_stageNanoseconds[kCompressionStageZStd] += m_stageStats.AddSample(kCompressionStageZStd, stageStartTime, currentPageSize, m_compressedSize);
+
+		if (ZSTD_isError(m_compressedSize))
+			return false;
+
+		m_pageStats.m_zstdSize = m_compressedSize;
+
+		m_transcodeInput.m_data = m_compressedData;
+		m_transcodeInput.m_size = m_compressedSize;
+
+		m_dictInput.m_data = static_cast<const uint8_t *>(m_cglobal->ZStdDictData());
+		m_dictInput.m_size = m_cglobal->ZStdDictSize();
+
+		return true;
+	}
+
+	TraceBegin(traceRecorder, "deflate");
+	m_deflatedSize = libdeflate_deflate_compress(m_searchDeflateCompressors[candidateIndex], m_inputData, currentPageSize, m_deflatedData, m_maxDeflatedData);
+	TraceEnd(traceRecorder);
+
+	m_pageStats.m_stageNanoseconds[kCompressionStageDeflate] += m_stageStats.AddSample(kCompressionStageDeflate, stageStartTime, currentPageSize, m_deflatedSize);
+	m_pageStats.m_deflateSize = m_deflatedSize;
+
+	if (m_deflatedSize == 0)
+		return false;
+
+	stageStartTime = std::chrono::steady_clock::now();
+
+	TraceBegin(traceRecorder, "convert");
+	zstdhl_ResultCode_t convResult = ConvertDeflatedData();
+	TraceEnd(traceRecorder);
+
+	m_pageStats.m_stageNanoseconds[kCompressionStageDeflateConv] += m_stageStats.AddSample(kCompressionStageDeflateConv, stageStartTime, m_deflatedSize, m_deflateConvOutput.m_size);
+	m_pageStats.m_deflateConvSize = m_deflateConvOutput.m_size;
+
+	if (convResult != ZSTDHL_RESULT_OK)
+		return false;
+
+	m_transcodeInput.m_data = m_deflateConvOutput.m_data;
+	m_transcodeInput.m_size = m_deflateConvOutput.m_size;
+
+	return true;
+}
+
+bool CompressionTask::LoadFromPageCache(size_t currentPageSize)
+{
+	TraceScope traceScope(m_cglobal->GetTraceRecorder(), "cache-load");
+
+	m_pageContentHash = ComputeContentHash(currentPageSize);
+	m_pageVerifyHash = XXH64(m_inputData, currentPageSize, PageCache::kVerifyHashSeed);
+	m_pageSettingsHash = m_cglobal->PageCacheSettingsHash(m_pageLevel, m_pageUseDeflate, m_pageNumSearchCandidates);
+
+	if (!m_cglobal->GetPageCache()->Load(m_pageContentHash, m_pageVerifyHash, m_pageSettingsHash, currentPageSize, m_pageCacheData))
+	{
+		m_isPageCacheMiss = true;
+		return false;
+	}
+
+	// An empty entry means the page was stored, which an empty transcode output also produces
+	m_transcodeOutput.m_size = 0;
+
+	if (!m_pageCacheData.empty())
+		CBWriteBitstream(&m_transcodeOutput, &m_pageCacheData[0], m_pageCacheData.size());
+
+	m_pageStats.m_transcodedSize = m_transcodeOutput.m_size;
+
+	m_isPageCacheHit = true;
+	return true;
+}
+
+void CompressionTask::StoreInPageCache(size_t currentPageSize)
+{
+	TraceScope traceScope(m_cglobal->GetTraceRecorder(), "cache-store");
+
+	size_t compressedSize = m_transcodeOutput.m_size;
+	if (compressedSize >= currentPageSize)
+		compressedSize = 0;
+
+	m_cglobal->GetPageCache()->Store(m_pageContentHash, m_pageVerifyHash, m_pageSettingsHash, currentPageSize, m_transcodeOutput.m_data, compressedSize);
+}
+
+const std::vector<uint64_t> &CompressionTask::SearchWins() const
+{
+	return m_searchWins;
+}
+
+uint64_t CompressionTask::NumSearchBudgetStops() const
+{
+	return m_numSearchBudgetStops;
+}
+
+uint64_t CompressionTask::NumBasePages() const
+{
+	return m_numBasePages;
+}
+
+bool CompressionTask::IsEstimatedIncompressible(size_t currentPageSize)
+{
+	unsigned int counts[256];
+	unsigned int maxSymbolValue = 255;
+
+	size_t largestCount = HIST_count(counts, &maxSymbolValue, m_inputData, currentPageSize);
+	if (HIST_isError(largestCount))
+		return false;
+
+	// Order-0 entropy doesn't account for matches, so a page that only compresses through repeats can be
+	// misjudged.  The margin trades those pages off against the time saved on media that is already
+	// compressed.
+	double pageSize = static_cast<double>(currentPageSize);
+	double entropyBits = 0.0;
+
+	for (unsigned int i = 0; i <= maxSymbolValue; i++)
+	{
+		if (counts[i] != 0)
+			entropyBits += static_cast<double>(counts[i]) * log2(pageSize / static_cast<double>(counts[i]));
+	}
+
+	double estimatedSize = entropyBits / 8.0;
+	double requiredSize = pageSize * static_cast<double>(100 - m_cglobal->IncompressibleMargin()) / 100.0;
+
+	return estimatedSize >= requiredSize;
+}
+
+void *CompressionTask::CBRealloc(void *userdata, void *ptr, size_t newSize)
+{
+	if (newSize == 0 && ptr == nullptr)
+		return nullptr;
+
+	return realloc(ptr, newSize);
+}
+
+zstdhl_ResultCode_t CompressionTask::CBWriteBitstream(void *userdata, const void *data, size_t size)
+{
+	CompressionOutputBuffer *outBuf = static_cast<CompressionOutputBuffer *>(userdata);
+
+	size_t oldCapacity = outBuf->m_capacity;
+	while (outBuf->m_capacity < outBuf->m_size + size)
+		outBuf->m_capacity = std::max<size_t>(1024, outBuf->m_capacity * 2);
+
+	if (oldCapacity != outBuf->m_capacity)
+	{
+		unsigned char *newData = new unsigned char[outBuf->m_capacity];
+		memcpy(newData, outBuf->m_data, outBuf->m_size);
+		delete[] outBuf->m_data;
+
+		outBuf->m_data = newData;
+	}
+
+	memcpy(outBuf->m_data + outBuf->m_size, data, size);
+	outBuf->m_size += size;
+
+	return ZSTDHL_RESULT_OK;
+}
+
+size_t CompressionTask::CBReadBytes(void *userdata, void *dest, size_t size)
+{
+	CompressionInputBuffer *inBuf = static_cast<CompressionInputBuffer *>(userdata);
+
+	size_t available = inBuf->m_size - inBuf->m_readPos;
+	if (size > available)
+		size = available;
+
+	memcpy(dest, inBuf->m_data + inBuf->m_readPos, size);
+	inBuf->m_readPos += size;
+
+	return size;
+}
+
+void RunSerializedTaskThreads(SerializedTaskGlobalState &globalState, unsigned int numThreads)
+{
+	if (numThreads == 1)
+	{
+		globalState.RunThread(0);
+	}
+	else
+	{
+		std::thread **threads = new std::thread*[numThreads];
+		for (unsigned int i = 0; i < numThreads; i++)
+		{
+			threads[i] = new std::thread([&globalState, i]
+				{
+					globalState.RunThread(i);
+				});
+		}
+
+		for (unsigned int i = 0; i < numThreads; i++)
+		{
+			threads[i]->join();
+			delete threads[i];
+		}
+
+		delete[] threads;
+
+	}
+}
+
+// Parses a comma-separated list of search candidates, see PrintUsageAndQuit for the syntax
+bool ParseSearchCandidates(const char *str, std::vector<SearchCandidate> &outCandidates)
+{
+	outCandidates.clear();
+
+	while (*str)
+	{
+		const char *nameStart = str;
+
+		SearchCandidate candidate;
+		candidate.m_strategy = 0;
+		candidate.m_windowLog = 0;
+		candidate.m_useBlockSplitter = false;
+
+		if (*str == 'z')
+			candidate.m_type = kSearchCandidateZStd;
+		else if (*str == 'd')
+			candidate.m_type = kSearchCandidateDeflate;
+		else
+			return false;
+
+		str++;
+
+		int numChars = 0;
+		if (sscanf(str, "%u%n", &candidate.m_level, &numChars) != 1)
+			return false;
+
+		str += numChars;
+
+		if (candidate.m_type == kSearchCandidateDeflate)
+		{
+			if (candidate.m_level > 12)
+				return false;
+		}
+		else
+		{
+			while (*str != ',' && *str != 0)
+			{
+				char param = *str++;
+
+				if (param == 'b')
+				{
+					candidate.m_useBlockSplitter = true;
+					continue;
+				}
+
+				unsigned int value = 0;
+				numChars = 0;
+				if (sscanf(str, "%u%n", &value, &numChars) != 1)
+					return false;
+
+				str += numChars;
+
+				if (param == 's' && value >= 1 && value <= 9)
+					candidate.m_strategy = value;
+				else if (param == 'w' && value >= 10 && value <= 30)
+					candidate.m_windowLog = value;
+				else
+					return false;
+			}
+		}
+
+		candidate.m_name.assign(nameStart, str);
+		outCandidates.push_back(candidate);
+
+		if (*str == ',')
+			str++;
+		else if (*str != 0)
+			return false;
+	}
+
+	return !outCandidates.empty();
+}
+
+bool WriteArchiveHeader(FILE *f, uint32_t archiveHeader)
+{
+	uint8_t headerBytes[4];
+	headerBytes[0] = static_cast<uint8_t>((archiveHeader >> 0) & 0xffu);
+	headerBytes[1] = static_cast<uint8_t>((archiveHeader >> 8) & 0xffu);
+	headerBytes[2] = static_cast<uint8_t>((archiveHeader >> 16) & 0xffu);
+	headerBytes[3] = static_cast<uint8_t>((archiveHeader >> 24) & 0xffu);
+
+	return fwrite(headerBytes, 1, 4, f) == 4;
+}
+
+// Update mode is compression with a base archive, so both modes are handled here
+int CompressMain(int optc, const char **optv, const char *inFileName, const char *outFileName, bool isUpdate)
+{
+	unsigned int maxThreads = std::thread::hardware_concurrency();
+	unsigned int numThreads = maxThreads;
+	unsigned int isolateBlock = 0;
+	unsigned int pageSize = 64 * 1024;
+	unsigned int compressionLevel = static_cast<unsigned int>(ZSTD_defaultCLevel());
+	const char *failBlockPath = "";
+	const char *dictPath = "";
+	const char *statsPath = "";
+	const char *tracePath = "";
+	bool isolateMode = 0;
+	uint32_t tweaks = 0;
+	bool useZStd = true;
+	bool useDeflate = true;
+	unsigned int numLanes = 32;
+	uint32_t laneCode = 0;
+	PageChecksumType checksumType = kPageChecksumCRC32;
+	bool deduplicate = false;
+	bool skipIncompressible = false;
+	unsigned int incompressibleMargin = 0;
+	std::vector<SearchCandidate> searchCandidates;
+	unsigned int searchBudgetMicroseconds = 0;
+	double targetRate = 0.0;
+	double deadlineSeconds = 0.0;
+	const char *cachePath = "";
+	const char *basePath = "";
+	bool hasPageSizeOption = false;
+	bool hasLanesOption = false;
+	bool hasChecksumOption = false;
+
+	for (int i = 0; i < optc; i++)
+	{
+		const char *optName = optv[i];
+		if (!strcmp(optName, "-pagesize"))
+		{
+			i++;
+			if (i == optc || !sscanf(optv[i], "%u", &pageSize) || pageSize < 1024 || pageSize > kArchiveLegacyMaxPageSizeHeader)
+			{
+				fprintf(stderr, "Invalid page size parameter for -pagesize");
+				return -1;
+			}
+
+			hasPageSizeOption = true;
+		}
+		else if (!strcmp(optName, "-lanes"))
+		{
+			i++;
+			if (i == optc || !sscanf(optv[i], "%u", &numLanes) || !LaneCountToArchiveCode(numLanes, laneCode))
+			{
+				fprintf(stderr, "Invalid lane count for -lanes, must be 8, 16, 32, or 64");
+				return -1;
+			}
+
+			hasLanesOption = true;
+		}
+		else if (!strcmp(optName, "-checksum"))
+		{
+			hasChecksumOption = true;
+
+			i++;
+			if (i == optc)
+			{
+				fprintf(stderr, "Expected checksum type for -checksum");
+				return -1;
+			}
+
+			if (!strcmp(optv[i], "crc32"))
+				checksumType = kPageChecksumCRC32;
+			else if (!strcmp(optv[i], "xxh64"))
+				checksumType = kPageChecksumXXH64;
+			else
+			{
+				fprintf(stderr, "Invalid checksum type for -checksum, must be crc32 or xxh64");
+				return -1;
+			}
+		}
+		else if (!strcmp(optName, "-t"))
+		{
+			i++;
+			if (i == optc || !sscanf(optv[i], "%u", &numThreads) || numThreads == 0)
+			{
+				fprintf(stderr, "Invalid thread count for -t");
+				return -1;
+			}
+		}
+		else if (!strcmp(optName, "-f"))
+		{
+			i++;
+			if (i == optc)
+			{
+				fprintf(stderr, "Expected path for -f");
+				return -1;
+			}
+
+			failBlockPath = optv[i];
+		}
+		else if (!strcmp(optName, "-dict"))
+		{
+			i++;
+			if (i == optc)
+			{
+				fprintf(stderr, "Expected path for -dict");
+				return -1;
+			}
+
+			dictPath = optv[i];
+		}
+		else if (!strcmp(optName, "-stats"))
+		{
+			i++;
+			if (i == optc)
+			{
+				fprintf(stderr, "Expected path for -stats");
+				return -1;
+			}
+
+			statsPath = optv[i];
+		}
+		else if (!strcmp(optName, "-trace"))
+		{
+			i++;
+			if (i == optc)
+			{
+				fprintf(stderr, "Expected path for -trace");
+				return -1;
+			}
+
+			tracePath = optv[i];
+		}
+		else if (!strcmp(optName, "-level"))
+		{
+			i++;
+			if (i == optc || !sscanf(optv[i], "%u", &compressionLevel))
+			{
+				fprintf(stderr, "Invalid level for -level");
+				return -1;
+			}
+		}
+		else if (!strcmp(optName, "-isolate"))
+		{
+			isolateMode = true;
+			i++;
+			if (i == optc || !sscanf(optv[i], "%u", &isolateBlock))
+			{
+				fprintf(stderr, "Invalid block value for -isolate");
+				return -1;
+			}
+		}
+		else if (!strcmp(optName, "-nofseshuffle"))
+		{
+			tweaks |= GSTD_TWEAK_NO_FSE_TABLE_SHUFFLE;
+		}
+		else if (!strcmp(optName, "-dedup"))
+		{
+			deduplicate = true;
+		}
+		else if (!strcmp(optName, "-skipincompressible"))
+		{
+			i++;
+			if (i == optc || !sscanf(optv[i], "%u", &incompressibleMargin) || incompressibleMargin > 100)
+			{
+				fprintf(stderr, "Invalid margin for -skipincompressible, must be a percentage");
+				return -1;
+			}
+
+			skipIncompressible = true;
+		}
+		else if (!strcmp(optName, "-search"))
+		{
+			i++;
+			if (i == optc || !ParseSearchCandidates(optv[i], searchCandidates))
+			{
+				fprintf(stderr, "Invalid candidate list for -search");
+				return -1;
+			}
+		}
+		else if (!strcmp(optName, "-searchbudget"))
+		{
+			i++;
+			if (i == optc || !sscanf(optv[i], "%u", &searchBudgetMicroseconds))
+			{
+				fprintf(stderr, "Invalid time budget for -searchbudget");
+				return -1;
+			}
+		}
+		else if (!strcmp(optName, "-base"))
+		{
+			if (!isUpdate)
+			{
+				fprintf(stderr, "-base is only valid in update mode");
+				return -1;
+			}
 
- 	if (m_cglobal->IsUsingZStd())
-	{
-		unsigned int clevel = std::min(m_cglobal->CompressionLevel(), static_cast<unsigned int>(ZSTD_maxCLevel()));
+			i++;
+			if (i == optc)
+			{
+				fprintf(stderr, "Expected path for -base");
+				return -1;
+			}
 
-		ZSTD_CCtx_setPledgedSrcSize(m_ctx, currentPageSize);
-		ZSTD_CCtx_setParameter(m_ctx, ZSTD_c_compressionLevel, static_cast<int>(clevel));
-		//ZSTD_CCtx_setParameter(m_ctx, ZSTD_c_useBlockSplitter, static_cast<int>(ZSTD_ps_enable));
+			basePath = optv[i];
+		}
+		else if (!strcmp(optName, "-cache"))
+		{
+			i++;
+			if (i == optc)
+			{
+				fprintf(stderr, "Expected path for -cache");
+				return -1;
+			}
 
-		if (m_cglobal->ZStdDict())
+			cachePath = optv[i];
+		}
+		else if (!strcmp(optName, "-targetrate"))
 		{
-			m_compressedSize = ZSTD_compress_usingCDict(m_ctx, m_compressedData, m_maxCompressedSize, m_inputData, currentPageSize, m_cglobal->ZStdDict());
-			useDict = true;
+			i++;
+			if (i == optc || !sscanf(optv[i], "%lf", &targetRate) || !(targetRate > 0.0))
+			{
+				fprintf(stderr, "Invalid throughput for -targetrate");
+				return -1;
+			}
+		}
+		else if (!strcmp(optName, "-deadline"))
+		{
+			i++;
+			if (i == optc || !sscanf(optv[i], "%lf", &deadlineSeconds) || !(deadlineSeconds > 0.0))
+			{
+				fprintf(stderr, "Invalid time for -deadline");
+				return -1;
+			}
 		}
 		else
-			m_compressedSize = ZSTD_compress2(m_ctx, m_compressedData, m_maxCompressedSize, m_inputData, currentPageSize);
-
-		ZSTD_CCtx_reset(m_ctx, ZSTD_reset_session_and_parameters);
+		{
+			fprintf(stderr, "Invalid option %s", optName);
+			return -1;
+		}
 	}
-	else
-		m_compressedSize = 0;
 
-	m_transcodeInput.m_readPos = 0;
-	m_dictInput.m_readPos = 0;
+	if (numThreads > maxThreads)
+		numThreads = maxThreads;
+	else if (numThreads < 1)
+		numThreads = 1;
 
-	m_transcodeInput.m_size = m_compressedSize;
-	m_transcodeInput.m_data = m_compressedData;
+	if (targetRate > 0.0 && deadlineSeconds > 0.0)
+	{
+		fprintf(stderr, "-targetrate and -deadline can't be used together");
+		return -1;
+	}
 
-	m_dictInput.m_data = static_cast<const uint8_t *>(m_cglobal->ZStdDictData());
-	m_dictInput.m_size = m_cglobal->ZStdDictSize();
+	if (isUpdate && !basePath[0])
+	{
+		fprintf(stderr, "Update mode requires -base");
+		return -1;
+	}
 
-	if (m_cglobal->IsUsingDeflate())
+	ArchiveIndex baseIndex;
+	MappedFile baseMap;
+
+	if (basePath[0])
 	{
-		m_deflatedSize = libdeflate_deflate_compress(m_libdeflateCompressor, m_inputData, currentPageSize, m_deflatedData, m_maxDeflatedData);
+		if (!strcmp(basePath, outFileName))
+		{
+			fprintf(stderr, "The base archive can't be overwritten by the output");
+			return -1;
+		}
+
+		FILE *baseF = fopen(basePath, "rb");
+		if (!baseF)
+		{
+			fprintf(stderr, "Couldn't open base archive %s", basePath);
+			return -1;
+		}
+
+		bool indexed = BuildArchiveIndex(baseF, baseIndex);
+		fclose(baseF);
 
-		zstdhl_DeflateConv_State_t *deflateConvState = nullptr;
-		zstdhl_EncBlockDesc_t convEncBlock;
-		zstdhl_FrameHeaderDesc_t frameHeaderDesc;
+		if (!indexed)
+		{
+			fprintf(stderr, "Base archive is malformed");
+			return -1;
+		}
 
-		m_deflateConvOutput.m_size = 0;
+		const ArchiveHeader &baseHeader = baseIndex.m_header;
 
-		m_deflateConvStreamSource.m_readBytesFunc = CBReadBytes;
-		m_deflateConvStreamSource.m_userdata = &m_deflateConvInput;
+		if (!hasPageSizeOption)
+			pageSize = baseHeader.m_pageSize;
 
-		m_deflateConvInput.m_size = m_deflatedSize;
-		m_deflateConvInput.m_readPos = 0;
-		m_deflateConvInput.m_data = m_deflatedData;
+		if (!hasLanesOption)
+		{
+			numLanes = baseHeader.m_numLanes;
+			LaneCountToArchiveCode(numLanes, laneCode);
+		}
 
-		zstdhl_DeflateConv_CreateState(&m_memAlloc, &m_deflateConvStreamSource, &deflateConvState);
+		if (!hasChecksumOption)
+			checksumType = baseHeader.m_checksumType;
 
-		zstdhl_ResultCode_t convResult = ZSTDHL_RESULT_OK;
-		uint8_t eofFlag = 0;
+		if (pageSize != baseHeader.m_pageSize || numLanes != baseHeader.m_numLanes || checksumType != baseHeader.m_checksumType)
+		{
+			fprintf(stderr, "The page size, lane count, and checksum type must match the base archive");
+			return -1;
+		}
 
-		frameHeaderDesc.m_dictionaryID = 0;
-		frameHeaderDesc.m_frameContentSize = 0;
-		frameHeaderDesc.m_windowSize = 32768;
-		frameHeaderDesc.m_haveContentChecksum = 0;
-		frameHeaderDesc.m_haveDictionaryID = 0;
-		frameHeaderDesc.m_haveFrameContentSize = 0;
-		frameHeaderDesc.m_haveWindowSize = 1;
-		frameHeaderDesc.m_isSingleSegment = 0;
+		if (!baseMap.OpenRead(basePath))
+		{
+			fprintf(stderr, "Couldn't map base archive %s", basePath);
+			return -1;
+		}
+	}
 
-		zstdhl_AssemblerPersistentState_t persistentState;
+	std::vector<uint8_t> dictData;
 
-		zstdhl_InitAssemblerState(&persistentState);
+	ZSTD_CDict *dict = nullptr;
 
-		convResult = zstdhl_AssembleFrame(&frameHeaderDesc, &m_deflateConvOutputObj, 0);
+	if (dictPath[0])
+	{
+		FILE *dictF = fopen(dictPath, "rb");
 
-		while (convResult == ZSTDHL_RESULT_OK && !eofFlag)
+		if (fseek(dictF, 0, SEEK_END))
 		{
-			size_t deflateReadStart = m_deflateConvInput.m_readPos;
-			size_t zstdWriteStart = m_deflateConvOutput.m_size;
+			fprintf(stderr, "Dict seek failed");
+			return -1;
+		}
 
-			convResult = zstdhl_DeflateConv_Convert(deflateConvState, &eofFlag, &convEncBlock);
+		long dictSizeL = ftell(dictF);
 
-			if (eofFlag)
-				break;
+		if (static_cast<unsigned long>(dictSizeL) > std::numeric_limits<size_t>::max())
+		{
+			fprintf(stderr, "Dict too big");
+			return -1;
+		}
 
-			if (convResult == ZSTDHL_RESULT_OK)
-			{
-				convResult = zstdhl_AssembleBlock(&persistentState, &convEncBlock, &m_deflateConvOutputObj, &m_memAlloc);
-			}
+		if (fseek(dictF, 0, SEEK_SET))
+		{
+			fprintf(stderr, "Dict seek to start failed");
+			return -1;
 		}
 
-		zstdhl_DeflateConv_DestroyState(deflateConvState);
+		size_t dictSize = dictSizeL;
 
-		if (m_deflatedSize > 0 && convResult == ZSTDHL_RESULT_OK)
+		dictData.resize(dictSize);
+		if (fread(&dictData[0], 1, dictSize, dictF) != dictSize)
 		{
-			unsigned char *convertedData = m_deflateConvOutput.m_data;
-			size_t convertedSize = m_deflateConvOutput.m_size;
+			fprintf(stderr, "Dict read failed");
+			return -1;
+		}
 
-			if (m_transcodeInput.m_size == 0 || m_deflateConvOutput.m_size < m_transcodeInput.m_size)
-			{
-				m_transcodeInput.m_size = m_deflateConvOutput.m_size;
-				m_transcodeInput.m_data = m_deflateConvOutput.m_data;
-				useDict = false;
-			}
+		fclose(dictF);
+
+		unsigned int realCompressionLevel = std::min<unsigned int>(compressionLevel, ZSTD_maxCLevel());
+
+		dict = ZSTD_createCDict_byReference(&dictData[0], dictSize, static_cast<int>(realCompressionLevel));
+		if (!dict)
+		{
+			fprintf(stderr, "Dict load failed");
+			return -1;
 		}
 	}
 
-	m_transcodeOutput.m_size = 0;
+	FILE *inF = fopen(inFileName, "rb");
+	if (!inF)
+	{
+		fprintf(stderr, "Couldn't open input file %s", inFileName);
+		return -1;
+	}
 
-	zstdhl_ResultCode_t transcodeResult = gstd_Encoder_Transcode(m_encState, &m_transcodeStreamSource, useDict ? (&m_dictStreamSource) : nullptr, &m_memAlloc);
+	if (fseek(inF, 0, SEEK_END))
+	{
+		fprintf(stderr, "Failed to seek to end of input file");
+		return -1;
+	}
 
-	if (transcodeResult != ZSTDHL_RESULT_OK)
+	long fileSizeL = ftell(inF);
+	if (fileSizeL < 0 || fileSizeL > std::numeric_limits<size_t>::max())
 	{
-		const char* failBlockBase = m_cglobal->FailBlockPath();
+		fprintf(stderr, "Integer overflow");
+		return -1;
+	}
 
-		if (failBlockBase[0] != 0)
+	if (fseek(inF, 0, SEEK_SET))
+	{
+		fprintf(stderr, "Failed to seek to start of input file");
+		return -1;
+	}
+
+	size_t fileSize = static_cast<size_t>(fileSizeL);
+	size_t numPages = fileSize / pageSize;
+	if (fileSize % pageSize)
+		numPages++;
+
+	if (pageSize > kArchivePageSizeMask && (numLanes != kArchiveLaneCounts[0] || checksumType != kPageChecksumCRC32))
+	{
+		fprintf(stderr, "16MB pages use the legacy archive header, which requires 32 lanes and CRC-32 checksums");
+		return -1;
+	}
+
+	FILE *outF = fopen(outFileName, "wb");
+	if (!outF)
+	{
+		fprintf(stderr, "Couldn't open output file %s", outFileName);
+		return -1;
+	}
+
+	// An isolated block can't reference pages that aren't written
+	if (isolateMode)
+		deduplicate = false;
+
+	uint32_t archiveHeader = pageSize | (laneCode << kArchiveLaneCodeOffset);
+	if (checksumType == kPageChecksumXXH64)
+		archiveHeader |= kArchiveChecksumXXH64Flag;
+
+	// 16MB pages don't fit in the page size bits, so they're written with the legacy header, which has no
+	// flags
+	bool isLegacyPageSize = (pageSize > kArchivePageSizeMask);
+	if (isLegacyPageSize)
+		archiveHeader = kArchiveLegacyMaxPageSizeHeader;
+
+	// The records flag is only set afterward if a record was written, so archives without any stay readable
+	// by decoders that don't support records
+	if (!WriteArchiveHeader(outF, archiveHeader))
+	{
+		fprintf(stderr, "Failed to write page size");
+		return -1;
+	}
+
+	SerializedTaskGlobalState globalState(numPages, numThreads);
+
+	CompressionGlobal cglobal(inF, outF, numPages, pageSize, fileSize, compressionLevel, tweaks, failBlockPath, isolateMode, isolateBlock, useZStd, useDeflate, dict, dict ? (&dictData[0]) : nullptr, dictData.size());
+
+	cglobal.SetNumLanes(numLanes);
+	cglobal.SetChecksumType(checksumType);
+	cglobal.SetDeduplicate(deduplicate);
+
+	if (isLegacyPageSize)
+		cglobal.DisableRecords();
+
+	if (skipIncompressible)
+		cglobal.SetIncompressibleMargin(incompressibleMargin);
+
+	cglobal.SetSearch(searchCandidates, static_cast<uint64_t>(searchBudgetMicroseconds) * 1000u);
+
+	LevelController *levelController = nullptr;
+
+	if (targetRate > 0.0 || deadlineSeconds > 0.0)
+	{
+		levelController = new LevelController(cglobal.NumLevelSettings(), cglobal.InitialLevelSetting(), numThreads, fileSize);
+
+		if (deadlineSeconds > 0.0)
+			levelController->SetDeadline(deadlineSeconds);
+		else
+			levelController->SetTargetRate(targetRate * 1024.0 * 1024.0);
+
+		cglobal.SetLevelController(levelController);
+	}
+
+	if (basePath[0])
+		cglobal.SetBaseArchive(&baseIndex, baseMap.Data());
+
+	PageCache *pageCache = nullptr;
+
+	if (cachePath[0])
+	{
+		pageCache = new PageCache();
+
+		if (!pageCache->Open(cachePath))
 		{
-			std::string pathBase(failBlockBase);
-			if (pathBase.back() != '/' && pathBase.back() != '\\')
-				pathBase.append("/");
+			fprintf(stderr, "Couldn't open cache directory %s", cachePath);
+			return -1;
+		}
 
-			fprintf(stderr, "Failed with result code %i in block %zu\n", static_cast<int>(transcodeResult), m_workUnit);
-			m_transcodeOutput.m_size = 0;
+		cglobal.SetPageCache(pageCache);
+	}
 
-			char debugPath[128];
-			sprintf_s(debugPath, "fail_block_%zu.bin", m_workUnit);
+	FILE *statsF = nullptr;
+	PageStatsWriter *statsWriter = nullptr;
 
-			std::string fullPath = pathBase + debugPath;
+	if (statsPath[0])
+	{
+		statsF = fopen(statsPath, "wb");
+		if (!statsF)
+		{
+			fprintf(stderr, "Couldn't open stats file %s", statsPath);
+			return -1;
+		}
+
+		statsWriter = new PageStatsWriter(statsF, statsPath);
+		statsWriter->WriteHeader();
+
+		cglobal.SetStatsWriter(statsWriter);
+	}
+
+	TraceRecorder *traceRecorder = nullptr;
+
+	if (tracePath[0])
+	{
+		traceRecorder = new TraceRecorder();
+
+		cglobal.SetTraceRecorder(traceRecorder);
+		globalState.SetTraceRecorder(traceRecorder);
+	}
+
+	CompressionTask *tasks = new CompressionTask[numThreads];
+
+	for (unsigned int i = 0; i < numThreads; i++)
+	{
+		tasks[i].Init(&cglobal);
+		globalState.SetTaskRunner(i, &tasks[i]);
+	}
+
+	RunSerializedTaskThreads(globalState, numThreads);
+
+	if (cglobal.HasBaseArchive())
+	{
+		uint64_t numBasePages = 0;
+		for (unsigned int i = 0; i < numThreads; i++)
+			numBasePages += tasks[i].NumBasePages();
+
+		fprintf(stderr, "Copied %llu of %llu pages from the base archive\n", static_cast<unsigned long long>(numBasePages), static_cast<unsigned long long>(numPages));
+	}
+
+	if (cglobal.IsSearching())
+	{
+		std::vector<uint64_t> searchWins(searchCandidates.size(), 0);
+		uint64_t numSearchBudgetStops = 0;
+
+		for (unsigned int i = 0; i < numThreads; i++)
+		{
+			for (size_t c = 0; c < searchCandidates.size(); c++)
+				searchWins[c] += tasks[i].SearchWins()[c];
+
+			numSearchBudgetStops += tasks[i].NumSearchBudgetStops();
+		}
+
+		for (size_t c = 0; c < searchCandidates.size(); c++)
+			fprintf(stderr, "Search candidate %s won %llu pages\n", searchCandidates[c].m_name.c_str(), static_cast<unsigned long long>(searchWins[c]));
+
+		if (numSearchBudgetStops > 0)
+			fprintf(stderr, "Search ran out of time on %llu pages\n", static_cast<unsigned long long>(numSearchBudgetStops));
+	}
+
+	delete[] tasks;
+
+	if (levelController)
+	{
+		for (unsigned int setting = 0; setting < levelController->NumSettings(); setting++)
+		{
+			uint64_t numPages = levelController->NumPagesAtSetting(setting);
+			if (numPages == 0)
+				continue;
+
+			unsigned int level = 0;
+			bool useDeflate = false;
+			size_t numSearchCandidates = 0;
+			cglobal.GetLevelSetting(setting, level, useDeflate, numSearchCandidates);
+
+			if (cglobal.IsSearching())
+				fprintf(stderr, "%llu pages searched the first %zu candidates\n", static_cast<unsigned long long>(numPages), numSearchCandidates);
+			else
+				fprintf(stderr, "%llu pages compressed at level %u%s\n", static_cast<unsigned long long>(numPages), level, useDeflate ? " with libdeflate" : "");
+		}
 
-			if (FILE* debugFile = fopen(fullPath.c_str(), "wb"))
-			{
-				fwrite(m_inputData, 1, currentPageSize, debugFile);
-				fclose(debugFile);
-			}
+		delete levelController;
+	}
 
-			sprintf_s(debugPath, "fail_block_%zu.zstd", m_workUnit);
+	if (pageCache)
+	{
+		fprintf(stderr, "Page cache: %llu hits, %llu misses\n", static_cast<unsigned long long>(pageCache->NumHits()), static_cast<unsigned long long>(pageCache->NumMisses()));
 
-			fullPath = pathBase + debugPath;
+		delete pageCache;
+	}
 
-			if (FILE* debugFile = fopen(fullPath.c_str(), "wb"))
-			{
-				fwrite(m_compressedData, 1, m_compressedSize, debugFile);
-				fclose(debugFile);
-			}
+	if (cglobal.HasWrittenRecords())
+	{
+		if (!SeekFile64(outF, 0) || !WriteArchiveHeader(outF, archiveHeader | kArchiveRecordsFlag))
+		{
+			fprintf(stderr, "Failed to update archive header");
+			return -1;
 		}
 	}
-}
 
-void CompressionTask::FinishWritingWorkUnit()
-{
-	if (m_cglobal->IsIsolateBlock() && m_cglobal->IsolateBlock() != m_workUnit)
-		return;
+	if (statsWriter)
+	{
+		statsWriter->WriteFooter();
+		delete statsWriter;
 
-	size_t currentPageSize = ComputeCurrentPageSize();
-	const unsigned char *compressedData = m_transcodeOutput.m_data;
-	size_t compressedSize = m_transcodeOutput.m_size;
+		fclose(statsF);
+	}
 
-	if (compressedSize >= currentPageSize)
+	if (traceRecorder)
 	{
-		compressedSize = currentPageSize;
-		compressedData = m_inputData;
+		FILE *traceF = fopen(tracePath, "wb");
+		if (!traceF)
+			fprintf(stderr, "Couldn't open trace file %s", tracePath);
+		else
+		{
+			traceRecorder->WriteJSON(traceF);
+			fclose(traceF);
+		}
+
+		delete traceRecorder;
 	}
 
-	uint32_t crc = crc32(0, m_inputData, currentPageSize);
+	fclose(inF);
+	fclose(outF);
+
+	if (dict)
+		ZSTD_freeCDict(dict);
 
-	m_cglobal->WriteToOutput(compressedData, crc, compressedSize, currentPageSize);
+	return 0;
 }
 
-size_t CompressionTask::ComputeCurrentPageSize() const
+bool ParseUIntList(const char *str, std::vector<unsigned int> &outValues)
 {
-	if (m_workUnit + 1u == m_cglobal->NumPages())
+	outValues.clear();
+
+	while (*str)
 	{
-		size_t lastPageSize = m_cglobal->GlobalSize() % m_cglobal->PageSize();
-		if (lastPageSize != 0)
-			return lastPageSize;
+		unsigned int value = 0;
+		int numChars = 0;
+		if (sscanf(str, "%u%n", &value, &numChars) != 1)
+			return false;
+
+		outValues.push_back(value);
+		str += numChars;
+
+		if (*str == ',')
+			str++;
+		else if (*str != 0)
+			return false;
 	}
 
-	return m_cglobal->PageSize();
+	return !outValues.empty();
 }
 
-
-void *CompressionTask::CBRealloc(void *userdata, void *ptr, size_t newSize)
+void ReportBenchResult(FILE *reportF, unsigned int level, unsigned int numLanes, unsigned int numThreads, const char *stage, uint64_t inputBytes, uint64_t outputBytes, uint64_t nanoseconds)
 {
-	if (newSize == 0 && ptr == nullptr)
-		return nullptr;
+	double mbPerSecond = 0.0;
+	if (nanoseconds > 0)
+		mbPerSecond = (static_cast<double>(inputBytes) / (1024.0 * 1024.0)) / (static_cast<double>(nanoseconds) / 1000000000.0);
 
-	return realloc(ptr, newSize);
+	double ratio = 0.0;
+	if (outputBytes > 0)
+		ratio = static_cast<double>(inputBytes) / static_cast<double>(outputBytes);
+
+	if (outputBytes > 0)
+		fprintf(stderr, "    %-16s %10.2f MB/s   ratio %.3f\n", stage, mbPerSecond, ratio);
+	else
+		fprintf(stderr, "    %-16s %10.2f MB/s\n", stage, mbPerSecond);
+
+	fprintf(reportF, "%u,%u,%u,%s,%llu,%llu,%llu,%.3f,%.4f\n", level, numLanes, numThreads, stage, static_cast<unsigned long long>(inputBytes), static_cast<unsigned long long>(outputBytes), static_cast<unsigned long long>(nanoseconds), mbPerSecond, ratio);
 }
 
-zstdhl_ResultCode_t CompressionTask::CBWriteBitstream(void *userdata, const void *data, size_t size)
+// Decoders run on one thread, so their rows report one thread
+int BenchDecompression(FILE *reportF, unsigned int level, unsigned int numLanes, unsigned int numPasses, const std::vector<uint8_t> &fileData, size_t pageSize, const std::vector<CompressedPageRecord> &pages)
 {
-	CompressionOutputBuffer *outBuf = static_cast<CompressionOutputBuffer *>(userdata);
+	size_t numPages = pages.size();
 
-	size_t oldCapacity = outBuf->m_capacity;
-	while (outBuf->m_capacity < outBuf->m_size + size)
-		outBuf->m_capacity = std::max<size_t>(1024, outBuf->m_capacity * 2);
+	// Set up copies of each page for every decoder outside of the timed loops
+	std::vector<std::vector<uint8_t> > gstdPages(numPages);
+	std::vector<std::vector<uint8_t> > zstdPages(numPages);
+	std::vector<std::vector<uint8_t> > deflatePages(numPages);
 
-	if (oldCapacity != outBuf->m_capacity)
-	{
-		unsigned char *newData = new unsigned char[outBuf->m_capacity];
-		memcpy(newData, outBuf->m_data, outBuf->m_size);
-		delete[] outBuf->m_data;
+	uint64_t gstdBytes = 0;
+	uint64_t zstdBytes = 0;
+	uint64_t deflateBytes = 0;
 
-		outBuf->m_data = newData;
+	ZSTD_CCtx *zstdCCtx = ZSTD_createCCtx();
+	ZSTD_DCtx *zstdDCtx = ZSTD_createDCtx();
+	libdeflate_compressor *deflateCompressor = libdeflate_alloc_compressor(12);
+	libdeflate_decompressor *deflateDecompressor = libdeflate_alloc_decompressor();
+
+	int clevel = static_cast<int>(std::min(level, static_cast<unsigned int>(ZSTD_maxCLevel())));
+
+	for (size_t i = 0; i < numPages; i++)
+	{
+		const CompressedPageRecord &page = pages[i];
+		const uint8_t *uncompressedData = &fileData[i * pageSize];
+
+		gstdPages[i].resize(page.m_data.size() + GSTD_DECOMPRESS_INPUT_PADDING);
+		memcpy(&gstdPages[i][0], &page.m_data[0], page.m_data.size());
+		gstdBytes += page.m_data.size();
+
+		zstdPages[i].resize(ZSTD_compressBound(page.m_uncompressedSize));
+		size_t zstdSize = ZSTD_compressCCtx(zstdCCtx, &zstdPages[i][0], zstdPages[i].size(), uncompressedData, page.m_uncompressedSize, clevel);
+		zstdPages[i].resize(ZSTD_isError(zstdSize) ? 0 : zstdSize);
+		zstdBytes += zstdPages[i].size();
+
+		deflatePages[i].resize(libdeflate_deflate_compress_bound(deflateCompressor, page.m_uncompressedSize));
+		size_t deflateSize = libdeflate_deflate_compress(deflateCompressor, uncompressedData, page.m_uncompressedSize, &deflatePages[i][0], deflatePages[i].size());
+		deflatePages[i].resize(deflateSize);
+		deflateBytes += deflateSize;
 	}
 
-	memcpy(outBuf->m_data + outBuf->m_size, data, size);
-	outBuf->m_size += size;
+	std::vector<uint8_t> decompressedPage(pageSize + 3);
 
-	return ZSTDHL_RESULT_OK;
-}
+	uint64_t totalBytes = static_cast<uint64_t>(fileData.size()) * numPasses;
+	int numErrors = 0;
 
-size_t CompressionTask::CBReadBytes(void *userdata, void *dest, size_t size)
-{
-	CompressionInputBuffer *inBuf = static_cast<CompressionInputBuffer *>(userdata);
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+	for (unsigned int pass = 0; pass < numPasses; pass++)
+	{
+		for (size_t i = 0; i < numPages; i++)
+		{
+			const CompressedPageRecord &page = pages[i];
 
-	size_t available = inBuf->m_size - inBuf->m_readPos;
-	if (size > available)
-		size = available;
+			if (page.m_data.size() == page.m_uncompressedSize)
+				memcpy(&decompressedPage[0], &gstdPages[i][0], page.m_uncompressedSize);
+			else
+			{
+				memset(&decompressedPage[0], 0, (page.m_uncompressedSize + 3u) & ~static_cast<uint32_t>(3u));
+				DecompressGstdCPULanes(&gstdPages[i][0], static_cast<uint32_t>(page.m_data.size()), &decompressedPage[0], page.m_uncompressedSize, numLanes, GSTD_DECOMPRESS_FLAG_PADDED_BUFFERS, nullptr, nullptr, nullptr, nullptr, nullptr);
+			}
 
-	memcpy(dest, inBuf->m_data + inBuf->m_readPos, size);
-	inBuf->m_readPos += size;
+			if (pass == 0 && crc32(0, &decompressedPage[0], page.m_uncompressedSize) != page.m_checksum)
+				numErrors++;
+		}
+	}
+	ReportBenchResult(reportF, level, numLanes, 1u, "decompress_gstd", totalBytes, gstdBytes, NanosecondsSince(startTime));
 
-	return size;
+	startTime = std::chrono::steady_clock::now();
+	for (unsigned int pass = 0; pass < numPasses; pass++)
+	{
+		for (size_t i = 0; i < numPages; i++)
+		{
+			size_t result = ZSTD_decompressDCtx(zstdDCtx, &decompressedPage[0], pageSize, zstdPages[i].empty() ? nullptr : &zstdPages[i][0], zstdPages[i].size());
+			if (pass == 0 && ZSTD_isError(result))
+				numErrors++;
+		}
+	}
+	ReportBenchResult(reportF, level, numLanes, 1u, "decompress_zstd", totalBytes, zstdBytes, NanosecondsSince(startTime));
+
+	startTime = std::chrono::steady_clock::now();
+	for (unsigned int pass = 0; pass < numPasses; pass++)
+	{
+		for (size_t i = 0; i < numPages; i++)
+		{
+			size_t actualSize = 0;
+			libdeflate_result result = libdeflate_deflate_decompress(deflateDecompressor, deflatePages[i].empty() ? nullptr : &deflatePages[i][0], deflatePages[i].size(), &decompressedPage[0], pageSize, &actualSize);
+			if (pass == 0 && result != LIBDEFLATE_SUCCESS)
+				numErrors++;
+		}
+	}
+	ReportBenchResult(reportF, level, numLanes, 1u, "decompress_deflate", totalBytes, deflateBytes, NanosecondsSince(startTime));
+
+	ZSTD_freeCCtx(zstdCCtx);
+	ZSTD_freeDCtx(zstdDCtx);
+	libdeflate_free_compressor(deflateCompressor);
+	libdeflate_free_decompressor(deflateDecompressor);
+
+	return numErrors;
 }
 
-int CompressMain(int optc, const char **optv, const char *inFileName, const char *outFileName)
+int BenchMain(int optc, const char **optv, const char *inFileName, const char *outFileName)
 {
 	unsigned int maxThreads = std::thread::hardware_concurrency();
-	unsigned int numThreads = maxThreads;
-	unsigned int isolateBlock = 0;
 	unsigned int pageSize = 64 * 1024;
-	unsigned int compressionLevel = static_cast<unsigned int>(ZSTD_defaultCLevel());
-	const char *failBlockPath = "";
-	const char *dictPath = "";
-	bool isolateMode = 0;
+	unsigned int numPasses = 1;
 	uint32_t tweaks = 0;
-	bool useZStd = true;
-	bool useDeflate = true;
+
+	std::vector<unsigned int> levels;
+	std::vector<unsigned int> laneCounts;
+	std::vector<unsigned int> threadCounts;
+
+	levels.push_back(static_cast<unsigned int>(ZSTD_defaultCLevel()));
+	laneCounts.push_back(32);
+	threadCounts.push_back(maxThreads);
 
 	for (int i = 0; i < optc; i++)
 	{
@@ -1271,59 +4871,55 @@ int CompressMain(int optc, const char **optv, const char *inFileName, const char
 		if (!strcmp(optName, "-pagesize"))
 		{
 			i++;
-			if (i == optc || !sscanf(optv[i], "%u", &pageSize) || pageSize < 1024)
+			if (i == optc || !sscanf(optv[i], "%u", &pageSize) || pageSize < 1024 || pageSize > kArchivePageSizeMask)
 			{
 				fprintf(stderr, "Invalid page size parameter for -pagesize");
 				return -1;
 			}
 		}
-		else if (!strcmp(optName, "-t"))
+		else if (!strcmp(optName, "-levels"))
 		{
 			i++;
-			if (i == optc || !sscanf(optv[i], "%u", &numThreads) || numThreads == 0)
+			if (i == optc || !ParseUIntList(optv[i], levels))
 			{
-				fprintf(stderr, "Invalid thread count for -t");
+				fprintf(stderr, "Invalid level list for -levels");
 				return -1;
 			}
 		}
-		else if (!strcmp(optName, "-f"))
+		else if (!strcmp(optName, "-lanes"))
 		{
 			i++;
-			if (i == optc)
+			if (i == optc || !ParseUIntList(optv[i], laneCounts))
 			{
-				fprintf(stderr, "Expected path for -f");
+				fprintf(stderr, "Invalid lane count list for -lanes");
 				return -1;
 			}
 
-			failBlockPath = optv[i];
-		}
-		else if (!strcmp(optName, "-dict"))
-		{
-			i++;
-			if (i == optc)
+			for (unsigned int numLanes : laneCounts)
 			{
-				fprintf(stderr, "Expected path for -dict");
-				return -1;
+				uint32_t laneCode = 0;
+				if (!LaneCountToArchiveCode(numLanes, laneCode))
+				{
+					fprintf(stderr, "Invalid lane count %u for -lanes, must be 8, 16, 32, or 64", numLanes);
+					return -1;
+				}
 			}
-
-			dictPath = optv[i];
 		}
-		else if (!strcmp(optName, "-level"))
+		else if (!strcmp(optName, "-threads"))
 		{
 			i++;
-			if (i == optc || !sscanf(optv[i], "%u", &compressionLevel))
+			if (i == optc || !ParseUIntList(optv[i], threadCounts))
 			{
-				fprintf(stderr, "Invalid level for -level");
+				fprintf(stderr, "Invalid thread count list for -threads");
 				return -1;
 			}
 		}
-		else if (!strcmp(optName, "-isolate"))
+		else if (!strcmp(optName, "-passes"))
 		{
-			isolateMode = true;
 			i++;
-			if (i == optc || !sscanf(optv[i], "%u", &isolateBlock))
+			if (i == optc || !sscanf(optv[i], "%u", &numPasses) || numPasses == 0)
 			{
-				fprintf(stderr, "Invalid block value for -isolate");
+				fprintf(stderr, "Invalid pass count for -passes");
 				return -1;
 			}
 		}
@@ -1338,60 +4934,6 @@ int CompressMain(int optc, const char **optv, const char *inFileName, const char
 		}
 	}
 
-	if (numThreads > maxThreads)
-		numThreads = maxThreads;
-	else if (numThreads < 1)
-		numThreads = 1;
-
-	std::vector<uint8_t> dictData;
-
-	ZSTD_CDict *dict = nullptr;
-
-	if (dictPath[0])
-	{
-		FILE *dictF = fopen(dictPath, "rb");
-
-		if (fseek(dictF, 0, SEEK_END))
-		{
-			fprintf(stderr, "Dict seek failed");
-			return -1;
-		}
-
-		long dictSizeL = ftell(dictF);
-
-		if (static_cast<unsigned long>(dictSizeL) > std::numeric_limits<size_t>::max())
-		{
-			fprintf(stderr, "Dict too big");
-			return -1;
-		}
-
-		if (fseek(dictF, 0, SEEK_SET))
-		{
-			fprintf(stderr, "Dict seek to start failed");
-			return -1;
-		}
-
-		size_t dictSize = dictSizeL;
-
-		dictData.resize(dictSize);
-		if (fread(&dictData[0], 1, dictSize, dictF) != dictSize)
-		{
-			fprintf(stderr, "Dict read failed");
-			return -1;
-		}
-
-		fclose(dictF);
-
-		unsigned int realCompressionLevel = std::min<unsigned int>(compressionLevel, ZSTD_maxCLevel());
-
-		dict = ZSTD_createCDict_byReference(&dictData[0], dictSize, static_cast<int>(realCompressionLevel));
-		if (!dict)
-		{
-			fprintf(stderr, "Dict load failed");
-			return -1;
-		}
-	}
-
 	FILE *inF = fopen(inFileName, "rb");
 	if (!inF)
 	{
@@ -1406,9 +4948,9 @@ int CompressMain(int optc, const char **optv, const char *inFileName, const char
 	}
 
 	long fileSizeL = ftell(inF);
-	if (fileSizeL < 0 || fileSizeL > std::numeric_limits<size_t>::max())
+	if (fileSizeL <= 0 || static_cast<unsigned long>(fileSizeL) > std::numeric_limits<size_t>::max())
 	{
-		fprintf(stderr, "Integer overflow");
+		fprintf(stderr, "Input file is empty or too large");
 		return -1;
 	}
 
@@ -1418,74 +4960,93 @@ int CompressMain(int optc, const char **optv, const char *inFileName, const char
 		return -1;
 	}
 
-	size_t fileSize = static_cast<size_t>(fileSizeL);
-	size_t numPages = fileSize / pageSize;
-	if (fileSize % pageSize)
-		numPages++;
-
-	FILE *outF = fopen(outFileName, "wb");
-	if (!outF)
+	std::vector<uint8_t> fileData(static_cast<size_t>(fileSizeL));
+	if (fread(&fileData[0], 1, fileData.size(), inF) != fileData.size())
 	{
-		fprintf(stderr, "Couldn't open output file %s", outFileName);
+		fprintf(stderr, "Failed to read input file");
 		return -1;
 	}
 
-	uint8_t pageSizeBytes[4];
-	pageSizeBytes[0] = static_cast<uint8_t>((pageSize >> 0) & 0xffu);
-	pageSizeBytes[1] = static_cast<uint8_t>((pageSize >> 8) & 0xffu);
-	pageSizeBytes[2] = static_cast<uint8_t>((pageSize >> 16) & 0xffu);
-	pageSizeBytes[3] = static_cast<uint8_t>((pageSize >> 24) & 0xffu);
+	fclose(inF);
 
-	if (fwrite(pageSizeBytes, 1, 4, outF) != 4)
+	FILE *reportF = fopen(outFileName, "wb");
+	if (!reportF)
 	{
-		fprintf(stderr, "Failed to write page size");
+		fprintf(stderr, "Couldn't open output file %s", outFileName);
 		return -1;
 	}
 
-	SerializedTaskGlobalState globalState(numPages, numThreads);
-
-	CompressionGlobal cglobal(inF, outF, numPages, pageSize, fileSize, compressionLevel, tweaks, failBlockPath, isolateMode, isolateBlock, useZStd, useDeflate, dict, dict ? (&dictData[0]) : nullptr, dictData.size());
+	fprintf(reportF, "level,lanes,threads,stage,input_bytes,output_bytes,nanoseconds,mb_per_s,ratio\n");
 
-	CompressionTask *tasks = new CompressionTask[numThreads];
+	size_t fileSize = fileData.size();
+	size_t numPages = fileSize / pageSize;
+	if (fileSize % pageSize)
+		numPages++;
 
-	for (unsigned int i = 0; i < numThreads; i++)
-	{
-		tasks[i].Init(&cglobal);
-		globalState.SetTaskRunner(i, &tasks[i]);
-	}
+	int numErrors = 0;
 
-	if (numThreads == 1)
+	for (unsigned int level : levels)
 	{
-		globalState.RunThread(0);
-	}
-	else
-	{
-		std::thread **threads = new std::thread*[numThreads];
-		for (unsigned int i = 0; i < numThreads; i++)
+		for (unsigned int numLanes : laneCounts)
 		{
-			threads[i] = new std::thread([&globalState, i]
+			for (unsigned int numThreads : threadCounts)
+			{
+				numThreads = std::max(1u, std::min(numThreads, maxThreads));
+
+				fprintf(stderr, "Level %u, %u lanes, %u threads:\n", level, numLanes, numThreads);
+
+				std::vector<CompressedPageRecord> pages;
+				pages.reserve(numPages);
+
+				SerializedTaskGlobalState globalState(numPages, numThreads);
+				CompressionGlobal cglobal(nullptr, nullptr, numPages, pageSize, fileSize, level, tweaks, "", false, 0, true, true, nullptr, nullptr, 0);
+
+				cglobal.SetNumLanes(numLanes);
+				cglobal.SetInputMemory(&fileData[0]);
+				cglobal.SetPageCollector(&pages);
+
+				CompressionTask *tasks = new CompressionTask[numThreads];
+
+				for (unsigned int i = 0; i < numThreads; i++)
 				{
-					globalState.RunThread(i);
-				});
-		}
+					tasks[i].Init(&cglobal);
+					globalState.SetTaskRunner(i, &tasks[i]);
+				}
 
-		for (unsigned int i = 0; i < numThreads; i++)
-		{
-			threads[i]->join();
-			delete threads[i];
-		}
+				std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+				RunSerializedTaskThreads(globalState, numThreads);
+				uint64_t pipelineNanoseconds = NanosecondsSince(startTime);
 
-		delete[] threads;
+				CompressionStageStats stats;
+				for (unsigned int i = 0; i < numThreads; i++)
+					stats.Add(tasks[i].StageStats());
 
-	}
+				delete[] tasks;
 
-	delete[] tasks;
+				uint64_t archiveSize = 4;
+				for (const CompressedPageRecord &page : pages)
+					archiveSize += 12 + page.m_data.size();
 
-	fclose(inF);
-	fclose(outF);
+				// Stage rates are per thread, the pipeline rate is wall clock across all threads
+				static const char *stageNames[kCompressionStageCount] = { "zstd", "deflate", "deflateconv", "transcode", "crc", "estimate" };
 
-	if (dict)
-		ZSTD_freeCDict(dict);
+				for (int stage = 0; stage < kCompressionStageCount; stage++)
+					ReportBenchResult(reportF, level, numLanes, numThreads, stageNames[stage], stats.m_inputBytes[stage], stats.m_outputBytes[stage], stats.m_nanoseconds[stage]);
+
+				ReportBenchResult(reportF, level, numLanes, numThreads, "pipeline", fileSize, archiveSize, pipelineNanoseconds);
+
+				numErrors += BenchDecompression(reportF, level, numLanes, numPasses, fileData, pageSize, pages);
+			}
+		}
+	}
+
+	fclose(reportF);
+
+	if (numErrors > 0)
+	{
+		fprintf(stderr, "%i pages failed to decompress\n", numErrors);
+		return -1;
+	}
 
 	return 0;
 }
@@ -1584,6 +5145,10 @@ int ExportPredefinedTablesMain(int optc, const char **optv, const char *inFileNa
 
 int main(int argc, const char **argv)
 {
+	// Verify mode has no output file
+	if (argc >= 3 && !strcmp(argv[1], "v"))
+		return VerifyMain(argc - 3, argv + 2, argv[argc - 1]);
+
 	if (argc < 4)
 	{
 		PrintUsageAndQuit();
@@ -1597,9 +5162,15 @@ int main(int argc, const char **argv)
 	const char **firstOption = argv + 2;
 
 	if (!strcmp(argv[1], "c"))
-		return CompressMain(numOptionArgs, firstOption, inFileName, outFileName);
+		return CompressMain(numOptionArgs, firstOption, inFileName, outFileName, false);
+	if (!strcmp(argv[1], "u"))
+		return CompressMain(numOptionArgs, firstOption, inFileName, outFileName, true);
+	if (!strcmp(argv[1], "r"))
+		return ReadStressMain(numOptionArgs, firstOption, inFileName, outFileName);
 	if (!strcmp(argv[1], "d"))
 		return DecompressMain(numOptionArgs, firstOption, inFileName, outFileName);
+	if (!strcmp(argv[1], "b"))
+		return BenchMain(numOptionArgs, firstOption, inFileName, outFileName);
 	if (!strcmp(argv[1], "p"))
 		return ExportPredefinedTablesMain(numOptionArgs, firstOption, inFileName, outFileName);
 	if (!strcmp(argv[1], "t"))
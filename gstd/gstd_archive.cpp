@@ -0,0 +1,495 @@
+/*
+Copyright (c) 2024 Eric Lasota
+
+This software is available under the terms of the MIT license
+or the Apache License, Version 2.0.  For more information, see
+the included LICENSE.txt file.
+*/
+
+#include "gstd_archive.h"
+#include "gstd_crc32.h"
+#include "gstd_fileio.h"
+
+#include "common/xxhash.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+namespace
+{
+	struct RangeDecodeState
+	{
+		const ArchiveIndex *m_index;
+		const uint8_t *m_archiveData;
+		uint64_t m_offset;
+		uint64_t m_size;
+		uint8_t *m_outData;
+
+		size_t m_firstPage;
+		size_t m_endPage;
+
+		std::atomic<size_t> m_nextPage;
+		std::atomic<int> m_numFailed;
+	};
+
+	bool PageOutputOffsetLess(uint64_t offset, const ArchivePageEntry &page)
+	{
+		return offset < page.m_outputOffset;
+	}
+
+	void RunRangeDecodeWorker(RangeDecodeState *state)
+	{
+		const ArchiveIndex &index = *state->m_index;
+
+		std::vector<uint8_t> stagingBuffer;
+		std::vector<uint8_t> scratchPage;
+		int numFailed = 0;
+
+		for (;;)
+		{
+			size_t pageIndex = state->m_firstPage + state->m_nextPage.fetch_add(1, std::memory_order_relaxed);
+			if (pageIndex >= state->m_endPage)
+				break;
+
+			const ArchivePageEntry &page = index.m_pages[pageIndex];
+			const uint8_t *storedData = state->m_archiveData + page.m_storedOffset;
+
+			// Clip the page to the requested range
+			uint64_t pageStart = std::max(state->m_offset, page.m_outputOffset);
+			uint64_t pageEnd = std::min(state->m_offset + state->m_size, page.m_outputOffset + page.m_uncompressedSize);
+			size_t sliceOffset = static_cast<size_t>(pageStart - page.m_outputOffset);
+			size_t sliceSize = static_cast<size_t>(pageEnd - pageStart);
+			uint8_t *sliceOutData = state->m_outData + (pageStart - state->m_offset);
+
+			bool isCovered = (sliceSize == page.m_uncompressedSize);
+			uint64_t actualChecksum = 0;
+			bool checksumOK = false;
+
+			if (page.m_storedSize == page.m_uncompressedSize)
+			{
+				// Stored pages are checked in place in the archive and only the slice is copied
+				actualChecksum = ComputePageChecksum(index.m_header.m_checksumType, storedData, page.m_uncompressedSize);
+				checksumOK = (actualChecksum == page.m_checksum);
+				memcpy(sliceOutData, storedData + sliceOffset, sliceSize);
+			}
+			else if (isCovered && (page.m_uncompressedSize & 3u) == 0 && (reinterpret_cast<uintptr_t>(sliceOutData) & 3u) == 0)
+			{
+				// Fully covered pages that fit the decoder's alignment requirements are decoded in place
+				memset(sliceOutData, 0, page.m_uncompressedSize);
+				checksumOK = DecodeArchivePage(index.m_header, page, storedData, stagingBuffer, sliceOutData, actualChecksum, nullptr, nullptr);
+			}
+			else
+			{
+				if (scratchPage.size() < index.m_header.m_pageSize + 3u)
+					scratchPage.resize(index.m_header.m_pageSize + 3u);
+
+				memset(&scratchPage[0], 0, (page.m_uncompressedSize + 3u) & ~static_cast<uint32_t>(3u));
+				checksumOK = DecodeArchivePage(index.m_header, page, storedData, stagingBuffer, &scratchPage[0], actualChecksum, nullptr, nullptr);
+
+				memcpy(sliceOutData, &scratchPage[sliceOffset], sliceSize);
+			}
+
+			if (!checksumOK)
+				numFailed++;
+		}
+
+		state->m_numFailed.fetch_add(numFailed, std::memory_order_relaxed);
+	}
+}
+
+size_t PageHeaderSize(PageChecksumType checksumType)
+{
+	return (checksumType == kPageChecksumXXH64) ? 16 : 12;
+}
+
+uint64_t ComputePageChecksum(PageChecksumType checksumType, const void *data, size_t size)
+{
+	if (checksumType == kPageChecksumXXH64)
+		return XXH64(data, size, 0);
+
+	return crc32(0, data, size);
+}
+
+uint64_t ComputePageChecksumParallel(PageChecksumType checksumType, const void *data, size_t size, unsigned int numThreads)
+{
+	// Below this size per chunk, starting a thread costs more than it saves
+	const size_t kMinChunkSize = 1024 * 1024;
+
+	size_t numChunks = size / kMinChunkSize;
+	if (numChunks > numThreads)
+		numChunks = numThreads;
+
+	if (checksumType != kPageChecksumCRC32 || numChunks < 2)
+		return ComputePageChecksum(checksumType, data, size);
+
+	const uint8_t *bytes = static_cast<const uint8_t *>(data);
+	size_t chunkSize = size / numChunks;
+
+	// The last chunk also takes the remainder
+	std::vector<uint32_t> chunkCRCs(numChunks);
+	std::vector<std::thread> helperThreads;
+	helperThreads.reserve(numChunks - 1u);
+
+	for (size_t i = 1; i < numChunks; i++)
+	{
+		size_t chunkEnd = (i == numChunks - 1u) ? size : (i + 1u) * chunkSize;
+		helperThreads.emplace_back([&chunkCRCs, bytes, chunkSize, chunkEnd, i]
+			{
+				chunkCRCs[i] = crc32(0, bytes + i * chunkSize, chunkEnd - i * chunkSize);
+			});
+	}
+
+	uint32_t crc = crc32(0, bytes, chunkSize);
+
+	for (std::thread &thread : helperThreads)
+		thread.join();
+
+	for (size_t i = 1; i < numChunks; i++)
+	{
+		size_t chunkEnd = (i == numChunks - 1u) ? size : (i + 1u) * chunkSize;
+		crc = crc32_combine(crc, chunkCRCs[i], chunkEnd - i * chunkSize);
+	}
+
+	return crc;
+}
+
+bool LaneCountToArchiveCode(unsigned int numLanes, uint32_t &outCode)
+{
+	for (uint32_t code = 0; code < 4; code++)
+	{
+		if (kArchiveLaneCounts[code] == numLanes)
+		{
+			outCode = code;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+uint32_t ReadLE32(const uint8_t *bytes)
+{
+	return bytes[0] | (static_cast<uint32_t>(bytes[1]) << 8) | (static_cast<uint32_t>(bytes[2]) << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+}
+
+bool ReadArchiveHeader(FILE *f, ArchiveHeader &outHeader)
+{
+	uint8_t sizeBytes[4];
+	size_t bytesRead = fread(sizeBytes, 1, 4, f);
+
+	if (bytesRead != 4)
+	{
+		fprintf(stderr, "Failed to read page size");
+		return false;
+	}
+
+	uint32_t archiveHeader = ReadLE32(sizeBytes);
+
+	if (archiveHeader & kArchiveReservedMask)
+	{
+		fprintf(stderr, "Archive uses unsupported features or an unsupported legacy page size larger than 16MB");
+		return false;
+	}
+
+	outHeader.m_pageSize = archiveHeader & kArchivePageSizeMask;
+	outHeader.m_numLanes = kArchiveLaneCounts[(archiveHeader >> kArchiveLaneCodeOffset) & kArchiveLaneCodeMask];
+	outHeader.m_checksumType = (archiveHeader & kArchiveChecksumXXH64Flag) ? kPageChecksumXXH64 : kPageChecksumCRC32;
+	outHeader.m_hasRecords = ((archiveHeader & kArchiveRecordsFlag) != 0);
+
+	if (archiveHeader == kArchiveLegacyMaxPageSizeHeader)
+	{
+		outHeader.m_pageSize = kArchiveLegacyMaxPageSizeHeader;
+		outHeader.m_numLanes = kArchiveLaneCounts[0];
+	}
+
+	if (outHeader.m_pageSize == 0)
+	{
+		fprintf(stderr, "Invalid page size or an unsupported legacy page size larger than 16MB");
+		return false;
+	}
+
+	return true;
+}
+
+int ReadArchivePageHeader(FILE *f, const ArchiveHeader &archiveHeader, ArchivePageHeader &outHeader)
+{
+	uint8_t headerBytes[16];
+	size_t bytesRead = fread(headerBytes, 1, 4, f);
+
+	if (bytesRead == 0)
+		return 0;
+
+	if (bytesRead != 4)
+	{
+		fprintf(stderr, "Failed to read block size");
+		return -1;
+	}
+
+	uint32_t blockSize = ReadLE32(headerBytes);
+
+	if (blockSize > archiveHeader.m_pageSize || (blockSize == 0 && !archiveHeader.m_hasRecords))
+	{
+		fprintf(stderr, "Malformed block size");
+		return -1;
+	}
+
+	bytesRead = fread(headerBytes + 4, 1, 4, f);
+
+	if (bytesRead != 4)
+	{
+		fprintf(stderr, "Failed to read uncompressed size");
+		return -1;
+	}
+
+	uint32_t uncompressedSize = ReadLE32(headerBytes + 4);
+
+	if (uncompressedSize < blockSize || uncompressedSize > archiveHeader.m_pageSize)
+	{
+		fprintf(stderr, "Malformed uncompressed size");
+		return -1;
+	}
+
+	size_t checksumSize = PageHeaderSize(archiveHeader.m_checksumType) - 8;
+
+	bytesRead = fread(headerBytes + 8, 1, checksumSize, f);
+
+	if (bytesRead != checksumSize)
+	{
+		fprintf(stderr, "Failed to read checksum");
+		return -1;
+	}
+
+	uint64_t checksum = 0;
+	for (size_t i = 0; i < checksumSize; i++)
+		checksum |= static_cast<uint64_t>(headerBytes[8 + i]) << (i * 8);
+
+	outHeader.m_storedSize = blockSize;
+	outHeader.m_uncompressedSize = uncompressedSize;
+	outHeader.m_checksum = checksum;
+	outHeader.m_recordType = kArchiveRecordNone;
+	outHeader.m_recordPayload = 0;
+
+	if (blockSize == 0)
+	{
+		uint8_t recordBytes[kArchiveRecordSize];
+
+		if (fread(recordBytes, 1, kArchiveRecordSize, f) != kArchiveRecordSize)
+		{
+			fprintf(stderr, "Failed to read page record");
+			return -1;
+		}
+
+		uint32_t recordType = ReadLE32(recordBytes);
+
+		uint32_t recordPayload = ReadLE32(recordBytes + 4);
+
+		bool isValidRecord = false;
+		if (recordType == kArchiveRecordPageReference)
+			isValidRecord = true;
+		else if (recordType == kArchiveRecordConstant)
+			isValidRecord = (recordPayload < 256);
+
+		if (!isValidRecord || uncompressedSize == 0)
+		{
+			fprintf(stderr, "Malformed page record");
+			return -1;
+		}
+
+		outHeader.m_recordType = static_cast<ArchiveRecordType>(recordType);
+		outHeader.m_recordPayload = recordPayload;
+	}
+
+	return 1;
+}
+
+bool IsValidPageReference(const ArchiveHeader &archiveHeader, const ArchivePageHeader &pageHeader, size_t pageIndex, const std::vector<ArchiveRecordType> &earlierRecordTypes)
+{
+	if (pageHeader.m_recordPayload >= pageIndex || pageIndex > earlierRecordTypes.size())
+	{
+		fprintf(stderr, "Block %llu references a later block", static_cast<unsigned long long>(pageIndex));
+		return false;
+	}
+
+	if (earlierRecordTypes[pageHeader.m_recordPayload] != kArchiveRecordNone)
+	{
+		fprintf(stderr, "Block %llu references block %u, which is a record", static_cast<unsigned long long>(pageIndex), static_cast<unsigned int>(pageHeader.m_recordPayload));
+		return false;
+	}
+
+	if (pageHeader.m_uncompressedSize != archiveHeader.m_pageSize)
+	{
+		fprintf(stderr, "Block %llu is a page reference but isn't a full page", static_cast<unsigned long long>(pageIndex));
+		return false;
+	}
+
+	return true;
+}
+
+bool BuildArchiveIndex(FILE *f, ArchiveIndex &outIndex)
+{
+	outIndex.m_pages.clear();
+	outIndex.m_uncompressedSize = 0;
+
+	if (!SeekFile64(f, 0))
+	{
+		fprintf(stderr, "Failed to seek to the start of the archive");
+		return false;
+	}
+
+	if (!ReadArchiveHeader(f, outIndex.m_header))
+		return false;
+
+	uint64_t storedOffset = 4;
+	uint64_t archiveSize = 0;
+
+	if (!GetFileSize64(f, archiveSize))
+	{
+		fprintf(stderr, "Failed to get the archive size");
+		return false;
+	}
+
+	std::vector<ArchiveRecordType> recordTypes;
+
+	for (;;)
+	{
+		ArchivePageHeader pageHeader;
+		int pageHeaderResult = ReadArchivePageHeader(f, outIndex.m_header, pageHeader);
+
+		if (pageHeaderResult == 0)
+			break;
+
+		if (pageHeaderResult < 0)
+			return false;
+
+		storedOffset += PageHeaderSize(outIndex.m_header.m_checksumType);
+
+		if (archiveSize - storedOffset < pageHeader.m_storedSize)
+		{
+			fprintf(stderr, "Block %u is truncated", static_cast<unsigned int>(outIndex.m_pages.size()));
+			return false;
+		}
+
+		ArchivePageEntry page;
+		page.m_storedOffset = storedOffset;
+		page.m_outputOffset = outIndex.m_uncompressedSize;
+		page.m_storedSize = pageHeader.m_storedSize;
+		page.m_uncompressedSize = pageHeader.m_uncompressedSize;
+		page.m_checksum = pageHeader.m_checksum;
+		page.m_recordType = pageHeader.m_recordType;
+		page.m_recordPayload = pageHeader.m_recordPayload;
+
+		if (page.m_recordType == kArchiveRecordPageReference)
+		{
+			// References must also have the same contents as the page they point at
+			if (!IsValidPageReference(outIndex.m_header, pageHeader, outIndex.m_pages.size(), recordTypes))
+				return false;
+
+			const ArchivePageEntry &referencedPage = outIndex.m_pages[page.m_recordPayload];
+
+			if (referencedPage.m_checksum != page.m_checksum)
+			{
+				fprintf(stderr, "Block %u has a mismatched reference", static_cast<unsigned int>(outIndex.m_pages.size()));
+				return false;
+			}
+
+			page.m_storedOffset = referencedPage.m_storedOffset;
+			page.m_storedSize = referencedPage.m_storedSize;
+		}
+
+		outIndex.m_pages.push_back(page);
+		recordTypes.push_back(page.m_recordType);
+
+		storedOffset += (pageHeader.m_storedSize == 0) ? kArchiveRecordSize : pageHeader.m_storedSize;
+		outIndex.m_uncompressedSize += pageHeader.m_uncompressedSize;
+
+		if (!SeekFile64(f, storedOffset))
+		{
+			fprintf(stderr, "Failed to seek past block %u", static_cast<unsigned int>(outIndex.m_pages.size() - 1u));
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool DecodeArchivePage(const ArchiveHeader &archiveHeader, const ArchivePageEntry &page, const void *storedData, std::vector<uint8_t> &stagingBuffer, void *outData, uint64_t &outActualChecksum, void *warnContext, gstd_WarnCallback_t warnCallback)
+{
+	if (page.m_recordType == kArchiveRecordConstant)
+		memset(outData, static_cast<int>(page.m_recordPayload), page.m_uncompressedSize);
+	else if (page.m_storedSize == page.m_uncompressedSize)
+		memcpy(outData, storedData, page.m_uncompressedSize);
+	else
+	{
+		// Zero padding past the end of the page lets the decoder skip per-lane input bounds checks
+		if (stagingBuffer.size() < page.m_storedSize + GSTD_DECOMPRESS_INPUT_PADDING)
+			stagingBuffer.resize(page.m_storedSize + GSTD_DECOMPRESS_INPUT_PADDING);
+
+		memcpy(&stagingBuffer[0], storedData, page.m_storedSize);
+		memset(&stagingBuffer[page.m_storedSize], 0, GSTD_DECOMPRESS_INPUT_PADDING);
+
+		uint32_t paddedOutSize = (page.m_uncompressedSize + 3u) & ~static_cast<uint32_t>(3u);
+
+		DecompressGstdCPULanes(&stagingBuffer[0], page.m_storedSize, outData, paddedOutSize, archiveHeader.m_numLanes, GSTD_DECOMPRESS_FLAG_PADDED_BUFFERS, nullptr, warnContext, warnCallback, nullptr, nullptr);
+	}
+
+	outActualChecksum = ComputePageChecksum(archiveHeader.m_checksumType, outData, page.m_uncompressedSize);
+
+	return outActualChecksum == page.m_checksum;
+}
+
+size_t FindArchivePage(const ArchiveIndex &index, uint64_t offset)
+{
+	if (offset >= index.m_uncompressedSize)
+		return index.m_pages.size();
+
+	std::vector<ArchivePageEntry>::const_iterator it = std::upper_bound(index.m_pages.begin(), index.m_pages.end(), offset, PageOutputOffsetLess);
+
+	return static_cast<size_t>(it - index.m_pages.begin()) - 1u;
+}
+
+int DecompressArchiveRange(const ArchiveIndex &index, const uint8_t *archiveData, uint64_t offset, uint64_t size, void *outData, unsigned int numThreads)
+{
+	if (offset > index.m_uncompressedSize || size > index.m_uncompressedSize - offset)
+		return -1;
+
+	if (size == 0)
+		return 0;
+
+	RangeDecodeState state;
+	state.m_index = &index;
+	state.m_archiveData = archiveData;
+	state.m_offset = offset;
+	state.m_size = size;
+	state.m_outData = static_cast<uint8_t *>(outData);
+	state.m_firstPage = FindArchivePage(index, offset);
+	state.m_endPage = FindArchivePage(index, offset + size - 1u) + 1u;
+	state.m_nextPage = 0;
+	state.m_numFailed = 0;
+
+	size_t numPages = state.m_endPage - state.m_firstPage;
+
+	if (numThreads < 1)
+		numThreads = 1;
+
+	if (numThreads > numPages)
+		numThreads = static_cast<unsigned int>(numPages);
+
+	std::vector<std::thread> helperThreads;
+
+	if (numThreads > 1)
+	{
+		helperThreads.reserve(numThreads - 1u);
+		for (unsigned int i = 1; i < numThreads; i++)
+			helperThreads.emplace_back(RunRangeDecodeWorker, &state);
+	}
+
+	RunRangeDecodeWorker(&state);
+
+	for (std::thread &thread : helperThreads)
+		thread.join();
+
+	return state.m_numFailed.load();
+}
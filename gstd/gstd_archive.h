@@ -0,0 +1,132 @@
+/*
+Copyright (c) 2024 Eric Lasota
+
+This software is available under the terms of the MIT license
+or the Apache License, Version 2.0.  For more information, see
+the included LICENSE.txt file.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+#include "gstddec_cpu.h"
+
+// The archive starts with a header dword.  Bits 0-23 are the page size, bits 24-25 are the lane count
+// code, bit 26 selects XXH64 page checksums instead of CRC-32, bit 27 allows page records, and the
+// remaining bits are reserved and must be zero.
+const uint32_t kArchivePageSizeMask = 0xffffffu;
+const uint32_t kArchiveLaneCodeOffset = 24;
+const uint32_t kArchiveLaneCodeMask = 0x3u;
+const uint32_t kArchiveChecksumXXH64Flag = 0x4000000u;
+const uint32_t kArchiveRecordsFlag = 0x8000000u;
+const uint32_t kArchiveReservedMask = 0xf0000000u;
+
+// Archives from before the header had flags stored the page size alone, so a 16MB page size reads as a
+// page size of zero with lane code 1.  That header is still decoded as 16MB pages with 32 lanes, and is
+// written for 16MB pages.
+const uint32_t kArchiveLegacyMaxPageSizeHeader = 0x1000000u;
+
+// A page with a stored size of zero is followed by a record of two dwords, the record type and a payload,
+// in place of its stored bytes
+const size_t kArchiveRecordSize = 8;
+
+enum ArchiveRecordType
+{
+	kArchiveRecordNone,				// Not a record, the page has stored bytes
+	kArchiveRecordPageReference,	// Same contents as an earlier page, the payload is that page's index
+	kArchiveRecordConstant,			// Every byte of the page is the payload, which is less than 256
+};
+
+const unsigned int kArchiveLaneCounts[4] = { 32, 8, 16, 64 };
+
+enum PageChecksumType
+{
+	kPageChecksumCRC32,
+	kPageChecksumXXH64,
+};
+
+struct ArchiveHeader
+{
+	uint32_t m_pageSize;
+	unsigned int m_numLanes;
+	PageChecksumType m_checksumType;
+	bool m_hasRecords;
+};
+
+struct ArchivePageHeader
+{
+	uint32_t m_storedSize;
+	uint32_t m_uncompressedSize;
+	uint64_t m_checksum;
+	ArchiveRecordType m_recordType;
+	uint32_t m_recordPayload;
+};
+
+// Location of a page in both the archive and the decompressed output.  For a page reference, the stored
+// offset and size are those of the referenced page, so it can be decoded like any other page.
+struct ArchivePageEntry
+{
+	uint64_t m_storedOffset;		// Offset of the page's stored bytes in the archive, after the page header
+	uint64_t m_outputOffset;
+	uint32_t m_storedSize;
+	uint32_t m_uncompressedSize;
+	uint64_t m_checksum;
+	ArchiveRecordType m_recordType;
+	uint32_t m_recordPayload;
+};
+
+struct ArchiveIndex
+{
+	ArchiveHeader m_header;
+	std::vector<ArchivePageEntry> m_pages;
+	uint64_t m_uncompressedSize;
+};
+
+// Page headers are the stored size, the uncompressed size, and the checksum, which is 2 dwords for XXH64
+size_t PageHeaderSize(PageChecksumType checksumType);
+
+uint64_t ComputePageChecksum(PageChecksumType checksumType, const void *data, size_t size);
+
+// Same as ComputePageChecksum, but large CRC-32 pages are split into chunks that are checksummed on up to
+// numThreads threads, including the calling thread, and combined.  XXH64 can't be split this way.
+uint64_t ComputePageChecksumParallel(PageChecksumType checksumType, const void *data, size_t size, unsigned int numThreads);
+
+bool LaneCountToArchiveCode(unsigned int numLanes, uint32_t &outCode);
+
+uint32_t ReadLE32(const uint8_t *bytes);
+
+bool ReadArchiveHeader(FILE *f, ArchiveHeader &outHeader);
+
+// Reads and validates a page header, including the record if the page is one.  Record payloads are not
+// validated.  Returns 1 if a page header was read, 0 at the end of the archive, or -1 if the header is
+// malformed.
+int ReadArchivePageHeader(FILE *f, const ArchiveHeader &archiveHeader, ArchivePageHeader &outHeader);
+
+// Checks a page reference read at pageIndex against the record types of the pages before it.  References
+// must name an earlier page that isn't a record and, since every page but the last is full, must be a full
+// page.  Checksums are left to the caller.  Prints an error and returns false if the reference is invalid.
+bool IsValidPageReference(const ArchiveHeader &archiveHeader, const ArchivePageHeader &pageHeader, size_t pageIndex, const std::vector<ArchiveRecordType> &earlierRecordTypes);
+
+// Scans the page headers of an archive from the start of the file, skipping over the stored bytes
+bool BuildArchiveIndex(FILE *f, ArchiveIndex &outIndex);
+
+// Decodes one page from its stored bytes, which need no alignment or padding.  Compressed pages are
+// staged in stagingBuffer to satisfy the decoder's alignment and padding requirements.  outData must be
+// 4-byte aligned, zero-filled, and hold the uncompressed size rounded up to a multiple of 4.  Returns
+// true if the checksum matches.
+bool DecodeArchivePage(const ArchiveHeader &archiveHeader, const ArchivePageEntry &page, const void *storedData, std::vector<uint8_t> &stagingBuffer, void *outData, uint64_t &outActualChecksum, void *warnContext, gstd_WarnCallback_t warnCallback);
+
+// Decodes the bytes [offset, offset + size) of an archive's decompressed contents into outData.  Only the
+// pages covering the range are decoded, spread over up to numThreads threads including the calling
+// thread.  archiveData is the entire archive, normally mapped with MappedFile.  Returns the number of
+// pages that failed their checksums, or -1 if the range extends past the end of the decompressed data.
+int DecompressArchiveRange(const ArchiveIndex &index, const uint8_t *archiveData, uint64_t offset, uint64_t size, void *outData, unsigned int numThreads);
+
+// Returns the index of the page containing the decompressed byte at offset, or the page count if the
+// offset is past the end
+size_t FindArchivePage(const ArchiveIndex &index, uint64_t offset);
@@ -0,0 +1,335 @@
+/*
+Copyright (c) 2024 Eric Lasota
+
+This software is available under the terms of the MIT license
+or the Apache License, Version 2.0.  For more information, see
+the included LICENSE.txt file.
+*/
+
+#include "gstd_archive_reader.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+namespace
+{
+	size_t PageBufferSize(const ArchivePageEntry &page)
+	{
+		return (page.m_uncompressedSize + 3u) & ~static_cast<size_t>(3u);
+	}
+}
+
+ArchiveReader::ArchiveReader()
+	: m_cacheBytes(0), m_cachedBytes(0), m_readAheadPages(0), m_lruHead(nullptr), m_lruTail(nullptr), m_terminated(false)
+	, m_lastReadEnd(0), m_numCacheHits(0), m_numCacheMisses(0), m_numReadAheadPages(0)
+{
+}
+
+ArchiveReader::~ArchiveReader()
+{
+	Close();
+}
+
+bool ArchiveReader::Open(const char *path, size_t cacheBytes, unsigned int numThreads, unsigned int readAheadPages)
+{
+	Close();
+
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return false;
+
+	bool indexed = BuildArchiveIndex(f, m_index);
+	fclose(f);
+
+	if (!indexed || !m_archiveMap.OpenRead(path))
+		return false;
+
+	m_cacheBytes = cacheBytes;
+	m_cachedBytes = 0;
+	m_readAheadPages = readAheadPages;
+	m_pages.assign(m_index.m_pages.size(), nullptr);
+	m_terminated = false;
+	m_lastReadEnd = 0;
+	m_numCacheHits = 0;
+	m_numCacheMisses = 0;
+	m_numReadAheadPages = 0;
+
+	if (numThreads < 1)
+		numThreads = 1;
+
+	for (unsigned int i = 0; i < numThreads; i++)
+		m_workers.push_back(std::thread(&ArchiveReader::RunWorker, this));
+
+	return true;
+}
+
+void ArchiveReader::Close()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_terminated = true;
+	}
+
+	m_workAvailableEvent.notify_all();
+
+	for (std::thread &thread : m_workers)
+		thread.join();
+
+	m_workers.clear();
+
+	for (CachedPage *page : m_pages)
+		delete page;
+
+	m_pages.clear();
+	m_decodeQueue.clear();
+	m_lruHead = nullptr;
+	m_lruTail = nullptr;
+	m_cachedBytes = 0;
+
+	m_archiveMap.Close();
+}
+
+int64_t ArchiveReader::Read(void *dest, uint64_t offset, size_t size)
+{
+	uint64_t dataSize = m_index.m_uncompressedSize;
+
+	if (offset >= dataSize || size == 0)
+		return 0;
+
+	if (size > dataSize - offset)
+		size = static_cast<size_t>(dataSize - offset);
+
+	size_t firstPage = FindArchivePage(m_index, offset);
+	size_t lastPage = FindArchivePage(m_index, offset + size - 1u);
+
+	std::vector<CachedPage *> pages;
+	pages.reserve(lastPage - firstPage + 1u);
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	// Pin every page up front so that all of the misses are decoded in parallel
+	for (size_t pageIndex = firstPage; pageIndex <= lastPage; pageIndex++)
+	{
+		bool isNew = false;
+		pages.push_back(AcquirePage(pageIndex, isNew));
+
+		if (isNew)
+			m_numCacheMisses++;
+		else
+			m_numCacheHits++;
+	}
+
+	if (offset == m_lastReadEnd)
+	{
+		for (size_t i = 1; i <= m_readAheadPages && lastPage + i < m_pages.size(); i++)
+			QueueReadAhead(lastPage + i);
+	}
+
+	m_lastReadEnd = offset + size;
+
+	bool failed = false;
+	uint8_t *destBytes = static_cast<uint8_t *>(dest);
+
+	for (CachedPage *page : pages)
+	{
+		m_pageDecodedEvent.wait(lock, [page] { return page->m_state != kPageStateDecoding; });
+
+		if (page->m_state == kPageStateFailed)
+			failed = true;
+		else if (!failed)
+		{
+			const ArchivePageEntry &pageEntry = m_index.m_pages[page->m_pageIndex];
+
+			uint64_t sliceStart = std::max(offset, pageEntry.m_outputOffset);
+			uint64_t sliceEnd = std::min(offset + size, pageEntry.m_outputOffset + pageEntry.m_uncompressedSize);
+
+			// Ready pages never change while pinned, so they can be copied without holding the lock
+			lock.unlock();
+			memcpy(destBytes + (sliceStart - offset), &page->m_data[static_cast<size_t>(sliceStart - pageEntry.m_outputOffset)], static_cast<size_t>(sliceEnd - sliceStart));
+			lock.lock();
+		}
+
+		ReleasePage(page);
+	}
+
+	EvictToBudget();
+
+	if (failed)
+		return -1;
+
+	return static_cast<int64_t>(size);
+}
+
+uint64_t ArchiveReader::Size() const
+{
+	return m_index.m_uncompressedSize;
+}
+
+uint64_t ArchiveReader::NumCacheHits() const
+{
+	return m_numCacheHits;
+}
+
+uint64_t ArchiveReader::NumCacheMisses() const
+{
+	return m_numCacheMisses;
+}
+
+uint64_t ArchiveReader::NumReadAheadPages() const
+{
+	return m_numReadAheadPages;
+}
+
+ArchiveReader::CachedPage *ArchiveReader::AcquirePage(size_t pageIndex, bool &outIsNew)
+{
+	CachedPage *page = m_pages[pageIndex];
+
+	if (page)
+	{
+		Unlink(page);
+		LinkMostRecent(page);
+		page->m_pinCount++;
+
+		outIsNew = false;
+		return page;
+	}
+
+	// New pages are pinned once for the caller and once for the decode job
+	page = new CachedPage();
+	page->m_pageIndex = pageIndex;
+	page->m_state = kPageStateDecoding;
+	page->m_pinCount = 2;
+	page->m_lruPrev = nullptr;
+	page->m_lruNext = nullptr;
+
+	m_pages[pageIndex] = page;
+	m_cachedBytes += PageBufferSize(m_index.m_pages[pageIndex]);
+
+	LinkMostRecent(page);
+
+	m_decodeQueue.push_back(page);
+	m_workAvailableEvent.notify_one();
+
+	outIsNew = true;
+	return page;
+}
+
+void ArchiveReader::ReleasePage(CachedPage *page)
+{
+	page->m_pinCount--;
+}
+
+void ArchiveReader::QueueReadAhead(size_t pageIndex)
+{
+	if (m_pages[pageIndex])
+		return;
+
+	bool isNew = false;
+	CachedPage *page = AcquirePage(pageIndex, isNew);
+
+	// Only the decode job holds a read-ahead page, and it goes to the back of the LRU so that it
+	// doesn't push out pages that were actually read
+	ReleasePage(page);
+	Unlink(page);
+
+	page->m_lruPrev = m_lruTail;
+	page->m_lruNext = nullptr;
+
+	if (m_lruTail)
+		m_lruTail->m_lruNext = page;
+	else
+		m_lruHead = page;
+
+	m_lruTail = page;
+
+	m_numReadAheadPages++;
+}
+
+void ArchiveReader::LinkMostRecent(CachedPage *page)
+{
+	page->m_lruPrev = nullptr;
+	page->m_lruNext = m_lruHead;
+
+	if (m_lruHead)
+		m_lruHead->m_lruPrev = page;
+	else
+		m_lruTail = page;
+
+	m_lruHead = page;
+}
+
+void ArchiveReader::Unlink(CachedPage *page)
+{
+	if (page->m_lruPrev)
+		page->m_lruPrev->m_lruNext = page->m_lruNext;
+	else
+		m_lruHead = page->m_lruNext;
+
+	if (page->m_lruNext)
+		page->m_lruNext->m_lruPrev = page->m_lruPrev;
+	else
+		m_lruTail = page->m_lruPrev;
+
+	page->m_lruPrev = nullptr;
+	page->m_lruNext = nullptr;
+}
+
+void ArchiveReader::EvictToBudget()
+{
+	// Pinned pages are skipped, so the cache can run over budget while they are in use
+	CachedPage *page = m_lruTail;
+
+	while (page && m_cachedBytes > m_cacheBytes)
+	{
+		CachedPage *prevPage = page->m_lruPrev;
+
+		if (page->m_pinCount == 0)
+		{
+			Unlink(page);
+
+			m_pages[page->m_pageIndex] = nullptr;
+			m_cachedBytes -= PageBufferSize(m_index.m_pages[page->m_pageIndex]);
+
+			delete page;
+		}
+
+		page = prevPage;
+	}
+}
+
+void ArchiveReader::RunWorker()
+{
+	std::vector<uint8_t> stagingBuffer;
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	for (;;)
+	{
+		m_workAvailableEvent.wait(lock, [this] { return m_terminated || !m_decodeQueue.empty(); });
+
+		if (m_terminated)
+			break;
+
+		CachedPage *page = m_decodeQueue.front();
+		m_decodeQueue.pop_front();
+
+		// Nothing else touches the page data until it leaves the decoding state
+		lock.unlock();
+
+		const ArchivePageEntry &pageEntry = m_index.m_pages[page->m_pageIndex];
+		page->m_data.assign(PageBufferSize(pageEntry), 0);
+
+		uint64_t actualChecksum = 0;
+		bool checksumOK = DecodeArchivePage(m_index.m_header, pageEntry, m_archiveMap.Data() + pageEntry.m_storedOffset, stagingBuffer, &page->m_data[0], actualChecksum, nullptr, nullptr);
+
+		lock.lock();
+
+		page->m_state = checksumOK ? kPageStateReady : kPageStateFailed;
+		ReleasePage(page);
+
+		m_pageDecodedEvent.notify_all();
+
+		EvictToBudget();
+	}
+}
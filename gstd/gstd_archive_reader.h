@@ -0,0 +1,104 @@
+/*
+Copyright (c) 2024 Eric Lasota
+
+This software is available under the terms of the MIT license
+or the Apache License, Version 2.0.  For more information, see
+the included LICENSE.txt file.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "gstd_archive.h"
+#include "gstd_fileio.h"
+
+// Serves pread-style reads of an archive's decompressed contents.  Decoded pages are kept in an LRU
+// cache bounded by a byte budget.  Missing pages are decoded by a pool of background threads.  A page
+// that is already being decoded is waited on rather than decoded again.  When reads are sequential, the
+// pages after each read are decoded ahead of time.
+class ArchiveReader
+{
+public:
+	ArchiveReader();
+	~ArchiveReader();
+
+	bool Open(const char *path, size_t cacheBytes, unsigned int numThreads, unsigned int readAheadPages);
+	void Close();
+
+	// Reads up to size bytes at offset.  Returns the number of bytes read, which is only less than size at
+	// the end of the data, or -1 if a page in the range failed its checksum.  Safe to call from any number
+	// of threads.
+	int64_t Read(void *dest, uint64_t offset, size_t size);
+
+	uint64_t Size() const;
+
+	uint64_t NumCacheHits() const;
+	uint64_t NumCacheMisses() const;
+	uint64_t NumReadAheadPages() const;
+
+private:
+	ArchiveReader(const ArchiveReader &) = delete;
+	ArchiveReader &operator=(const ArchiveReader &) = delete;
+
+	enum PageState
+	{
+		kPageStateDecoding,
+		kPageStateReady,
+		kPageStateFailed,
+	};
+
+	struct CachedPage
+	{
+		size_t m_pageIndex;
+		PageState m_state;
+		unsigned int m_pinCount;		// Readers and decode jobs using the page, pinned pages can't be evicted
+		std::vector<uint8_t> m_data;
+
+		CachedPage *m_lruPrev;
+		CachedPage *m_lruNext;
+	};
+
+	// All of these must be called with m_mutex locked
+	CachedPage *AcquirePage(size_t pageIndex, bool &outIsNew);
+	void ReleasePage(CachedPage *page);
+	void QueueReadAhead(size_t pageIndex);
+	void LinkMostRecent(CachedPage *page);
+	void Unlink(CachedPage *page);
+	void EvictToBudget();
+
+	void RunWorker();
+
+	MappedFile m_archiveMap;
+	ArchiveIndex m_index;
+
+	size_t m_cacheBytes;
+	size_t m_cachedBytes;
+	unsigned int m_readAheadPages;
+
+	std::mutex m_mutex;
+	std::condition_variable m_pageDecodedEvent;
+	std::condition_variable m_workAvailableEvent;
+
+	// Indexed by page index, null if the page isn't cached
+	std::vector<CachedPage *> m_pages;
+	CachedPage *m_lruHead;		// Most recently used
+	CachedPage *m_lruTail;
+
+	std::deque<CachedPage *> m_decodeQueue;
+	std::vector<std::thread> m_workers;
+	bool m_terminated;
+
+	uint64_t m_lastReadEnd;
+
+	uint64_t m_numCacheHits;
+	uint64_t m_numCacheMisses;
+	uint64_t m_numReadAheadPages;
+};
@@ -0,0 +1,168 @@
+/*
+Copyright (c) 2024 Eric Lasota
+
+This software is available under the terms of the MIT license
+or the Apache License, Version 2.0.  For more information, see
+the included LICENSE.txt file.
+*/
+
+#include "gstd_bench_kernels.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+#ifndef GSTD_BENCH_KERNELS_AVX2
+#define GSTD_BENCH_KERNELS_AVX2		0
+#endif
+
+#ifndef GSTD_BENCH_KERNELS_AVX512
+#define GSTD_BENCH_KERNELS_AVX512	0
+#endif
+
+namespace
+{
+#if GSTD_BENCH_KERNELS_AVX2 || GSTD_BENCH_KERNELS_AVX512
+	enum CPUFeature
+	{
+		kCPUFeatureAVX2,
+		kCPUFeatureAVX512,
+	};
+
+	// Checks for the instructions that the corresponding backend is compiled with
+	bool CPUSupports(CPUFeature feature)
+	{
+#if defined(_MSC_VER)
+		int regs[4];
+
+		__cpuid(regs, 0);
+		if (regs[0] < 7)
+			return false;
+
+		__cpuid(regs, 1);
+		bool osUsesXSave = ((regs[2] >> 27) & 1) != 0;
+		if (!osUsesXSave)
+			return false;
+
+		unsigned long long xcr0 = _xgetbv(0);
+
+		__cpuidex(regs, 7, 0);
+		bool hasBMI = ((regs[1] >> 3) & 1) != 0;
+
+		if (feature == kCPUFeatureAVX2)
+			return hasBMI && (xcr0 & 0x6) == 0x6 && ((regs[1] >> 5) & 1) != 0;
+
+		if (feature == kCPUFeatureAVX512)
+			return hasBMI && (xcr0 & 0xe6) == 0xe6 && ((regs[1] >> 16) & 1) != 0 && ((regs[1] >> 28) & 1) != 0 && ((regs[1] >> 31) & 1) != 0;
+
+		return false;
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+		__builtin_cpu_init();
+
+		if (feature == kCPUFeatureAVX2)
+			return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi");
+
+		if (feature == kCPUFeatureAVX512)
+			return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx512cd") && __builtin_cpu_supports("bmi");
+
+		return false;
+#else
+		return false;
+#endif
+	}
+#endif
+
+	void PrintUsageAndQuit()
+	{
+		fprintf(stderr, "gstd_bench_kernels - Gstd decoder kernel microbenchmarks\n");
+		fprintf(stderr, "Usage:\n");
+		fprintf(stderr, "    gstd_bench_kernels <options>\n");
+		fprintf(stderr, "Options:\n");
+		fprintf(stderr, "    -iterations <n>  - Calls per kernel (default is 200000)\n");
+		fprintf(stderr, "    -kernel <name>   - Only runs the named kernel\n");
+		fprintf(stderr, "    -o <file>        - Writes CSV results to a file instead of stdout\n");
+
+		exit(-1);
+	}
+}
+
+int main(int argc, const char **argv)
+{
+	KernelBenchOptions options;
+	options.m_iterations = 200000;
+	options.m_kernelFilter = nullptr;
+
+	const char *outFileName = nullptr;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char *optName = argv[i];
+
+		if (!strcmp(optName, "-iterations"))
+		{
+			i++;
+			if (i == argc || !sscanf(argv[i], "%u", &options.m_iterations) || options.m_iterations == 0)
+			{
+				fprintf(stderr, "Invalid iteration count for -iterations");
+				return -1;
+			}
+		}
+		else if (!strcmp(optName, "-kernel"))
+		{
+			i++;
+			if (i == argc)
+				PrintUsageAndQuit();
+
+			options.m_kernelFilter = argv[i];
+		}
+		else if (!strcmp(optName, "-o"))
+		{
+			i++;
+			if (i == argc)
+				PrintUsageAndQuit();
+
+			outFileName = argv[i];
+		}
+		else
+			PrintUsageAndQuit();
+	}
+
+	FILE *csvF = stdout;
+	if (outFileName)
+	{
+		csvF = fopen(outFileName, "wb");
+		if (!csvF)
+		{
+			fprintf(stderr, "Couldn't open output file %s", outFileName);
+			return -1;
+		}
+	}
+
+	fprintf(csvF, "backend,vector_width,kernel,calls,items,nanoseconds,ns_per_call,mitems_per_s\n");
+
+	BenchKernelsPortable(csvF, options);
+
+#if GSTD_BENCH_KERNELS_AVX2
+	if (CPUSupports(kCPUFeatureAVX2))
+		BenchKernelsAVX2(csvF, options);
+	else
+		fprintf(stderr, "Skipping AVX2 kernels, not supported by this CPU\n");
+#endif
+
+#if GSTD_BENCH_KERNELS_AVX512
+	if (CPUSupports(kCPUFeatureAVX512))
+		BenchKernelsAVX512(csvF, options);
+	else
+		fprintf(stderr, "Skipping AVX-512 kernels, not supported by this CPU\n");
+#endif
+
+	if (csvF != stdout)
+		fclose(csvF);
+
+	return 0;
+}
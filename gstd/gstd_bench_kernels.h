@@ -0,0 +1,24 @@
+/*
+Copyright (c) 2024 Eric Lasota
+
+This software is available under the terms of the MIT license
+or the Apache License, Version 2.0.  For more information, see
+the included LICENSE.txt file.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+struct KernelBenchOptions
+{
+	uint32_t m_iterations;		// Calls per kernel, table builds use 1/100th of this
+	const char *m_kernelFilter;	// If not null, only the kernel with this name is run
+};
+
+// Each of these runs every kernel benchmark at every vector width, with the decoder compiled for one SIMD
+// backend, and writes one CSV row per kernel and width to csvF.
+void BenchKernelsPortable(FILE *csvF, const KernelBenchOptions &options);
+void BenchKernelsAVX2(FILE *csvF, const KernelBenchOptions &options);
+void BenchKernelsAVX512(FILE *csvF, const KernelBenchOptions &options);
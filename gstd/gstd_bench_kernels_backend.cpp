@@ -0,0 +1,484 @@
+/*
+Copyright (c) 2024 Eric Lasota
+
+This software is available under the terms of the MIT license
+or the Apache License, Version 2.0.  For more information, see
+the included LICENSE.txt file.
+*/
+
+// This file is compiled once per SIMD backend.  The decoder's templates are declared in an inline namespace
+// named after the backend, so the instantiations of each backend stay separate instead of being merged by
+// the linker.
+
+#include "gstd_bench_kernels.h"
+#include "gstddec_kernel.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#if GSTDDEC_CPU_SIMD_AVX512
+#define GSTD_BENCH_KERNELS_ENTRY	BenchKernelsAVX512
+#define GSTD_BENCH_KERNELS_BACKEND	"avx512"
+#elif GSTDDEC_CPU_SIMD_AVX2
+#define GSTD_BENCH_KERNELS_ENTRY	BenchKernelsAVX2
+#define GSTD_BENCH_KERNELS_BACKEND	"avx2"
+#else
+#define GSTD_BENCH_KERNELS_ENTRY	BenchKernelsPortable
+#define GSTD_BENCH_KERNELS_BACKEND	"portable"
+#endif
+
+namespace
+{
+	class BenchRandom
+	{
+	public:
+		explicit BenchRandom(uint32_t seed)
+			: m_state(seed)
+		{
+		}
+
+		uint32_t Next()
+		{
+			m_state ^= m_state << 13;
+			m_state ^= m_state >> 17;
+			m_state ^= m_state << 5;
+			return m_state;
+		}
+
+		uint32_t NextInRange(uint32_t minValue, uint32_t maxValueInclusive)
+		{
+			return minValue + Next() % (maxValueInclusive - minValue + 1u);
+		}
+
+	private:
+		uint32_t m_state;
+	};
+}
+
+// The bench class is a friend of the decoder context, so it has to be in the backend's namespace as well
+GSTDDEC_NAMESPACE_BEGIN
+	template<unsigned int TVectorWidth, unsigned int TFormatWidth, bool TPaddedBuffers>
+	class DecompressorKernelBench
+	{
+	public:
+		DecompressorKernelBench(FILE *csvF, const KernelBenchOptions &options);
+
+		void RunAll();
+
+	private:
+		typedef DecompressorContext<TVectorWidth, TFormatWidth, TPaddedBuffers> Context_t;
+		typedef typename Context_t::vuint64_t vuint64_t;
+		typedef typename Context_t::vuint32_t vuint32_t;
+
+		static const uint32_t kInputDWords = 64 * 1024;
+		static const uint32_t kOutputBytes = 256 * 1024;
+		static const uint32_t kMatchWindowBytes = 32 * 1024;
+		static const uint32_t kNumPatterns = 256;
+		static const uint32_t kFSEAccuracyLog = GSTD_MAX_LIT_LENGTH_ACCURACY_LOG;
+
+		template<class TCall>
+		void Measure(const char *kernelName, uint32_t numCalls, const TCall &call);
+
+		void ResetState();
+		void ResetBitstream(uint32_t readPos);
+		void BuildLitHuffmanWeights();
+		void BuildFSETable();
+
+		void BenchDecodeLiteralVector();
+		void BenchDecodeFSEValueNoPeek();
+		void BenchBitstreamPeekNoTruncate();
+		void BenchExpandLitHuffmanTable();
+		void BenchDecodeFSETable();
+		void BenchEmitLiterals();
+		void BenchExecuteMatchCopy();
+
+		FILE *m_csvF;
+		KernelBenchOptions m_options;
+
+		std::vector<uint32_t> m_input;
+		std::vector<uint32_t> m_sparseInput;
+		std::vector<uint32_t> m_output;
+
+		Context_t m_context;
+		Context_t m_sparseContext;
+
+		uint32_t m_numSpecifiedWeights;
+		uint32_t m_weightTotal;
+		uint32_t m_huffmanCodeMask;
+
+		vuint32_t m_codeBitPatterns[kNumPatterns];
+		vuint64_t m_bitstreamPatterns[kNumPatterns];
+		vuint32_t m_discardPatterns[kNumPatterns];
+		uint32_t m_runLengths[kNumPatterns];
+		uint32_t m_matchOffsets[kNumPatterns];
+
+		uint32_t m_sink;
+	};
+
+	template<unsigned int TVectorWidth, unsigned int TFormatWidth, bool TPaddedBuffers>
+	DecompressorKernelBench<TVectorWidth, TFormatWidth, TPaddedBuffers>::DecompressorKernelBench(FILE *csvF, const KernelBenchOptions &options)
+		: m_csvF(csvF)
+		, m_options(options)
+		, m_input(kInputDWords + GSTD_DECOMPRESS_INPUT_PADDING / 4, 0)
+		, m_sparseInput(kInputDWords + GSTD_DECOMPRESS_INPUT_PADDING / 4, 0)
+		, m_output(kOutputBytes / 4, 0)
+		, m_context(&m_input[0], kInputDWords * 4, &m_output[0], kOutputBytes, nullptr, nullptr, nullptr, nullptr)
+		, m_sparseContext(&m_sparseInput[0], kInputDWords * 4, &m_output[0], kOutputBytes, nullptr, nullptr, nullptr, nullptr)
+		, m_numSpecifiedWeights(0)
+		, m_weightTotal(0)
+		, m_huffmanCodeMask(0)
+		, m_sink(0)
+	{
+		BenchRandom rng(0x9e3779b9u + TVectorWidth);
+
+		// FSE table probabilities are read from sparse bits so that tables have many small probabilities
+		// like real ones, instead of a few large ones that would exhaust the table immediately.
+		for (uint32_t i = 0; i < kInputDWords; i++)
+		{
+			m_input[i] = rng.Next();
+			m_sparseInput[i] = rng.Next() & rng.Next() & rng.Next();
+		}
+
+		for (uint32_t i = 0; i < kOutputBytes / 4; i++)
+			m_output[i] = rng.Next();
+
+		for (uint32_t i = 0; i < kNumPatterns; i++)
+		{
+			for (unsigned int lane = 0; lane < TVectorWidth; lane++)
+			{
+				m_codeBitPatterns[i].Set(lane, rng.Next());
+				m_bitstreamPatterns[i].Set(lane, (static_cast<uint64_t>(rng.Next()) << 32) | rng.Next());
+				m_discardPatterns[i].Set(lane, rng.NextInRange(1, GSTD_MAX_HUFFMAN_CODE_LENGTH));
+			}
+
+			// Mostly short runs, as in real sequences, with the occasional long one
+			if ((i & 15) == 0)
+				m_runLengths[i] = rng.NextInRange(32, 128);
+			else
+				m_runLengths[i] = rng.NextInRange(3, 16);
+
+			switch (i & 3)
+			{
+			case 0:
+				m_matchOffsets[i] = rng.NextInRange(1, 15);
+				break;
+			case 1:
+				m_matchOffsets[i] = rng.NextInRange(16, 255);
+				break;
+			default:
+				m_matchOffsets[i] = rng.NextInRange(256, kMatchWindowBytes);
+				break;
+			}
+		}
+	}
+
+	template<unsigned int TVectorWidth, unsigned int TFormatWidth, bool TPaddedBuffers>
+	template<class TCall>
+	void DecompressorKernelBench<TVectorWidth, TFormatWidth, TPaddedBuffers>::Measure(const char *kernelName, uint32_t numCalls, const TCall &call)
+	{
+		if (numCalls < 1)
+			numCalls = 1;
+
+		uint64_t numItems = 0;
+
+		std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+		for (uint32_t i = 0; i < numCalls; i++)
+			numItems += call(i);
+
+		uint64_t nanoseconds = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count());
+
+		double nsPerCall = static_cast<double>(nanoseconds) / static_cast<double>(numCalls);
+		double mItemsPerSecond = 0.0;
+		if (nanoseconds > 0)
+			mItemsPerSecond = static_cast<double>(numItems) * 1000.0 / static_cast<double>(nanoseconds);
+
+		fprintf(m_csvF, "%s,%u,%s,%u,%llu,%llu,%.3f,%.3f\n", GSTD_BENCH_KERNELS_BACKEND, TVectorWidth, kernelName, numCalls, static_cast<unsigned long long>(numItems), static_cast<unsigned long long>(nanoseconds), nsPerCall, mItemsPerSecond);
+		fflush(m_csvF);
+	}
+
+	// Same starting state as Run
+	template<unsigned int TVectorWidth, unsigned int TFormatWidth, bool TPaddedBuffers>
+	void DecompressorKernelBench<TVectorWidth, TFormatWidth, TPaddedBuffers>::ResetState()
+	{
+		Context_t *contexts[2] = { &m_context, &m_sparseContext };
+
+		for (Context_t *context : contexts)
+		{
+			memset(&context->gs_decompressorState, 0, sizeof(context->gs_decompressorState));
+
+			context->g_dstate.readPos = 0;
+			context->g_dstate.writePosByte = 0;
+			context->g_dstate.uncompressedBytesAvailable = 0;
+			context->g_dstate.uncompressedBytes = 0;
+			context->g_dstate.litRLEByte = 0;
+			context->g_dstate.litLengthAccuracyLog = 0;
+			context->g_dstate.matchLengthAccuracyLog = 0;
+			context->g_dstate.offsetAccuracyLog = 0;
+			context->g_dstate.repeatedOffset1 = 1;
+			context->g_dstate.repeatedOffset2 = 4;
+			context->g_dstate.repeatedOffset3 = 8;
+			context->g_dstate.numLiteralsEmitted = 0;
+			context->g_dstate.maxLiterals = 0;
+
+			for (uint32_t i = 0; i < GSTDDEC_VVEC_SIZE; i++)
+			{
+				context->g_dstate.bitstreamBits[i] = vuint64_t(0);
+				context->g_dstate.bitstreamAvailable[i] = vuint32_t(0);
+				context->g_dstate.fseState[i] = vuint32_t(0);
+				context->g_dstate.fseDrainLevel[i] = vuint32_t(GSTD_MAX_ACCURACY_LOG);
+				context->g_dstate.literalsBuffer[i] = vuint32_t(0);
+			}
+		}
+	}
+
+	template<unsigned int TVectorWidth, unsigned int TFormatWidth, bool TPaddedBuffers>
+	void DecompressorKernelBench<TVectorWidth, TFormatWidth, TPaddedBuffers>::ResetBitstream(uint32_t readPos)
+	{
+		m_context.g_dstate.readPos = readPos;
+		m_sparseContext.g_dstate.readPos = readPos;
+
+		for (uint32_t i = 0; i < GSTDDEC_VVEC_SIZE; i++)
+		{
+			m_context.g_dstate.bitstreamBits[i] = vuint64_t(0);
+			m_context.g_dstate.bitstreamAvailable[i] = vuint32_t(0);
+			m_sparseContext.g_dstate.bitstreamBits[i] = vuint64_t(0);
+			m_sparseContext.g_dstate.bitstreamAvailable[i] = vuint32_t(0);
+		}
+	}
+
+	// 255 specified weights plus 1 implied, forming a complete code with lengths from 6 to 10 bits
+	template<unsigned int TVectorWidth, unsigned int TFormatWidth, bool TPaddedBuffers>
+	void DecompressorKernelBench<TVectorWidth, TFormatWidth, TPaddedBuffers>::BuildLitHuffmanWeights()
+	{
+		m_context.ClearLitHuffmanTree();
+
+		m_numSpecifiedWeights = 255;
+		m_weightTotal = 0;
+
+		for (uint32_t i = 0; i < m_numSpecifiedWeights; i++)
+		{
+			uint32_t weight = 1;
+			if (i < 32)
+				weight = 5;
+			else if (i < 64)
+				weight = 4;
+			else if (i < 128)
+				weight = 2;
+
+			m_context.gs_decompressorState.packedHuffmanWeights[i / 8u] |= weight << ((i % 8u) * 4u);
+			m_weightTotal += (1u << weight) >> 1;
+		}
+
+		uint32_t finalWeightTotal = 0;
+		m_context.ExpandLitHuffmanTable(m_numSpecifiedWeights, m_weightTotal, finalWeightTotal);
+		m_huffmanCodeMask = finalWeightTotal - 1;
+	}
+
+	// Cells have a mix of bit counts with baselines that keep the state in range, the symbols themselves
+	// don't need to form a valid distribution for the decode step.
+	template<unsigned int TVectorWidth, unsigned int TFormatWidth, bool TPaddedBuffers>
+	void DecompressorKernelBench<TVectorWidth, TFormatWidth, TPaddedBuffers>::BuildFSETable()
+	{
+		uint32_t numCells = (1u << kFSEAccuracyLog);
+
+		for (uint32_t i = 0; i < numCells; i++)
+		{
+			uint32_t numBits = kFSEAccuracyLog - (i % 4u);
+			uint32_t baseline = ((i * 5u) & ((1u << (kFSEAccuracyLog - numBits)) - 1u)) << numBits;
+			uint32_t symbol = i % (GSTD_MAX_LIT_LENGTH_CODE + 1u);
+
+			m_context.gs_decompressorState.fseCells[GSTDDEC_FSETAB_LIT_LENGTH_START + i] = (symbol << GSTDDEC_FSE_TABLE_CELL_SYM_OFFSET) | (numBits << GSTDDEC_FSE_TABLE_CELL_NUMBITS_OFFSET) | (baseline << GSTDDEC_FSE_TABLE_CELL_BASELINE_OFFSET);
+		}
+	}
+
+	template<unsigned int TVectorWidth, unsigned int TFormatWidth, bool TPaddedBuffers>
+	void DecompressorKernelBench<TVectorWidth, TFormatWidth, TPaddedBuffers>::BenchDecodeLiteralVector()
+	{
+		ResetState();
+		BuildLitHuffmanWeights();
+
+		Measure("DecodeLiteralVector", m_options.m_iterations, [this](uint32_t callIndex) -> uint64_t
+		{
+			vuint32_t discardBits = vuint32_t(0);
+			vuint32_t symbols = m_context.DecodeLiteralVector(TVectorWidth, m_codeBitPatterns[callIndex % kNumPatterns], m_huffmanCodeMask, discardBits);
+			m_sink += symbols.Get(0) ^ discardBits.Get(TVectorWidth - 1);
+			return TVectorWidth;
+		});
+	}
+
+	template<unsigned int TVectorWidth, unsigned int TFormatWidth, bool TPaddedBuffers>
+	void DecompressorKernelBench<TVectorWidth, TFormatWidth, TPaddedBuffers>::BenchDecodeFSEValueNoPeek()
+	{
+		ResetState();
+		BuildFSETable();
+
+		// Bits are topped up directly instead of through a peek so that only the decode step is measured
+		Measure("DecodeFSEValueNoPeek", m_options.m_iterations, [this](uint32_t callIndex) -> uint64_t
+		{
+			m_context.g_dstate.bitstreamBits[0] = m_bitstreamPatterns[callIndex % kNumPatterns];
+			m_context.g_dstate.bitstreamAvailable[0] = vuint32_t(32);
+
+			vuint32_t symbols = m_context.DecodeFSEValueNoPeek(TVectorWidth, 0, kFSEAccuracyLog, GSTDDEC_FSETAB_LIT_LENGTH_START);
+			m_sink += symbols.Get(0);
+			return TVectorWidth;
+		});
+	}
+
+	template<unsigned int TVectorWidth, unsigned int TFormatWidth, bool TPaddedBuffers>
+	void DecompressorKernelBench<TVectorWidth, TFormatWidth, TPaddedBuffers>::BenchBitstreamPeekNoTruncate()
+	{
+		ResetState();
+
+		// Each call is paired with a discard of 1 to 11 bits per lane so that a varying subset of lanes refills
+		Measure("BitstreamPeekNoTruncate", m_options.m_iterations, [this](uint32_t callIndex) -> uint64_t
+		{
+			if (m_context.g_dstate.readPos + TVectorWidth > kInputDWords)
+				ResetBitstream(0);
+
+			vuint32_t bits = m_context.BitstreamPeekNoTruncate(0, TVectorWidth, GSTD_MAX_HUFFMAN_CODE_LENGTH);
+			m_context.BitstreamDiscard(0, TVectorWidth, m_discardPatterns[callIndex % kNumPatterns]);
+			m_sink += bits.Get(0);
+			return TVectorWidth;
+		});
+	}
+
+	template<unsigned int TVectorWidth, unsigned int TFormatWidth, bool TPaddedBuffers>
+	void DecompressorKernelBench<TVectorWidth, TFormatWidth, TPaddedBuffers>::BenchExpandLitHuffmanTable()
+	{
+		ResetState();
+		BuildLitHuffmanWeights();
+
+		Measure("ExpandLitHuffmanTable", m_options.m_iterations / 100u, [this](uint32_t) -> uint64_t
+		{
+			uint32_t finalWeightTotal = 0;
+			m_context.ExpandLitHuffmanTable(m_numSpecifiedWeights, m_weightTotal, finalWeightTotal);
+			m_sink += finalWeightTotal;
+			return m_numSpecifiedWeights + 1u;
+		});
+	}
+
+	template<unsigned int TVectorWidth, unsigned int TFormatWidth, bool TPaddedBuffers>
+	void DecompressorKernelBench<TVectorWidth, TFormatWidth, TPaddedBuffers>::BenchDecodeFSETable()
+	{
+		ResetState();
+
+		Measure("DecodeFSETable", m_options.m_iterations / 100u, [this](uint32_t callIndex) -> uint64_t
+		{
+			ResetBitstream((callIndex % 64u) * TFormatWidth);
+
+			uint32_t accuracyLog = 0;
+			m_sparseContext.DecodeFSETable(GSTDDEC_FSETAB_MATCH_LENGTH_START, GSTD_MAX_MATCH_LENGTH_CODE, GSTD_MAX_MATCH_LENGTH_ACCURACY_LOG, GSTD_MAX_MATCH_LENGTH_ACCURACY_LOG, accuracyLog);
+			m_sink += m_sparseContext.gs_decompressorState.fseCells[GSTDDEC_FSETAB_MATCH_LENGTH_START];
+			return 1u << accuracyLog;
+		});
+	}
+
+	template<unsigned int TVectorWidth, unsigned int TFormatWidth, bool TPaddedBuffers>
+	void DecompressorKernelBench<TVectorWidth, TFormatWidth, TPaddedBuffers>::BenchEmitLiterals()
+	{
+		ResetState();
+
+		BenchRandom rng(TVectorWidth);
+		for (uint32_t i = 0; i < GSTDDEC_VVEC_SIZE; i++)
+		{
+			for (unsigned int lane = 0; lane < TVectorWidth; lane++)
+				m_context.g_dstate.literalsBuffer[i].Set(lane, rng.Next());
+		}
+
+		Measure("EmitLiterals", m_options.m_iterations, [this](uint32_t callIndex) -> uint64_t
+		{
+			uint32_t numLiterals = std::min<uint32_t>(m_runLengths[callIndex % kNumPatterns], GSTDDEC_LIT_BUFFER_BYTE_SIZE);
+
+			if (m_context.g_dstate.writePosByte + numLiterals > kOutputBytes)
+				m_context.g_dstate.writePosByte = 0;
+
+			m_context.EmitLiterals(numLiterals);
+			return numLiterals;
+		});
+	}
+
+	template<unsigned int TVectorWidth, unsigned int TFormatWidth, bool TPaddedBuffers>
+	void DecompressorKernelBench<TVectorWidth, TFormatWidth, TPaddedBuffers>::BenchExecuteMatchCopy()
+	{
+		ResetState();
+
+		m_context.g_dstate.writePosByte = kMatchWindowBytes;
+
+		Measure("ExecuteMatchCopy", m_options.m_iterations, [this](uint32_t callIndex) -> uint64_t
+		{
+			uint32_t matchLength = m_runLengths[callIndex % kNumPatterns];
+			uint32_t matchOffset = m_matchOffsets[callIndex % kNumPatterns];
+
+			if (m_context.g_dstate.writePosByte + matchLength > kOutputBytes)
+				m_context.g_dstate.writePosByte = kMatchWindowBytes;
+
+			m_context.ExecuteMatchCopy(matchLength, matchOffset);
+			return matchLength;
+		});
+	}
+
+	template<unsigned int TVectorWidth, unsigned int TFormatWidth, bool TPaddedBuffers>
+	void DecompressorKernelBench<TVectorWidth, TFormatWidth, TPaddedBuffers>::RunAll()
+	{
+		struct KernelEntry
+		{
+			const char *m_name;
+			void (DecompressorKernelBench::*m_bench)();
+		};
+
+		const KernelEntry kernels[] =
+		{
+			{ "DecodeLiteralVector", &DecompressorKernelBench::BenchDecodeLiteralVector },
+			{ "DecodeFSEValueNoPeek", &DecompressorKernelBench::BenchDecodeFSEValueNoPeek },
+			{ "BitstreamPeekNoTruncate", &DecompressorKernelBench::BenchBitstreamPeekNoTruncate },
+			{ "ExpandLitHuffmanTable", &DecompressorKernelBench::BenchExpandLitHuffmanTable },
+			{ "DecodeFSETable", &DecompressorKernelBench::BenchDecodeFSETable },
+			{ "EmitLiterals", &DecompressorKernelBench::BenchEmitLiterals },
+			{ "ExecuteMatchCopy", &DecompressorKernelBench::BenchExecuteMatchCopy },
+		};
+
+		for (const KernelEntry &kernel : kernels)
+		{
+			if (m_options.m_kernelFilter == nullptr || !strcmp(m_options.m_kernelFilter, kernel.m_name))
+				(this->*kernel.m_bench)();
+		}
+
+		// Keeps the results of the kernels live
+		if (m_sink == 0x12345678u)
+			fprintf(stderr, "\n");
+	}
+GSTDDEC_NAMESPACE_END
+
+namespace
+{
+	template<unsigned int TWidth>
+	void BenchKernelsAtWidth(FILE *csvF, const KernelBenchOptions &options)
+	{
+		// The context is large, especially at wide vector widths, so keep it off of the stack
+		gstddec::DecompressorKernelBench<TWidth, TWidth, true> *bench = new gstddec::DecompressorKernelBench<TWidth, TWidth, true>(csvF, options);
+		bench->RunAll();
+		delete bench;
+	}
+}
+
+void GSTD_BENCH_KERNELS_ENTRY(FILE *csvF, const KernelBenchOptions &options)
+{
+	BenchKernelsAtWidth<8>(csvF, options);
+	BenchKernelsAtWidth<16>(csvF, options);
+	BenchKernelsAtWidth<32>(csvF, options);
+	BenchKernelsAtWidth<64>(csvF, options);
+}
@@ -0,0 +1,27 @@
+/*
+Copyright (c) 2024 Eric Lasota
+
+This software is available under the terms of the MIT license
+or the Apache License, Version 2.0.  For more information, see
+the included LICENSE.txt file.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Implemented in crc32.c
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+uint32_t crc32(uint32_t crc, const void *buf, size_t len);
+
+// Returns the CRC of two blocks concatenated, given the CRC of each block and the length of the second
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, size_t len2);
+
+#ifdef __cplusplus
+}
+#endif
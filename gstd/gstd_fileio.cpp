@@ -0,0 +1,433 @@
+/*
+Copyright (c) 2024 Eric Lasota
+
+This software is available under the terms of the MIT license
+or the Apache License, Version 2.0.  For more information, see
+the included LICENSE.txt file.
+*/
+
+#include "gstd_fileio.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+
+// CMake builds check for copy_file_range, other builds assume it's available from glibc 2.27 on
+#ifndef GSTD_HAVE_COPY_FILE_RANGE
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define GSTD_HAVE_COPY_FILE_RANGE 1
+#else
+#define GSTD_HAVE_COPY_FILE_RANGE 0
+#endif
+#endif
+
+namespace
+{
+	bool IsRegularFile(int fd)
+	{
+		struct stat st;
+		if (fstat(fd, &st) != 0)
+			return false;
+
+		return S_ISREG(st.st_mode);
+	}
+}
+
+bool CanKernelCopyFileRange(FILE *inF, FILE *outF)
+{
+	return IsRegularFile(fileno(inF)) && IsRegularFile(fileno(outF));
+}
+
+uint64_t KernelCopyFileRange(FILE *inF, FILE *outF, uint64_t size)
+{
+	// Both streams may have buffered data, so work from their logical positions with explicit offsets
+	// and reposition them afterward, which also discards the stale read buffer
+	if (fflush(outF) != 0)
+		return 0;
+
+	off_t inPos = ftello(inF);
+	off_t outPos = ftello(outF);
+	if (inPos < 0 || outPos < 0)
+		return 0;
+
+	int inFD = fileno(inF);
+	int outFD = fileno(outF);
+
+	uint64_t copied = 0;
+#if GSTD_HAVE_COPY_FILE_RANGE
+	bool useSendFile = false;
+#endif
+
+	while (copied < size)
+	{
+		size_t chunkSize = static_cast<size_t>(size - copied);
+		ssize_t result = -1;
+
+#if GSTD_HAVE_COPY_FILE_RANGE
+		if (!useSendFile)
+		{
+			result = copy_file_range(inFD, &inPos, outFD, &outPos, chunkSize, 0);
+
+			// Older kernels don't support copy_file_range across file systems
+			if (result < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP))
+			{
+				useSendFile = true;
+				continue;
+			}
+		}
+		else
+#endif
+		{
+			// sendfile writes at the output's file offset, which matches outPos after the flush
+			if (lseek(outFD, outPos, SEEK_SET) != outPos)
+				break;
+
+			result = sendfile(outFD, inFD, &inPos, chunkSize);
+			if (result > 0)
+				outPos += result;
+		}
+
+		if (result < 0 && errno == EINTR)
+			continue;
+
+		if (result <= 0)
+			break;
+
+		copied += static_cast<uint64_t>(result);
+	}
+
+	fseeko(inF, inPos, SEEK_SET);
+	fseeko(outF, outPos, SEEK_SET);
+
+	return copied;
+}
+
+#else
+
+bool CanKernelCopyFileRange(FILE *inF, FILE *outF)
+{
+	(void)inF;
+	(void)outF;
+
+	return false;
+}
+
+uint64_t KernelCopyFileRange(FILE *inF, FILE *outF, uint64_t size)
+{
+	(void)inF;
+	(void)outF;
+	(void)size;
+
+	return 0;
+}
+
+#endif
+
+#ifdef _WIN32
+
+bool SeekFile64(FILE *f, uint64_t offset)
+{
+	return _fseeki64(f, static_cast<__int64>(offset), SEEK_SET) == 0;
+}
+
+bool GetFileSize64(FILE *f, uint64_t &outSize)
+{
+	__int64 pos = _ftelli64(f);
+	if (pos < 0 || _fseeki64(f, 0, SEEK_END) != 0)
+		return false;
+
+	__int64 size = _ftelli64(f);
+	if (_fseeki64(f, pos, SEEK_SET) != 0 || size < 0)
+		return false;
+
+	outSize = static_cast<uint64_t>(size);
+	return true;
+}
+
+bool TellFile64(FILE *f, uint64_t &outOffset)
+{
+	__int64 pos = _ftelli64(f);
+	if (pos < 0)
+		return false;
+
+	outOffset = static_cast<uint64_t>(pos);
+	return true;
+}
+
+bool ReadFileAt(FILE *f, uint64_t offset, void *dest, size_t size)
+{
+	__int64 pos = _ftelli64(f);
+	if (pos < 0 || _fseeki64(f, static_cast<__int64>(offset), SEEK_SET) != 0)
+		return false;
+
+	bool succeeded = (fread(dest, 1, size, f) == size);
+
+	return _fseeki64(f, pos, SEEK_SET) == 0 && succeeded;
+}
+
+bool CreateDirectoryIfMissing(const char *path)
+{
+	if (CreateDirectoryA(path, nullptr))
+		return true;
+
+	return GetLastError() == ERROR_ALREADY_EXISTS;
+}
+
+bool RenameFileReplacing(const char *fromPath, const char *toPath)
+{
+	return MoveFileExA(fromPath, toPath, MOVEFILE_REPLACE_EXISTING) != 0;
+}
+
+MappedFile::MappedFile()
+	: m_data(nullptr), m_size(0), m_fileHandle(INVALID_HANDLE_VALUE), m_mappingHandle(nullptr)
+{
+}
+
+bool MappedFile::OpenRead(const char *path)
+{
+	Close();
+
+	m_fileHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (m_fileHandle == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(m_fileHandle, &fileSize))
+	{
+		Close();
+		return false;
+	}
+
+	m_size = static_cast<uint64_t>(fileSize.QuadPart);
+
+	return MapView(false);
+}
+
+bool MappedFile::CreateReadWrite(const char *path, uint64_t size)
+{
+	Close();
+
+	m_fileHandle = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (m_fileHandle == INVALID_HANDLE_VALUE)
+		return false;
+
+	// Creating the mapping extends the file to the mapping size
+	m_size = size;
+
+	return MapView(true);
+}
+
+bool MappedFile::MapView(bool writable)
+{
+	if (m_size == 0)
+		return true;
+
+	m_mappingHandle = CreateFileMappingA(m_fileHandle, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, static_cast<DWORD>(m_size >> 32), static_cast<DWORD>(m_size & 0xffffffffu), nullptr);
+	if (!m_mappingHandle)
+	{
+		Close();
+		return false;
+	}
+
+	m_data = static_cast<uint8_t *>(MapViewOfFile(m_mappingHandle, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0));
+	if (!m_data)
+	{
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_data)
+		UnmapViewOfFile(m_data);
+
+	if (m_mappingHandle)
+		CloseHandle(m_mappingHandle);
+
+	if (m_fileHandle != INVALID_HANDLE_VALUE)
+		CloseHandle(m_fileHandle);
+
+	m_data = nullptr;
+	m_size = 0;
+	m_mappingHandle = nullptr;
+	m_fileHandle = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+bool SeekFile64(FILE *f, uint64_t offset)
+{
+	return fseeko(f, static_cast<off_t>(offset), SEEK_SET) == 0;
+}
+
+bool GetFileSize64(FILE *f, uint64_t &outSize)
+{
+	struct stat st;
+	if (fflush(f) != 0 || fstat(fileno(f), &st) != 0)
+		return false;
+
+	outSize = static_cast<uint64_t>(st.st_size);
+	return true;
+}
+
+bool TellFile64(FILE *f, uint64_t &outOffset)
+{
+	off_t pos = ftello(f);
+	if (pos < 0)
+		return false;
+
+	outOffset = static_cast<uint64_t>(pos);
+	return true;
+}
+
+bool ReadFileAt(FILE *f, uint64_t offset, void *dest, size_t size)
+{
+	uint8_t *destBytes = static_cast<uint8_t *>(dest);
+
+	while (size > 0)
+	{
+		ssize_t bytesRead = pread(fileno(f), destBytes, size, static_cast<off_t>(offset));
+		if (bytesRead < 0 && errno == EINTR)
+			continue;
+
+		if (bytesRead <= 0)
+			return false;
+
+		destBytes += bytesRead;
+		offset += static_cast<uint64_t>(bytesRead);
+		size -= static_cast<size_t>(bytesRead);
+	}
+
+	return true;
+}
+
+bool CreateDirectoryIfMissing(const char *path)
+{
+	if (mkdir(path, 0777) == 0)
+		return true;
+
+	return errno == EEXIST;
+}
+
+bool RenameFileReplacing(const char *fromPath, const char *toPath)
+{
+	return rename(fromPath, toPath) == 0;
+}
+
+MappedFile::MappedFile()
+	: m_data(nullptr), m_size(0), m_fd(-1)
+{
+}
+
+bool MappedFile::OpenRead(const char *path)
+{
+	Close();
+
+	m_fd = open(path, O_RDONLY);
+	if (m_fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(m_fd, &st) != 0)
+	{
+		Close();
+		return false;
+	}
+
+	m_size = static_cast<uint64_t>(st.st_size);
+
+	return MapView(false);
+}
+
+bool MappedFile::CreateReadWrite(const char *path, uint64_t size)
+{
+	Close();
+
+	m_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+	if (m_fd < 0)
+		return false;
+
+	// Extending the file leaves it sparse, so the contents read as zero without being written
+	if (ftruncate(m_fd, static_cast<off_t>(size)) != 0)
+	{
+		Close();
+		return false;
+	}
+
+#ifdef __linux__
+	// A sparse file can run out of disk while pages are stored through the mapping, which raises SIGBUS
+	// instead of returning an error, so allocate all of its blocks up front
+	if (size > 0)
+	{
+		if (posix_fallocate(m_fd, 0, static_cast<off_t>(size)) != 0)
+		{
+			Close();
+			return false;
+		}
+	}
+#endif
+
+	m_size = size;
+
+	return MapView(true);
+}
+
+bool MappedFile::MapView(bool writable)
+{
+	if (m_size == 0)
+		return true;
+
+	void *data = mmap(nullptr, static_cast<size_t>(m_size), writable ? (PROT_READ | PROT_WRITE) : PROT_READ, writable ? MAP_SHARED : MAP_PRIVATE, m_fd, 0);
+	if (data == MAP_FAILED)
+	{
+		Close();
+		return false;
+	}
+
+	m_data = static_cast<uint8_t *>(data);
+
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_data)
+		munmap(m_data, static_cast<size_t>(m_size));
+
+	if (m_fd >= 0)
+		close(m_fd);
+
+	m_data = nullptr;
+	m_size = 0;
+	m_fd = -1;
+}
+
+#endif
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+uint8_t *MappedFile::Data() const
+{
+	return m_data;
+}
+
+uint64_t MappedFile::Size() const
+{
+	return m_size;
+}
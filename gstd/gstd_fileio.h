@@ -0,0 +1,73 @@
+/*
+Copyright (c) 2024 Eric Lasota
+
+This software is available under the terms of the MIT license
+or the Apache License, Version 2.0.  For more information, see
+the included LICENSE.txt file.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Copies up to size bytes from the current position of inF to the current position of outF without
+// passing the data through user space, and advances both files past the copied bytes.  Only works if
+// both files are regular files and the platform supports kernel-side copies.  Returns the number of
+// bytes copied, the caller is responsible for copying any remainder.
+uint64_t KernelCopyFileRange(FILE *inF, FILE *outF, uint64_t size);
+
+// Returns true if KernelCopyFileRange can be used between the two files
+bool CanKernelCopyFileRange(FILE *inF, FILE *outF);
+
+// 64-bit seek and size queries, which work past 2GB on every platform
+bool SeekFile64(FILE *f, uint64_t offset);
+bool GetFileSize64(FILE *f, uint64_t &outSize);
+bool TellFile64(FILE *f, uint64_t &outOffset);
+
+// Reads size bytes at offset without moving the file's position
+bool ReadFileAt(FILE *f, uint64_t offset, void *dest, size_t size);
+
+// Returns true if the directory exists afterward
+bool CreateDirectoryIfMissing(const char *path);
+
+// Renames a file, replacing any existing file at the destination in a single step
+bool RenameFileReplacing(const char *fromPath, const char *toPath);
+
+// A whole file mapped into memory
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	// Maps an existing file read-only
+	bool OpenRead(const char *path);
+
+	// Creates or truncates a file, sizes it, and maps it for writing.  The contents start out zero-filled.
+	// On Linux, this fails if the file's disk space can't be allocated.
+	bool CreateReadWrite(const char *path, uint64_t size);
+
+	void Close();
+
+	// Null if the file is empty
+	uint8_t *Data() const;
+	uint64_t Size() const;
+
+private:
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	bool MapView(bool writable);
+
+	uint8_t *m_data;
+	uint64_t m_size;
+
+#ifdef _WIN32
+	void *m_fileHandle;
+	void *m_mappingHandle;
+#else
+	int m_fd;
+#endif
+};
@@ -0,0 +1,189 @@
+/*
+Copyright (c) 2024 Eric Lasota
+
+This software is available under the terms of the MIT license
+or the Apache License, Version 2.0.  For more information, see
+the included LICENSE.txt file.
+*/
+
+#include "gstd_page_cache.h"
+#include "gstd_archive.h"
+#include "gstd_fileio.h"
+
+#include "common/xxhash.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <random>
+
+namespace
+{
+	// Entries start with a header of the magic, the uncompressed size, the compressed size, a reserved
+	// dword, then the content, verify, settings, and payload hashes
+	const uint32_t kPageCacheMagic = 0x43505347u;	// "GSPC"
+	const size_t kPageCacheHeaderSize = 48;
+
+	void WriteLE32(uint8_t *bytes, uint32_t value)
+	{
+		for (int i = 0; i < 4; i++)
+			bytes[i] = static_cast<uint8_t>((value >> (i * 8)) & 0xffu);
+	}
+
+	void WriteLE64(uint8_t *bytes, uint64_t value)
+	{
+		for (int i = 0; i < 8; i++)
+			bytes[i] = static_cast<uint8_t>((value >> (i * 8)) & 0xffu);
+	}
+
+	uint64_t ReadLE64(const uint8_t *bytes)
+	{
+		return static_cast<uint64_t>(ReadLE32(bytes)) | (static_cast<uint64_t>(ReadLE32(bytes + 4)) << 32);
+	}
+}
+
+PageCache::PageCache()
+	: m_numHits(0), m_numMisses(0), m_nextTempID(0), m_instanceID(0)
+{
+	std::random_device randomDevice;
+	for (int i = 0; i < 2; i++)
+		m_instanceID = (m_instanceID << 32) | static_cast<uint32_t>(randomDevice());
+
+	// random_device may be deterministic, so the time is mixed in as well
+	m_instanceID ^= static_cast<uint64_t>(std::chrono::high_resolution_clock::now().time_since_epoch().count());
+}
+
+bool PageCache::Open(const char *dirPath)
+{
+	m_dirPath = dirPath;
+
+	if (!m_dirPath.empty() && m_dirPath.back() != '/' && m_dirPath.back() != '\\')
+		m_dirPath.append("/");
+
+	return CreateDirectoryIfMissing(dirPath);
+}
+
+bool PageCache::Load(uint64_t contentHash, uint64_t verifyHash, uint64_t settingsHash, size_t uncompressedSize, std::vector<uint8_t> &outData)
+{
+	std::string path = EntryPath(contentHash, settingsHash, false);
+
+	FILE *f = fopen(path.c_str(), "rb");
+	if (!f)
+	{
+		m_numMisses++;
+		return false;
+	}
+
+	uint8_t header[kPageCacheHeaderSize];
+	bool isValid = (fread(header, 1, kPageCacheHeaderSize, f) == kPageCacheHeaderSize);
+
+	uint32_t compressedSize = 0;
+
+	if (isValid)
+	{
+		compressedSize = ReadLE32(header + 8);
+
+		isValid = ReadLE32(header) == kPageCacheMagic
+			&& ReadLE32(header + 4) == uncompressedSize
+			&& compressedSize < uncompressedSize
+			&& ReadLE64(header + 16) == contentHash
+			&& ReadLE64(header + 24) == verifyHash
+			&& ReadLE64(header + 32) == settingsHash;
+	}
+
+	if (isValid)
+	{
+		outData.resize(compressedSize);
+
+		if (compressedSize > 0)
+			isValid = (fread(&outData[0], 1, compressedSize, f) == compressedSize);
+	}
+
+	if (isValid)
+		isValid = (XXH64(outData.empty() ? nullptr : &outData[0], outData.size(), 0) == ReadLE64(header + 40));
+
+	fclose(f);
+
+	if (!isValid)
+	{
+		outData.clear();
+		m_numMisses++;
+		return false;
+	}
+
+	m_numHits++;
+	return true;
+}
+
+void PageCache::Store(uint64_t contentHash, uint64_t verifyHash, uint64_t settingsHash, size_t uncompressedSize, const void *data, size_t compressedSize)
+{
+	std::string path = EntryPath(contentHash, settingsHash, true);
+
+	// Other processes may be storing the same entry, so the temp file is named after this cache's random
+	// instance ID and is created exclusively, retrying with the next ID if it already exists
+	std::string tempPath;
+	FILE *f = nullptr;
+
+	for (int attempt = 0; attempt < 4 && !f; attempt++)
+	{
+		char tempSuffix[48];
+		snprintf(tempSuffix, sizeof(tempSuffix), ".tmp%016llx_%llu", static_cast<unsigned long long>(m_instanceID), static_cast<unsigned long long>(m_nextTempID++));
+
+		tempPath = path + tempSuffix;
+		f = fopen(tempPath.c_str(), "wbx");
+	}
+
+	if (!f)
+		return;
+
+	uint8_t header[kPageCacheHeaderSize];
+	WriteLE32(header, kPageCacheMagic);
+	WriteLE32(header + 4, static_cast<uint32_t>(uncompressedSize));
+	WriteLE32(header + 8, static_cast<uint32_t>(compressedSize));
+	WriteLE32(header + 12, 0);
+	WriteLE64(header + 16, contentHash);
+	WriteLE64(header + 24, verifyHash);
+	WriteLE64(header + 32, settingsHash);
+	WriteLE64(header + 40, XXH64(data, compressedSize, 0));
+
+	bool written = (fwrite(header, 1, kPageCacheHeaderSize, f) == kPageCacheHeaderSize);
+
+	if (written && compressedSize > 0)
+		written = (fwrite(data, 1, compressedSize, f) == compressedSize);
+
+	if (fclose(f) != 0)
+		written = false;
+
+	if (!written || !RenameFileReplacing(tempPath.c_str(), path.c_str()))
+		remove(tempPath.c_str());
+}
+
+uint64_t PageCache::NumHits() const
+{
+	return m_numHits;
+}
+
+uint64_t PageCache::NumMisses() const
+{
+	return m_numMisses;
+}
+
+std::string PageCache::EntryPath(uint64_t contentHash, uint64_t settingsHash, bool createSubdir) const
+{
+	uint64_t keyParts[2] = { contentHash, settingsHash };
+	uint64_t key = XXH64(keyParts, sizeof(keyParts), 0);
+
+	char subdirName[8];
+	snprintf(subdirName, sizeof(subdirName), "%02x", static_cast<unsigned int>(key >> 56));
+
+	std::string path = m_dirPath + subdirName;
+
+	if (createSubdir)
+		CreateDirectoryIfMissing(path.c_str());
+
+	char entryName[32];
+	snprintf(entryName, sizeof(entryName), "/%016llx.page", static_cast<unsigned long long>(key));
+
+	return path + entryName;
+}
@@ -0,0 +1,56 @@
+/*
+Copyright (c) 2024 Eric Lasota
+
+This software is available under the terms of the MIT license
+or the Apache License, Version 2.0.  For more information, see
+the included LICENSE.txt file.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+// A directory of compressed pages addressed by the page's contents and the settings it was compressed
+// with.  Each entry is a file in a subdirectory named after the first byte of its key.  Entries are
+// written to a uniquely named temporary file and renamed into place, so concurrent builds sharing a
+// directory never see a partial entry.  Entries also carry a second content hash and a hash of their
+// payload, so collisions and damaged files are treated as misses.
+class PageCache
+{
+public:
+	PageCache();
+
+	bool Open(const char *dirPath);
+
+	// Looks up a page.  On a hit, outData receives the compressed page, or is left empty if the page is
+	// stored uncompressed.
+	bool Load(uint64_t contentHash, uint64_t verifyHash, uint64_t settingsHash, size_t uncompressedSize, std::vector<uint8_t> &outData);
+
+	// Adds a page.  A compressed size of zero records that the page is stored uncompressed.  Failures are
+	// ignored, the page is just compressed again next time.
+	void Store(uint64_t contentHash, uint64_t verifyHash, uint64_t settingsHash, size_t uncompressedSize, const void *data, size_t compressedSize);
+
+	uint64_t NumHits() const;
+	uint64_t NumMisses() const;
+
+	// Seed of the verify hash, which must differ from the one used for the content hash
+	static const uint64_t kVerifyHashSeed = 0x47535044u;
+
+private:
+	PageCache(const PageCache &) = delete;
+	PageCache &operator=(const PageCache &) = delete;
+
+	std::string EntryPath(uint64_t contentHash, uint64_t settingsHash, bool createSubdir) const;
+
+	std::string m_dirPath;
+
+	std::atomic<uint64_t> m_numHits;
+	std::atomic<uint64_t> m_numMisses;
+	std::atomic<uint64_t> m_nextTempID;
+	uint64_t m_instanceID;
+};
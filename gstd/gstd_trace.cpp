@@ -0,0 +1,122 @@
+/*
+Copyright (c) 2024 Eric Lasota
+
+This software is available under the terms of the MIT license
+or the Apache License, Version 2.0.  For more information, see
+the included LICENSE.txt file.
+*/
+
+#include "gstd_trace.h"
+
+namespace
+{
+	struct TraceThreadState
+	{
+		uint64_t m_recorderID;
+		void *m_buffer;
+	};
+
+	thread_local TraceThreadState t_traceThreadState = { 0, nullptr };
+}
+
+std::atomic<uint64_t> TraceRecorder::ms_nextRecorderID(1);
+
+TraceRecorder::TraceRecorder()
+	: m_startTime(std::chrono::steady_clock::now()), m_recorderID(ms_nextRecorderID.fetch_add(1)), m_threadBuffers(nullptr), m_numThreads(0)
+{
+}
+
+TraceRecorder::~TraceRecorder()
+{
+	ThreadBuffer *buffer = m_threadBuffers.load(std::memory_order_acquire);
+	while (buffer)
+	{
+		ThreadBuffer *next = buffer->m_next;
+		delete buffer;
+		buffer = next;
+	}
+}
+
+void TraceRecorder::Begin(const char *name)
+{
+	AddEvent(name, true);
+}
+
+void TraceRecorder::End()
+{
+	AddEvent(nullptr, false);
+}
+
+void TraceRecorder::SetThreadName(const char *name)
+{
+	GetThreadBuffer()->m_threadName = name;
+}
+
+TraceRecorder::ThreadBuffer *TraceRecorder::GetThreadBuffer()
+{
+	// The recorder ID is used instead of the recorder address so that a buffer left over from a destroyed
+	// recorder is never reused by a new recorder at the same address
+	if (t_traceThreadState.m_recorderID == m_recorderID)
+		return static_cast<ThreadBuffer *>(t_traceThreadState.m_buffer);
+
+	ThreadBuffer *buffer = new ThreadBuffer();
+	buffer->m_threadID = m_numThreads.fetch_add(1, std::memory_order_relaxed);
+	buffer->m_threadName = nullptr;
+	buffer->m_events.reserve(4096);
+
+	ThreadBuffer *head = m_threadBuffers.load(std::memory_order_relaxed);
+	do
+	{
+		buffer->m_next = head;
+	} while (!m_threadBuffers.compare_exchange_weak(head, buffer, std::memory_order_release, std::memory_order_relaxed));
+
+	t_traceThreadState.m_recorderID = m_recorderID;
+	t_traceThreadState.m_buffer = buffer;
+
+	return buffer;
+}
+
+void TraceRecorder::AddEvent(const char *name, bool isBegin)
+{
+	ThreadBuffer *buffer = GetThreadBuffer();
+
+	Event evt;
+	evt.m_name = name;
+	evt.m_nanoseconds = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_startTime).count());
+	evt.m_isBegin = isBegin;
+
+	buffer->m_events.push_back(evt);
+}
+
+bool TraceRecorder::WriteJSON(FILE *f) const
+{
+	fprintf(f, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+
+	bool isFirstEvent = true;
+
+	for (const ThreadBuffer *buffer = m_threadBuffers.load(std::memory_order_acquire); buffer != nullptr; buffer = buffer->m_next)
+	{
+		if (buffer->m_threadName)
+		{
+			fprintf(f, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"%s\"}}", isFirstEvent ? "" : ",\n", buffer->m_threadID, buffer->m_threadName);
+			isFirstEvent = false;
+		}
+
+		for (const Event &evt : buffer->m_events)
+		{
+			unsigned long long microseconds = static_cast<unsigned long long>(evt.m_nanoseconds / 1000u);
+			unsigned int fraction = static_cast<unsigned int>(evt.m_nanoseconds % 1000u);
+
+			if (evt.m_isBegin)
+				fprintf(f, "%s{\"name\": \"%s\", \"ph\": \"B\", \"pid\": 1, \"tid\": %u, \"ts\": %llu.%03u}", isFirstEvent ? "" : ",\n", evt.m_name, buffer->m_threadID, microseconds, fraction);
+			else
+				fprintf(f, "%s{\"ph\": \"E\", \"pid\": 1, \"tid\": %u, \"ts\": %llu.%03u}", isFirstEvent ? "" : ",\n", buffer->m_threadID, microseconds, fraction);
+
+			isFirstEvent = false;
+		}
+	}
+
+	fprintf(f, "\n]}\n");
+
+	return !ferror(f);
+}
@@ -0,0 +1,108 @@
+/*
+Copyright (c) 2024 Eric Lasota
+
+This software is available under the terms of the MIT license
+or the Apache License, Version 2.0.  For more information, see
+the included LICENSE.txt file.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+// Records begin/end events from any number of threads and writes them as a chrome://tracing JSON file.
+//
+// Each thread appends to its own buffer, so recording never takes a lock.  A thread's buffer is created
+// the first time it records an event and is pushed onto a lock-free list.  Buffers are only read by
+// WriteJSON, which must be called after every recording thread has been joined.
+class TraceRecorder
+{
+public:
+	TraceRecorder();
+	~TraceRecorder();
+
+	// Names must be string literals or otherwise outlive the recorder
+	void Begin(const char *name);
+	void End();
+
+	// Names the calling thread in the trace
+	void SetThreadName(const char *name);
+
+	bool WriteJSON(FILE *f) const;
+
+private:
+	TraceRecorder(const TraceRecorder &) = delete;
+	TraceRecorder &operator=(const TraceRecorder &) = delete;
+
+	struct Event
+	{
+		const char *m_name;
+		uint64_t m_nanoseconds;
+		bool m_isBegin;
+	};
+
+	struct ThreadBuffer
+	{
+		ThreadBuffer *m_next;
+		uint32_t m_threadID;
+		const char *m_threadName;
+		std::vector<Event> m_events;
+	};
+
+	ThreadBuffer *GetThreadBuffer();
+	void AddEvent(const char *name, bool isBegin);
+
+	std::chrono::steady_clock::time_point m_startTime;
+	uint64_t m_recorderID;
+
+	std::atomic<ThreadBuffer *> m_threadBuffers;
+	std::atomic<uint32_t> m_numThreads;
+
+	static std::atomic<uint64_t> ms_nextRecorderID;
+};
+
+// Null-tolerant versions of Begin and End for regions that don't fit a TraceScope
+inline void TraceBegin(TraceRecorder *recorder, const char *name)
+{
+	if (recorder)
+		recorder->Begin(name);
+}
+
+inline void TraceEnd(TraceRecorder *recorder)
+{
+	if (recorder)
+		recorder->End();
+}
+
+// Records a begin event on construction and an end event on destruction, does nothing if the recorder
+// is null
+class TraceScope
+{
+public:
+	TraceScope(TraceRecorder *recorder, const char *name);
+	~TraceScope();
+
+private:
+	TraceScope(const TraceScope &) = delete;
+	TraceScope &operator=(const TraceScope &) = delete;
+
+	TraceRecorder *m_recorder;
+};
+
+inline TraceScope::TraceScope(TraceRecorder *recorder, const char *name)
+	: m_recorder(recorder)
+{
+	if (recorder)
+		recorder->Begin(name);
+}
+
+inline TraceScope::~TraceScope()
+{
+	if (m_recorder)
+		m_recorder->End();
+}
@@ -0,0 +1,251 @@
+/*
+Copyright (c) 2024 Eric Lasota
+
+This software is available under the terms of the MIT license
+or the Apache License, Version 2.0.  For more information, see
+the included LICENSE.txt file.
+*/
+
+#include "gstddec_cpu.h"
+#include "gstd_crc32.h"
+
+#include <string.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	struct BatchState
+	{
+		gstd_BatchPage_t *m_pages;
+		size_t m_numPages;
+		uint32_t m_flags;
+
+		void *m_warnContext;
+		gstd_BatchWarnCallback_t m_warnCallback;
+
+		std::atomic<size_t> m_nextPage;
+		std::atomic<size_t> m_numFailed;
+	};
+
+	struct PageWarnContext
+	{
+		BatchState *m_batch;
+		size_t m_pageIndex;
+	};
+
+	void BatchPageWarn(void *context, const char *msg)
+	{
+		PageWarnContext *warnContext = static_cast<PageWarnContext *>(context);
+		BatchState *batch = warnContext->m_batch;
+
+		batch->m_pages[warnContext->m_pageIndex].m_numWarnings++;
+
+		if (batch->m_warnCallback)
+			batch->m_warnCallback(batch->m_warnContext, warnContext->m_pageIndex, msg);
+	}
+
+	gstd_PageStatus_t DecompressBatchPage(BatchState *batch, size_t pageIndex)
+	{
+		gstd_BatchPage_t &page = batch->m_pages[pageIndex];
+
+		page.m_numWarnings = 0;
+		page.m_actualCRC = 0;
+
+		if (page.m_perfCounters)
+			memset(page.m_perfCounters, 0, sizeof(gstd_PerfCounters_t));
+
+		if (page.m_inSize > page.m_uncompressedSize || page.m_inSize == 0 || page.m_outData == nullptr || page.m_inData == nullptr)
+			return GSTD_PAGE_STATUS_INVALID_PARAMETERS;
+
+		if (page.m_inSize == page.m_uncompressedSize)
+			memcpy(page.m_outData, page.m_inData, page.m_uncompressedSize);
+		else
+		{
+			if ((reinterpret_cast<uintptr_t>(page.m_inData) & 3) != 0 || (reinterpret_cast<uintptr_t>(page.m_outData) & 3) != 0)
+				return GSTD_PAGE_STATUS_INVALID_PARAMETERS;
+
+			uint32_t paddedOutSize = (page.m_uncompressedSize + 3u) & ~static_cast<uint32_t>(3u);
+
+			// The decoder ORs bytes into the output, so the slot must start out cleared
+			memset(page.m_outData, 0, paddedOutSize);
+
+			PageWarnContext warnContext;
+			warnContext.m_batch = batch;
+			warnContext.m_pageIndex = pageIndex;
+
+			uint32_t numLanes = (page.m_numLanes == 0) ? 32 : page.m_numLanes;
+
+			if (!DecompressGstdCPULanes(page.m_inData, page.m_inSize, page.m_outData, paddedOutSize, numLanes, batch->m_flags, page.m_perfCounters, &warnContext, BatchPageWarn, nullptr, nullptr))
+				return GSTD_PAGE_STATUS_INVALID_PARAMETERS;
+		}
+
+		page.m_actualCRC = crc32(0, page.m_outData, page.m_uncompressedSize);
+
+		if (page.m_numWarnings > 0)
+			return GSTD_PAGE_STATUS_DECODE_WARNING;
+
+		if (page.m_actualCRC != page.m_expectedCRC)
+			return GSTD_PAGE_STATUS_CRC_MISMATCH;
+
+		return GSTD_PAGE_STATUS_OK;
+	}
+
+	void RunBatchWorker(BatchState *batch)
+	{
+		size_t numFailed = 0;
+
+		for (;;)
+		{
+			size_t pageIndex = batch->m_nextPage.fetch_add(1, std::memory_order_relaxed);
+			if (pageIndex >= batch->m_numPages)
+				break;
+
+			gstd_PageStatus_t status = DecompressBatchPage(batch, pageIndex);
+			batch->m_pages[pageIndex].m_status = status;
+
+			if (status != GSTD_PAGE_STATUS_OK)
+				numFailed++;
+		}
+
+		batch->m_numFailed.fetch_add(numFailed, std::memory_order_relaxed);
+	}
+}
+
+struct gstd_BatchContext
+{
+	gstd_BatchContext();
+
+	void RunHelper();
+
+	std::mutex m_mutex;
+	std::condition_variable m_batchPostedEvent;
+	std::condition_variable m_batchDoneEvent;
+
+	std::vector<std::thread> m_helperThreads;
+
+	// Helpers run a batch when the serial changes, then the submitting thread waits for all of them to
+	// check back in before the batch state goes out of scope
+	BatchState *m_batch;
+	uint64_t m_batchSerial;
+	size_t m_numBusyHelpers;
+	bool m_terminated;
+};
+
+gstd_BatchContext::gstd_BatchContext()
+	: m_batch(nullptr), m_batchSerial(0), m_numBusyHelpers(0), m_terminated(false)
+{
+}
+
+void gstd_BatchContext::RunHelper()
+{
+	uint64_t lastBatchSerial = 0;
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	for (;;)
+	{
+		m_batchPostedEvent.wait(lock, [this, lastBatchSerial] { return m_terminated || m_batchSerial != lastBatchSerial; });
+
+		if (m_terminated)
+			return;
+
+		lastBatchSerial = m_batchSerial;
+		BatchState *batch = m_batch;
+
+		lock.unlock();
+		RunBatchWorker(batch);
+		lock.lock();
+
+		m_numBusyHelpers--;
+		if (m_numBusyHelpers == 0)
+			m_batchDoneEvent.notify_one();
+	}
+}
+
+gstd_BatchContext_t *gstd_CreateBatchContext(unsigned int numThreads)
+{
+	gstd_BatchContext_t *context = new gstd_BatchContext_t();
+
+	if (numThreads > 1)
+	{
+		context->m_helperThreads.reserve(numThreads - 1u);
+		for (unsigned int i = 1; i < numThreads; i++)
+			context->m_helperThreads.emplace_back(&gstd_BatchContext::RunHelper, context);
+	}
+
+	return context;
+}
+
+void gstd_DestroyBatchContext(gstd_BatchContext_t *context)
+{
+	{
+		std::lock_guard<std::mutex> lock(context->m_mutex);
+		context->m_terminated = true;
+	}
+
+	context->m_batchPostedEvent.notify_all();
+
+	for (std::thread &thread : context->m_helperThreads)
+		thread.join();
+
+	delete context;
+}
+
+size_t gstd_DecompressBatchWithContext(gstd_BatchContext_t *context, gstd_BatchPage_t *pages, size_t numPages, uint32_t flags, void *warnContext, gstd_BatchWarnCallback_t warnCallback)
+{
+	BatchState batch;
+	batch.m_pages = pages;
+	batch.m_numPages = numPages;
+	batch.m_flags = flags;
+	batch.m_warnContext = warnContext;
+	batch.m_warnCallback = warnCallback;
+	batch.m_nextPage = 0;
+	batch.m_numFailed = 0;
+
+	for (size_t i = 0; i < numPages; i++)
+		pages[i].m_status = GSTD_PAGE_STATUS_NOT_DECODED;
+
+	// Helpers are woken once per batch and pull pages until the batch is drained, so the calling thread
+	// counts as one of the workers.  A single page isn't worth waking anyone for.
+	bool useHelpers = (numPages > 1 && !context->m_helperThreads.empty());
+
+	if (useHelpers)
+	{
+		{
+			std::lock_guard<std::mutex> lock(context->m_mutex);
+			context->m_batch = &batch;
+			context->m_batchSerial++;
+			context->m_numBusyHelpers = context->m_helperThreads.size();
+		}
+
+		context->m_batchPostedEvent.notify_all();
+	}
+
+	RunBatchWorker(&batch);
+
+	if (useHelpers)
+	{
+		std::unique_lock<std::mutex> lock(context->m_mutex);
+		context->m_batchDoneEvent.wait(lock, [context] { return context->m_numBusyHelpers == 0; });
+		context->m_batch = nullptr;
+	}
+
+	return batch.m_numFailed.load();
+}
+
+size_t gstd_DecompressBatch(gstd_BatchPage_t *pages, size_t numPages, unsigned int numThreads, uint32_t flags, void *warnContext, gstd_BatchWarnCallback_t warnCallback)
+{
+	if (numThreads > numPages)
+		numThreads = static_cast<unsigned int>(numPages);
+
+	gstd_BatchContext_t *context = gstd_CreateBatchContext(numThreads);
+	size_t numFailed = gstd_DecompressBatchWithContext(context, pages, numPages, flags, warnContext, warnCallback);
+	gstd_DestroyBatchContext(context);
+
+	return numFailed;
+}
@@ -0,0 +1,137 @@
+/*
+Copyright (c) 2024 Eric Lasota
+
+This software is available under the terms of the MIT license
+or the Apache License, Version 2.0.  For more information, see
+the included LICENSE.txt file.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef void (*gstd_WarnCallback_t)(void *context, const char *msg);
+typedef void (*gstd_DiagCallback_t)(void *context, const char *fmt, ...);
+
+// The input is followed by at least GSTD_DECOMPRESS_INPUT_PADDING readable zero bytes, which allows
+// the decoder to skip per-lane bounds checks.  The output needs no padding beyond rounding up to 4 bytes.
+#define GSTD_DECOMPRESS_FLAG_PADDED_BUFFERS	1
+
+#define GSTD_DECOMPRESS_INPUT_PADDING		256
+
+#define GSTD_PERF_MAX_LANES	64
+
+typedef enum gstd_PerfPhase
+{
+	GSTD_PERF_PHASE_LIT_TABLE,		// Huffman tree decode and decode table expansion
+	GSTD_PERF_PHASE_FSE_TABLES,
+	GSTD_PERF_PHASE_SEQUENCES,		// Sequence decode lane passes, not including their execution
+	GSTD_PERF_PHASE_EXECUTE,		// Literal emission and match copies, timed per batch of sequences
+
+	GSTD_PERF_PHASE_COUNT,
+} gstd_PerfPhase_t;
+
+typedef enum gstd_PerfOffsetClass
+{
+	GSTD_PERF_OFFSET_CLASS_UNDER_16,
+	GSTD_PERF_OFFSET_CLASS_UNDER_256,
+	GSTD_PERF_OFFSET_CLASS_UNDER_4K,
+	GSTD_PERF_OFFSET_CLASS_UNDER_64K,
+	GSTD_PERF_OFFSET_CLASS_FAR,
+
+	GSTD_PERF_OFFSET_CLASS_COUNT,
+} gstd_PerfOffsetClass_t;
+
+// Loops that run one iteration at a time regardless of the lane count
+typedef enum gstd_PerfSerialStep
+{
+	GSTD_PERF_SERIAL_STEP_SEQUENCE_EXECUTE,		// One per sequence, covers its literal emit and match copy
+	GSTD_PERF_SERIAL_STEP_HUFFMAN_BROADCAST,	// One per symbol broadcast into the Huffman decode table
+	GSTD_PERF_SERIAL_STEP_HUFFMAN_SCATTER,		// One per table entry written by the Huffman scatter fill
+
+	GSTD_PERF_SERIAL_STEP_COUNT,
+} gstd_PerfSerialStep_t;
+
+// Decoder hot-path counters.  These are only collected if the decoder is built with
+// GSTDDEC_PERF_COUNTERS, otherwise the structure is zero-filled.
+typedef struct gstd_PerfCounters
+{
+	uint32_t m_enabled;
+	uint32_t m_vectorWidth;
+
+	uint64_t m_refillsPerLane[GSTD_PERF_MAX_LANES];		// Bitstream dwords loaded by each format lane
+	uint64_t m_laneDecodeSteps;						// Vector literal and sequence decode steps
+	uint64_t m_laneDecodeActiveLanes;				// Sum of active lanes over all decode steps
+
+	uint64_t m_huffmanLiterals;
+	uint64_t m_rawLiterals;
+	uint64_t m_rleLiterals;
+
+	uint64_t m_matches;
+	uint64_t m_matchBytesByOffsetClass[GSTD_PERF_OFFSET_CLASS_COUNT];
+
+	uint32_t m_huffmanTableBuilds;
+	uint32_t m_fseTableBuilds;
+
+	uint64_t m_phaseNanoseconds[GSTD_PERF_PHASE_COUNT];
+
+	// Lane utilization.  A vector region is a GSTDDEC_VECTOR_IF or else branch, measured against the
+	// vector width.  Regions with no active lanes are counted separately since a GPU branches around them.
+	uint64_t m_vectorRegions;
+	uint64_t m_vectorRegionActiveLanes;
+	uint64_t m_vectorRegionsSkipped;
+	uint64_t m_refillSteps;							// Bitstream refills with at least one lane loading
+	uint64_t m_serialSteps[GSTD_PERF_SERIAL_STEP_COUNT];
+} gstd_PerfCounters_t;
+
+// Decompresses a single Gstd page.  Output must be zero-filled before calling.  perfCounters may be null.
+void DecompressGstdCPU32(const void *inData, uint32_t inSize, void *outData, uint32_t outCapacity, uint32_t flags, gstd_PerfCounters_t *perfCounters, void *warnContext, gstd_WarnCallback_t warnCallback, void *diagContext, gstd_DiagCallback_t diagCallback);
+
+// Same as DecompressGstdCPU32 for a page encoded with a parallelism level of 8, 16, 32 or 64 lanes.
+// Returns 0 without decoding anything if the lane count is not supported.
+int DecompressGstdCPULanes(const void *inData, uint32_t inSize, void *outData, uint32_t outCapacity, uint32_t numLanes, uint32_t flags, gstd_PerfCounters_t *perfCounters, void *warnContext, gstd_WarnCallback_t warnCallback, void *diagContext, gstd_DiagCallback_t diagCallback);
+
+typedef enum gstd_PageStatus
+{
+	GSTD_PAGE_STATUS_OK,
+	GSTD_PAGE_STATUS_NOT_DECODED,
+	GSTD_PAGE_STATUS_INVALID_PARAMETERS,
+	GSTD_PAGE_STATUS_DECODE_WARNING,
+	GSTD_PAGE_STATUS_CRC_MISMATCH,
+} gstd_PageStatus_t;
+
+typedef struct gstd_BatchPage
+{
+	// Inputs
+	const void *m_inData;			// Compressed page, must be 4-byte aligned and padded if GSTD_DECOMPRESS_FLAG_PADDED_BUFFERS is used
+	uint32_t m_inSize;				// If equal to m_uncompressedSize, the page is stored
+	void *m_outData;				// Must be 4-byte aligned and hold m_uncompressedSize rounded up to a multiple of 4
+	uint32_t m_uncompressedSize;
+	uint32_t m_expectedCRC;
+	uint32_t m_numLanes;			// Parallelism level the page was encoded with, 0 is treated as 32
+	gstd_PerfCounters_t *m_perfCounters;	// Optional
+
+	// Outputs
+	gstd_PageStatus_t m_status;
+	uint32_t m_actualCRC;
+	uint32_t m_numWarnings;
+} gstd_BatchPage_t;
+
+typedef void (*gstd_BatchWarnCallback_t)(void *context, size_t pageIndex, const char *msg);
+
+// Owns numThreads - 1 helper threads that sleep between batches, so submitting a batch only wakes them
+typedef struct gstd_BatchContext gstd_BatchContext_t;
+
+gstd_BatchContext_t *gstd_CreateBatchContext(unsigned int numThreads);
+void gstd_DestroyBatchContext(gstd_BatchContext_t *context);
+
+// Decompresses a batch of pages, fanning them out over the context's helper threads and the calling
+// thread.  Pages are decoded directly into their output slots.  Returns the number of pages whose status
+// is not GSTD_PAGE_STATUS_OK.  flags are passed through to the page decoder.  A context runs one batch at
+// a time, so batches must not be submitted to the same context from several threads at once.
+size_t gstd_DecompressBatchWithContext(gstd_BatchContext_t *context, gstd_BatchPage_t *pages, size_t numPages, uint32_t flags, void *warnContext, gstd_BatchWarnCallback_t warnCallback);
+
+// Same as gstd_DecompressBatchWithContext, but starts and stops up to numThreads - 1 helper threads for
+// this batch alone.  Callers that submit batches repeatedly should keep a context instead.
+size_t gstd_DecompressBatch(gstd_BatchPage_t *pages, size_t numPages, unsigned int numThreads, uint32_t flags, void *warnContext, gstd_BatchWarnCallback_t warnCallback);
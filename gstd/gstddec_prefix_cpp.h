@@ -8,21 +8,26 @@ the included LICENSE.txt file.
 
 #ifdef __cplusplus
 
+#ifndef GSTDDEC_PERF_COUNTERS
+#define GSTDDEC_PERF_COUNTERS		0
+#endif
+
 #define GSTDDEC_FORMAT_WIDTH		TFormatWidth
 #define GSTDDEC_VECTOR_WIDTH		TVectorWidth
 
 #include "gstddec_proto_cpp.h"
 
 
-#define GSTDDEC_FUNCTION_PREFIX	template<unsigned int TVectorWidth, unsigned int TFormatWidth>
+#define GSTDDEC_FUNCTION_PREFIX	template<unsigned int TVectorWidth, unsigned int TFormatWidth, bool TPaddedBuffers>
 
-#define GSTDDEC_FUNCTION_CONTEXT gstddec::DecompressorContext<TVectorWidth, TFormatWidth>::
-#define GSTDDEC_TYPE_CONTEXT typename gstddec::DecompressorContext<TVectorWidth, TFormatWidth>::
+#define GSTDDEC_FUNCTION_CONTEXT gstddec::DecompressorContext<TVectorWidth, TFormatWidth, TPaddedBuffers>::
+#define GSTDDEC_TYPE_CONTEXT typename gstddec::DecompressorContext<TVectorWidth, TFormatWidth, TPaddedBuffers>::
 
 #define GSTDDEC_READ_CONSTANT(constName)	(this->m_constants.constName)
 
 #define GSTDDEC_READ_INPUT_DWORD(pos) (this->ReadInputDWord(pos))
 #define GSTDDEC_CONDITIONAL_READ_INPUT_DWORD(pos) (this->ReadInputDWord(executionMask, pos))
+#define GSTDDEC_CONDITIONAL_EXPAND_READ_INPUT_DWORDS(pos) (this->ExpandReadInputDWords(executionMask, pos))
 #define GSTDDEC_CONDITIONAL_READ_OUTPUT_DWORD(pos) (this->ReadOutputDWord(executionMask, pos))
 
 #define GSTDDEC_VECTOR_UINT32(fillValue) (vuint32_t(fillValue))
@@ -40,22 +45,44 @@ the included LICENSE.txt file.
 #define GSTDDEC_VECTOR_READ_FROM_INDEX(n, index) (WaveReadLaneAt((n), (index)))
 
 #define GSTDDEC_WARN(msg) do { if (m_warnCallback != nullptr) m_warnCallback(m_warnContext, (msg));  } while (false)
+#if GSTDDEC_PERF_COUNTERS
+#define GSTDDEC_PERF_COUNT_REFILLS(vvecIndex) PerfCountRefills((vvecIndex), executionMask)
+#define GSTDDEC_PERF_COUNT_LANE_DECODE(numActiveLanes) PerfCountLaneDecode(numActiveLanes)
+#define GSTDDEC_PERF_COUNT_LITERALS(litSectionType, numLiterals) PerfCountLiterals((litSectionType), (numLiterals))
+#define GSTDDEC_PERF_COUNT_MATCH(matchLength, matchOffset) PerfCountMatch((matchLength), (matchOffset))
+#define GSTDDEC_PERF_COUNT_TABLE_BUILD(counter) (this->m_perf.counter++)
+#define GSTDDEC_PERF_ENTER_PHASE(phase) PerfEnterPhase(phase)
+#define GSTDDEC_PERF_EXIT_PHASE PerfExitPhase()
+#define GSTDDEC_PERF_COUNT_VECTOR_REGION PerfCountVectorRegion(executionMask)
+#define GSTDDEC_PERF_COUNT_SERIAL_STEP(step) (this->m_perf.m_serialSteps[step]++)
+#else
+#define GSTDDEC_PERF_COUNT_REFILLS(vvecIndex) ((void)0)
+#define GSTDDEC_PERF_COUNT_LANE_DECODE(numActiveLanes) ((void)0)
+#define GSTDDEC_PERF_COUNT_LITERALS(litSectionType, numLiterals) ((void)0)
+#define GSTDDEC_PERF_COUNT_MATCH(matchLength, matchOffset) ((void)0)
+#define GSTDDEC_PERF_COUNT_TABLE_BUILD(counter) ((void)0)
+#define GSTDDEC_PERF_ENTER_PHASE(phase) ((void)0)
+#define GSTDDEC_PERF_EXIT_PHASE ((void)0)
+#define GSTDDEC_PERF_COUNT_VECTOR_REGION ((void)0)
+#define GSTDDEC_PERF_COUNT_SERIAL_STEP(step) ((void)0)
+#endif
+
 #define GSTDDEC_DIAGNOSTIC(fmt, ...) do { if (m_diagCallback != nullptr) m_diagCallback(m_diagContext, (fmt), __VA_ARGS__);  } while (false)
 
 #define GSTDDEC_PARAM_INOUT(type, name) type &name
 #define GSTDDEC_PARAM_OUT(type, name) type &name
 #define GSTDDEC_PARAM_EXECUTION_MASK vbool_t executionMask,
 
-#define GSTDDEC_VECTOR_IF(condition) do { vbool_t executionMask = (condition);
-#define GSTDDEC_VECTOR_ELSE executionMask = ~executionMask;
+#define GSTDDEC_VECTOR_IF(condition) do { vbool_t executionMask = (condition); GSTDDEC_PERF_COUNT_VECTOR_REGION;
+#define GSTDDEC_VECTOR_ELSE executionMask = ~executionMask; GSTDDEC_PERF_COUNT_VECTOR_REGION;
 #define GSTDDEC_VECTOR_END_IF } while (false);
 
 #define GSTDDEC_VECTOR_LOGICAL_OR(l, r)  ((l) | (r))
 #define GSTDDEC_VECTOR_LOGICAL_AND(l, r) ((l) & (r))
 
 
-#define GSTDDEC_VECTOR_IF_NESTED(condition) do { vbool_t outerExecutionMask = executionMask; { vbool_t executionMask = outerExecutionMask & (condition);
-#define GSTDDEC_VECTOR_ELSE_NESTED executionMask = ((~executionMask) & outerExecutionMask);
+#define GSTDDEC_VECTOR_IF_NESTED(condition) do { vbool_t outerExecutionMask = executionMask; { vbool_t executionMask = outerExecutionMask & (condition); GSTDDEC_PERF_COUNT_VECTOR_REGION;
+#define GSTDDEC_VECTOR_ELSE_NESTED executionMask = ((~executionMask) & outerExecutionMask); GSTDDEC_PERF_COUNT_VECTOR_REGION;
 #define GSTDDEC_VECTOR_END_IF_NESTED } } while(false);
 
 #define GSTDDEC_BRANCH_HINT
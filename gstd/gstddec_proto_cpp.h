@@ -7,11 +7,19 @@ the included LICENSE.txt file.
 */
 
 #include <stdint.h>
+#include <string.h>
 
-namespace gstddec
-{
+#include "gstddec_simd_cpp.h"
+#include "gstddec_cpu.h"
+
+#if GSTDDEC_PERF_COUNTERS
+#include <chrono>
+#endif
+
+GSTDDEC_NAMESPACE_BEGIN
 	template<unsigned int TWidth> class VectorBool;
 	template<class TNumber, unsigned int TWidth> class VectorUInt;
+	template<unsigned int TVectorWidth, unsigned int TFormatWidth, bool TPaddedBuffers> class DecompressorKernelBench;
 
 	template<class TNumber, unsigned int TWidth>
 	class VectorUInt
@@ -44,6 +52,9 @@ namespace gstddec
 		void Set(unsigned int index, const TNumber &value);
 		const TNumber &Get(unsigned int index) const;
 
+		TNumber *GetValues();
+		const TNumber *GetValues() const;
+
 	private:
 		TNumber m_values[TWidth];
 	};
@@ -63,11 +74,15 @@ namespace gstddec
 		void Set(unsigned int index, bool value);
 		bool Get(unsigned int index) const;
 
+		const bool *GetValues() const;
+
 	private:
 		bool m_values[TWidth];
 	};
 
-	template<unsigned int TVectorWidth, unsigned int TFormatWidth>
+	// If TPaddedBuffers is set, the input buffer is followed by at least GSTD_DECOMPRESS_INPUT_PADDING
+	// zero bytes and per-lane bounds checks are skipped.
+	template<unsigned int TVectorWidth, unsigned int TFormatWidth, bool TPaddedBuffers>
 	class DecompressorContext
 	{
 	public:
@@ -85,7 +100,12 @@ namespace gstddec
 
 		void Run(vuint32_t laneIndex);
 
+		void GetPerfCounters(gstd_PerfCounters_t &outCounters) const;
+
 	private:
+		// Drives individual kernel routines on synthetic state, see gstd_bench_kernels_backend.cpp
+		friend class DecompressorKernelBench<TVectorWidth, TFormatWidth, TPaddedBuffers>;
+
 		struct Constants
 		{
 			uint32_t InSizeDWords;
@@ -95,13 +115,14 @@ namespace gstddec
 		vuint32_t ReadInputDWord(vbool_t executionMask, vuint32_t dwordPos) const;
 		vuint32_t ReadInputDWord(const vuint32_t &dwordPos) const;
 		uint32_t ReadInputDWord(uint32_t dwordPos) const;
+		vuint32_t ExpandReadInputDWords(vbool_t executionMask, uint32_t dwordPos) const;
 		uint32_t ReadOutputDWord(uint32_t dwordPos) const;
 		vuint32_t ReadOutputDWord(vbool_t executionMask, vuint32_t dwordPos) const;
 		void PutOutputDWord(const vuint32_t &dwordPos, const vuint32_t &dword) const;
 		void PutOutputDWord(uint32_t dwordPos, uint32_t dword) const;
 		void InterlockedOrOutputDWord(vbool_t executionMask, const vuint32_t &dwordPos, const vuint32_t &dword) const;
 
-		static vuint32_t FastFillAscending(vuint32_t value, uint32_t &runningValue);
+		vuint32_t FastFillAscending(vuint32_t value, uint32_t &runningValue);
 
 		static void ConditionalStoreVector(vbool_t executionMask, uint32_t *storage, vuint32_t index, vuint32_t value);
 		static void ConditionalStore(vbool_t executionMask, vbool_t &storage, vbool_t value);
@@ -154,6 +175,8 @@ namespace gstddec
 		vuint32_t DecodeFSEValueNoPeek(uint32_t numLanesToRefill, uint32_t vvecIndex, uint32_t accuracyLog, uint32_t firstCell);
 
 		uint32_t ReadRawByte();
+		uint32_t ClampedReadPos() const;
+		uint32_t ClampOutputRunLength(uint32_t length);
 
 		static vuint32_t WavePrefixSum(vuint32_t value);
 		static uint32_t WaveMax(vuint32_t value);
@@ -178,6 +201,16 @@ namespace gstddec
 		static uint32_t ReverseBits(uint32_t value);
 		static vuint32_t LaneIndex();
 
+#if GSTDDEC_PERF_COUNTERS
+		void PerfCountRefills(uint32_t vvecIndex, vbool_t refillMask);
+		void PerfCountLaneDecode(uint32_t numActiveLanes);
+		void PerfCountLiterals(uint32_t litSectionType, uint32_t numLiterals);
+		void PerfCountMatch(uint32_t matchLength, uint32_t matchOffset);
+		void PerfCountVectorRegion(vbool_t executionMask);
+		void PerfEnterPhase(gstd_PerfPhase_t phase);
+		void PerfExitPhase();
+#endif
+
 		const uint32_t *m_inData;
 		uint32_t m_inSize;
 		uint32_t *m_outData;
@@ -194,6 +227,15 @@ namespace gstddec
 		GroupSharedDecompressorState gs_decompressorState;
 		DecompressorState g_dstate;
 
+#if GSTDDEC_PERF_COUNTERS
+		static const unsigned int kMaxPerfPhaseDepth = 8;
+
+		gstd_PerfCounters_t m_perf;
+		gstd_PerfPhase_t m_perfPhaseStack[kMaxPerfPhaseDepth];
+		unsigned int m_perfPhaseDepth;
+		std::chrono::steady_clock::time_point m_perfPhaseStartTime;
+#endif
+
 		struct HuffmanCodesDebug
 		{
 			uint8_t m_symbol;
@@ -203,12 +245,19 @@ namespace gstddec
 		HuffmanCodesDebug m_huffmanDebug[1 << GSTD_MAX_HUFFMAN_CODE_LENGTH];
 	};
 
-	template<unsigned int TVectorWidth, unsigned int TFormatWidth>
-	DecompressorContext<TVectorWidth, TFormatWidth>::DecompressorContext(const uint32_t *inData, uint32_t inSize, uint32_t *outData, uint32_t outSize, void *warnContext, WarnCallback_t warnCallback, void *diagContext, DiagCallback_t diagCallback)
+	template<unsigned int TVectorWidth, unsigned int TFormatWidth, bool TPaddedBuffers>
+	DecompressorContext<TVectorWidth, TFormatWidth, TPaddedBuffers>::DecompressorContext(const uint32_t *inData, uint32_t inSize, uint32_t *outData, uint32_t outSize, void *warnContext, WarnCallback_t warnCallback, void *diagContext, DiagCallback_t diagCallback)
 		: m_inData(inData), m_inSize(inSize / 4), m_outData(outData), m_outSize(outSize / 4), m_warnContext(warnContext), m_warnCallback(warnCallback), m_diagContext(diagContext), m_diagCallback(diagCallback)
 	{
 		m_constants.InSizeDWords = m_inSize;
 		m_constants.OutSizeDWords = m_outSize;
+
+#if GSTDDEC_PERF_COUNTERS
+		memset(&m_perf, 0, sizeof(m_perf));
+		m_perf.m_enabled = 1;
+		m_perf.m_vectorWidth = TVectorWidth;
+		m_perfPhaseDepth = 0;
+#endif
 	}
 
 	template<unsigned int TWidth>
@@ -270,6 +319,12 @@ namespace gstddec
 		return m_values[index];
 	}
 
+	template<unsigned int TWidth>
+	const bool *VectorBool<TWidth>::GetValues() const
+	{
+		return m_values;
+	}
+
 	template<class TNumber, unsigned int TWidth>
 	VectorUInt<TNumber, TWidth>::VectorUInt(const TNumber &value)
 	{
@@ -332,8 +387,10 @@ namespace gstddec
 	{
 		VectorUInt<TNumber, TWidth> result;
 
+		// Shifting by the full width or more produces zero, as variable shifts do in SIMD instruction sets.
+		// Lanes that are masked off can compute shift amounts that large.
 		for (unsigned int i = 0; i < TWidth; i++)
-			result.m_values[i] = m_values[i] >> other.Get(i);
+			result.m_values[i] = (other.Get(i) < sizeof(TNumber) * 8u) ? (m_values[i] >> other.Get(i)) : 0;
 
 		return result;
 	}
@@ -344,8 +401,9 @@ namespace gstddec
 	{
 		VectorUInt<TNumber, TWidth> result;
 
+		// Shifting by the full width or more produces zero, the same as operator>>
 		for (unsigned int i = 0; i < TWidth; i++)
-			result.m_values[i] = m_values[i] << other.Get(i);
+			result.m_values[i] = (other.Get(i) < sizeof(TNumber) * 8u) ? (m_values[i] << other.Get(i)) : 0;
 
 		return result;
 	}
@@ -471,4 +529,16 @@ namespace gstddec
 	{
 		return m_values[index];
 	}
-}
+
+	template<class TNumber, unsigned int TWidth>
+	TNumber *VectorUInt<TNumber, TWidth>::GetValues()
+	{
+		return m_values;
+	}
+
+	template<class TNumber, unsigned int TWidth>
+	const TNumber *VectorUInt<TNumber, TWidth>::GetValues() const
+	{
+		return m_values;
+	}
+GSTDDEC_NAMESPACE_END
@@ -0,0 +1,309 @@
+/*
+Copyright (c) 2024 Eric Lasota
+
+This software is available under the terms of the MIT license
+or the Apache License, Version 2.0.  For more information, see
+the included LICENSE.txt file.
+*/
+
+#pragma once
+
+// Instruction set specializations for the CPU decoder.  The backend is picked from the compiler's target
+// flags (e.g. /arch:AVX2, -mavx512f) and everything falls back to plain C++ otherwise.
+
+#include <stdint.h>
+
+#if defined(__AVX512F__) && defined(__AVX512VL__)
+#define GSTDDEC_CPU_SIMD_AVX512		1
+#else
+#define GSTDDEC_CPU_SIMD_AVX512		0
+#endif
+
+#if GSTDDEC_CPU_SIMD_AVX512 && defined(__AVX512CD__)
+#define GSTDDEC_CPU_SIMD_AVX512CD	1
+#else
+#define GSTDDEC_CPU_SIMD_AVX512CD	0
+#endif
+
+#if defined(__AVX2__)
+#define GSTDDEC_CPU_SIMD_AVX2		1
+#else
+#define GSTDDEC_CPU_SIMD_AVX2		0
+#endif
+
+#if GSTDDEC_CPU_SIMD_AVX512 || GSTDDEC_CPU_SIMD_AVX2
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// The decoder's types are declared in an inline namespace named after the backend, so translation units
+// built for different instruction sets can be linked together without their instantiations colliding
+#if GSTDDEC_CPU_SIMD_AVX512
+#define GSTDDEC_BACKEND_NAMESPACE	avx512
+#elif GSTDDEC_CPU_SIMD_AVX2
+#define GSTDDEC_BACKEND_NAMESPACE	avx2
+#else
+#define GSTDDEC_BACKEND_NAMESPACE	portable
+#endif
+
+#define GSTDDEC_NAMESPACE_BEGIN	namespace gstddec { inline namespace GSTDDEC_BACKEND_NAMESPACE {
+#define GSTDDEC_NAMESPACE_END	} }
+
+GSTDDEC_NAMESPACE_BEGIN
+	namespace simd
+	{
+		static_assert(sizeof(bool) == 1, "Lane masks are read as bytes");
+
+		inline uint32_t PopCount(uint32_t value)
+		{
+#if defined(_MSC_VER)
+			return __popcnt(value);
+#elif defined(__GNUC__)
+			return static_cast<uint32_t>(__builtin_popcount(value));
+#else
+			value = value - ((value >> 1) & 0x55555555u);
+			value = (value & 0x33333333u) + ((value >> 2) & 0x33333333u);
+			return (((value + (value >> 4)) & 0x0f0f0f0fu) * 0x01010101u) >> 24;
+#endif
+		}
+
+		// Returns 0 for 0, otherwise the index of the highest set bit plus one
+		inline uint32_t FirstBitHighPlusOne(uint32_t value)
+		{
+			if (value == 0)
+				return 0;
+
+#if defined(_MSC_VER) && defined(__AVX2__)
+			return 32u - _lzcnt_u32(value);
+#elif defined(_MSC_VER)
+			unsigned long index = 0;
+			_BitScanReverse(&index, value);
+			return static_cast<uint32_t>(index) + 1u;
+#else
+			return 32u - static_cast<uint32_t>(__builtin_clz(value));
+#endif
+		}
+
+		// Returns 1 for 0, otherwise the index of the lowest set bit plus one
+		inline uint32_t FirstBitLowPlusOne(uint32_t value)
+		{
+			if (value == 0)
+				return 1;
+
+#if defined(_MSC_VER) && defined(__AVX2__)
+			return _tzcnt_u32(value) + 1u;
+#elif defined(_MSC_VER)
+			unsigned long index = 0;
+			_BitScanForward(&index, value);
+			return static_cast<uint32_t>(index) + 1u;
+#else
+			return static_cast<uint32_t>(__builtin_ctz(value)) + 1u;
+#endif
+		}
+
+		inline uint32_t ReverseBits(uint32_t value)
+		{
+#if defined(_MSC_VER)
+			value = _byteswap_ulong(value);
+#else
+			value = __builtin_bswap32(value);
+#endif
+			value = ((value << 4) & 0xf0f0f0f0u) | ((value >> 4) & 0x0f0f0f0fu);
+			value = ((value << 2) & 0xccccccccu) | ((value >> 2) & 0x33333333u);
+			value = ((value << 1) & 0xaaaaaaaau) | ((value >> 1) & 0x55555555u);
+
+			return value;
+		}
+
+#if GSTDDEC_CPU_SIMD_AVX2
+		// Highest set bit plus one via the float exponent.  Clearing each bit that has a set bit 8 places
+		// above it keeps the conversion from rounding up into the next power of two, and the sign bit
+		// case is patched afterwards.
+		inline __m256i FirstBitHighPlusOne8(__m256i value)
+		{
+#if GSTDDEC_CPU_SIMD_AVX512CD
+			return _mm256_sub_epi32(_mm256_set1_epi32(32), _mm256_lzcnt_epi32(value));
+#else
+			__m256i truncated = _mm256_andnot_si256(_mm256_srli_epi32(value, 8), value);
+			__m256i exponent = _mm256_srli_epi32(_mm256_castps_si256(_mm256_cvtepi32_ps(truncated)), 23);
+			__m256i result = _mm256_sub_epi32(_mm256_and_si256(exponent, _mm256_set1_epi32(0xff)), _mm256_set1_epi32(126));
+
+			result = _mm256_max_epi32(result, _mm256_setzero_si256());
+			return _mm256_max_epi32(result, _mm256_and_si256(_mm256_srai_epi32(value, 31), _mm256_set1_epi32(32)));
+#endif
+		}
+
+		// Lowest set bit plus one.  The isolated bit is a power of two so it converts exactly.
+		inline __m256i FirstBitLowPlusOne8(__m256i value)
+		{
+			__m256i lowBit = _mm256_and_si256(value, _mm256_sub_epi32(_mm256_setzero_si256(), value));
+
+#if GSTDDEC_CPU_SIMD_AVX512CD
+			__m256i result = _mm256_sub_epi32(_mm256_set1_epi32(32), _mm256_lzcnt_epi32(lowBit));
+#else
+			__m256i exponent = _mm256_srli_epi32(_mm256_castps_si256(_mm256_cvtepi32_ps(lowBit)), 23);
+			__m256i result = _mm256_sub_epi32(_mm256_and_si256(exponent, _mm256_set1_epi32(0xff)), _mm256_set1_epi32(126));
+#endif
+
+			return _mm256_max_epi32(result, _mm256_set1_epi32(1));
+		}
+
+		// Byte reverse with a shuffle, then reverse the bits of each byte with a nibble LUT
+		inline __m256i ReverseBits8(__m256i value)
+		{
+			const __m256i byteReverse = _mm256_setr_epi8(
+				3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+				3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+			const __m256i nibbleReverse = _mm256_setr_epi8(
+				0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe, 0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf,
+				0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe, 0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf);
+			const __m256i nibbleReverseHigh = _mm256_slli_epi16(nibbleReverse, 4);
+			const __m256i lowNibbleMask = _mm256_set1_epi8(0x0f);
+
+			value = _mm256_shuffle_epi8(value, byteReverse);
+
+			__m256i lowNibbles = _mm256_and_si256(value, lowNibbleMask);
+			__m256i highNibbles = _mm256_and_si256(_mm256_srli_epi16(value, 4), lowNibbleMask);
+
+			return _mm256_or_si256(_mm256_shuffle_epi8(nibbleReverseHigh, lowNibbles), _mm256_shuffle_epi8(nibbleReverse, highNibbles));
+		}
+
+		// For each 8-lane mask, the source index of every active lane packed as bytes.  Inactive lanes
+		// are 0 and get masked off by the caller.
+		struct ExpandPermuteTable
+		{
+			ExpandPermuteTable()
+			{
+				for (uint32_t mask = 0; mask < 256; mask++)
+				{
+					uint64_t indexes = 0;
+					uint32_t rank = 0;
+
+					for (uint32_t lane = 0; lane < 8; lane++)
+					{
+						if (mask & (1u << lane))
+							indexes |= static_cast<uint64_t>(rank++) << (lane * 8);
+					}
+
+					m_indexes[mask] = indexes;
+				}
+			}
+
+			uint64_t m_indexes[256];
+		};
+
+		inline const ExpandPermuteTable &GetExpandPermuteTable()
+		{
+			static const ExpandPermuteTable table;
+			return table;
+		}
+
+		inline uint32_t LaneMask8(const bool *laneMask)
+		{
+			__m128i maskBytes = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(laneMask));
+			return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(maskBytes, _mm_setzero_si128()))) & 0xffu;
+		}
+#endif
+
+		// Loads consecutive dwords from src into the active lanes of dest, in lane order.  Inactive lanes
+		// are zeroed.  Returns the number of dwords consumed.
+		// Up to numLanes dwords past src may be read, so src must have that many readable dwords.
+		inline uint32_t ExpandLoadDWords(const bool *laneMask, const uint32_t *src, uint32_t *dest, unsigned int numLanes)
+		{
+			const uint32_t *srcStart = src;
+			unsigned int lane = 0;
+
+#if GSTDDEC_CPU_SIMD_AVX512
+			for (; lane + 16 <= numLanes; lane += 16)
+			{
+				__m128i maskBytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(laneMask + lane));
+				__mmask16 mask = static_cast<__mmask16>(_mm_movemask_epi8(_mm_cmpgt_epi8(maskBytes, _mm_setzero_si128())));
+
+				_mm512_storeu_si512(dest + lane, _mm512_maskz_expandloadu_epi32(mask, src));
+				src += PopCount(mask);
+			}
+
+			for (; lane + 8 <= numLanes; lane += 8)
+			{
+				__mmask8 mask = static_cast<__mmask8>(LaneMask8(laneMask + lane));
+
+				_mm256_storeu_si256(reinterpret_cast<__m256i *>(dest + lane), _mm256_maskz_expandloadu_epi32(mask, src));
+				src += PopCount(mask);
+			}
+#elif GSTDDEC_CPU_SIMD_AVX2
+			const ExpandPermuteTable &permuteTable = GetExpandPermuteTable();
+
+			for (; lane + 8 <= numLanes; lane += 8)
+			{
+				uint32_t mask = LaneMask8(laneMask + lane);
+
+				__m256i indexes = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(permuteTable.m_indexes + mask)));
+				__m256i activeLanes = _mm256_cmpgt_epi32(_mm256_and_si256(_mm256_set1_epi32(static_cast<int>(mask)), _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128)), _mm256_setzero_si256());
+
+				__m256i loaded = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+				__m256i expanded = _mm256_and_si256(_mm256_permutevar8x32_epi32(loaded, indexes), activeLanes);
+
+				_mm256_storeu_si256(reinterpret_cast<__m256i *>(dest + lane), expanded);
+				src += PopCount(mask);
+			}
+#endif
+
+			for (; lane < numLanes; lane++)
+			{
+				if (laneMask[lane])
+					dest[lane] = *src++;
+				else
+					dest[lane] = 0;
+			}
+
+			return static_cast<uint32_t>(src - srcStart);
+		}
+
+		inline void FirstBitHighPlusOne(const uint32_t *values, uint32_t *results, unsigned int numLanes)
+		{
+			unsigned int lane = 0;
+
+#if GSTDDEC_CPU_SIMD_AVX512CD
+			for (; lane + 16 <= numLanes; lane += 16)
+				_mm512_storeu_si512(results + lane, _mm512_sub_epi32(_mm512_set1_epi32(32), _mm512_lzcnt_epi32(_mm512_loadu_si512(values + lane))));
+#endif
+
+#if GSTDDEC_CPU_SIMD_AVX2
+			for (; lane + 8 <= numLanes; lane += 8)
+				_mm256_storeu_si256(reinterpret_cast<__m256i *>(results + lane), FirstBitHighPlusOne8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + lane))));
+#endif
+
+			for (; lane < numLanes; lane++)
+				results[lane] = FirstBitHighPlusOne(values[lane]);
+		}
+
+		inline void FirstBitLowPlusOne(const uint32_t *values, uint32_t *results, unsigned int numLanes)
+		{
+			unsigned int lane = 0;
+
+#if GSTDDEC_CPU_SIMD_AVX2
+			for (; lane + 8 <= numLanes; lane += 8)
+				_mm256_storeu_si256(reinterpret_cast<__m256i *>(results + lane), FirstBitLowPlusOne8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + lane))));
+#endif
+
+			for (; lane < numLanes; lane++)
+				results[lane] = FirstBitLowPlusOne(values[lane]);
+		}
+
+		inline void ReverseBits(const uint32_t *values, uint32_t *results, unsigned int numLanes)
+		{
+			unsigned int lane = 0;
+
+#if GSTDDEC_CPU_SIMD_AVX2
+			for (; lane + 8 <= numLanes; lane += 8)
+				_mm256_storeu_si256(reinterpret_cast<__m256i *>(results + lane), ReverseBits8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + lane))));
+#endif
+
+			for (; lane < numLanes; lane++)
+				results[lane] = ReverseBits(values[lane]);
+		}
+	}
+GSTDDEC_NAMESPACE_END